@@ -0,0 +1,1506 @@
+#include "spr.h"
+#include "spr_shaders.h"
+#include "spr_thread.h"
+#include "spr_loader.h"
+#include "stl.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Rasterizer regression tests: every alternative path must reproduce the
+   reference image of the serial CPU rasterizer. */
+
+#define TEST_WIDTH 320
+#define TEST_HEIGHT 240
+
+typedef struct {
+    spr_mesh_t* mesh;
+    float cx, cy, cz, size;
+} test_scene_t;
+
+/* Pipeline settings for one render */
+typedef struct {
+    spr_rasterizer_mode_t mode;
+    float opacity;
+    int opaque_zbuffer;
+    int translucent_overlay; /* Draw the mesh again, shifted and 50% translucent */
+    int batch_shading;       /* Bind the SoA batch versions of the shaders */
+    int declare_varyings;    /* Interpolate only what the shader reads */
+    float eye_distance;      /* Camera distance in scene sizes */
+    spr_fragment_storage_t storage; /* A-buffer storage (zeroed: linked lists) */
+    size_t fragment_budget;  /* Fragment memory cap, 0 = unlimited */
+    spr_framebuffer_layout_t layout; /* Per-pixel state order (zeroed: linear) */
+    int parallel_resolve;    /* Resolve on the worker pool */
+    int parallel_geometry;   /* Vertex shading and clipping on the worker pool */
+    int instances;           /* > 0: draw the mesh as that many TEST_INSTANCES copies */
+    int separate_instances;  /* Draw the copies one call each, not instanced */
+    int index_bits;          /* 0: triangle soup, 16/32: draw through mesh->indices */
+    int batch_vertices;      /* Bind the batch versions of the vertex shaders */
+    int command_buffers;     /* 1: record the draws and submit them, 2: submit sorted */
+    int frames;              /* Frames drawn into one context (0 = one); the last is returned */
+} test_config_t;
+
+static test_config_t default_config(spr_rasterizer_mode_t mode, float opacity) {
+    test_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.mode = mode;
+    cfg.opacity = opacity;
+    cfg.eye_distance = 1.5f;
+    return cfg;
+}
+
+static int load_scene(test_scene_t* scene, const char* filename) {
+    int i;
+    float minx = 1e9f, miny = 1e9f, minz = 1e9f;
+    float maxx = -1e9f, maxy = -1e9f, maxz = -1e9f;
+
+    scene->mesh = spr_load_mesh(filename);
+    if (!scene->mesh) return 0;
+
+    for (i = 0; i < scene->mesh->vertex_count; ++i) {
+        float vx, vy, vz;
+        if (scene->mesh->type == SPR_MESH_STL) {
+            stl_vertex_t* v = &((stl_vertex_t*)scene->mesh->vertices)[i];
+            vx = v->x; vy = v->y; vz = v->z;
+        } else {
+            spr_vertex_t* v = &((spr_vertex_t*)scene->mesh->vertices)[i];
+            vx = v->position.x; vy = v->position.y; vz = v->position.z;
+        }
+        if (vx < minx) minx = vx;
+        if (vx > maxx) maxx = vx;
+        if (vy < miny) miny = vy;
+        if (vy > maxy) maxy = vy;
+        if (vz < minz) minz = vz;
+        if (vz > maxz) maxz = vz;
+    }
+    scene->cx = (minx + maxx) * 0.5f;
+    scene->cy = (miny + maxy) * 0.5f;
+    scene->cz = (minz + maxz) * 0.5f;
+    scene->size = maxx - minx;
+    if (maxy - miny > scene->size) scene->size = maxy - miny;
+    if (maxz - minz > scene->size) scene->size = maxz - minz;
+    if (scene->size <= 0.0001f) scene->size = 1.0f;
+    return 1;
+}
+
+/* Draws vertices [start, start + count) of the mesh as soup or indexed */
+static void draw_mesh_range(spr_context_t* ctx, const spr_mesh_t* mesh, int start, int count, size_t stride, int index_bits) {
+    int i;
+    if (index_bits == 32) {
+        spr_draw_indexed_triangles(ctx, count, mesh->indices + start, mesh->vertices, stride);
+    } else if (index_bits == 16) {
+        uint16_t* idx16 = (uint16_t*)malloc(count * sizeof(uint16_t));
+        assert(idx16 && mesh->vertex_count <= 65536);
+        for (i = 0; i < count; ++i) idx16[i] = (uint16_t)mesh->indices[start + i];
+        spr_draw_indexed_triangles16(ctx, count, idx16, mesh->vertices, stride);
+        free(idx16);
+    } else {
+        spr_draw_triangles(ctx, count / 3, (const uint8_t*)mesh->vertices + start * stride, stride);
+    }
+}
+
+#define TEST_INSTANCES 6
+
+/* Half-size copies of the scene, rotated about z, spread around the centre
+   and tinted */
+static void make_instances(const test_scene_t* scene, spr_shader_instance_t* inst, int n) {
+    int i;
+    for (i = 0; i < n; ++i) {
+        float a = 0.4f + 1.1f * (float)i;
+        float c = cosf(a) * 0.5f, s = sinf(a) * 0.5f;
+        float ox = scene->cx + scene->size * 0.35f * cosf(2.0f * (float)i);
+        float oy = scene->cy + scene->size * 0.35f * sinf(2.0f * (float)i);
+        mat4_t m = spr_mat4_identity();
+        /* Rotate and scale about the scene centre, then move to the offset */
+        m.m[0][0] = c; m.m[0][1] = -s; m.m[0][3] = ox - (c * scene->cx - s * scene->cy);
+        m.m[1][0] = s; m.m[1][1] = c;  m.m[1][3] = oy - (s * scene->cx + c * scene->cy);
+        m.m[2][2] = 0.5f;              m.m[2][3] = scene->cz * 0.5f;
+        inst[i].transform = m;
+        inst[i].color.x = 0.4f + 0.1f * (float)i;
+        inst[i].color.y = 1.0f - 0.1f * (float)i;
+        inst[i].color.z = (i & 1) ? 1.0f : 0.5f;
+        inst[i].color.w = 1.0f;
+    }
+}
+
+/* Draws a mesh range once, or once per instance: in one instanced call or,
+   with cfg->separate_instances, one call each */
+static void draw_instances(spr_context_t* ctx, const test_config_t* cfg, spr_shader_uniforms_t* u, const spr_shader_instance_t* inst,
+                           const spr_mesh_t* mesh, int start, int count, size_t stride) {
+    int i;
+    if (!cfg->instances) {
+        draw_mesh_range(ctx, mesh, start, count, stride, cfg->index_bits);
+    } else if (cfg->separate_instances) {
+        for (i = 0; i < cfg->instances; ++i) {
+            u->instances = &inst[i];
+            draw_mesh_range(ctx, mesh, start, count, stride, cfg->index_bits);
+        }
+    } else {
+        u->instances = inst;
+        if (cfg->index_bits) {
+            spr_draw_indexed_triangles_instanced(ctx, count, mesh->indices + start, mesh->vertices, stride, cfg->instances);
+        } else {
+            spr_draw_triangles_instanced(ctx, count / 3, (const uint8_t*)mesh->vertices + start * stride, stride, cfg->instances);
+        }
+    }
+    u->instances = NULL;
+}
+
+/* The scene's uniforms for the given camera matrices */
+static void scene_uniforms(spr_shader_uniforms_t* u, mat4_t projection, mat4_t modelview, spr_stats_t* stats, const test_config_t* cfg) {
+    memset(u, 0, sizeof(*u));
+    u->mvp = spr_mat4_mul(projection, modelview);
+    u->model = modelview;
+    u->roughness = 32.0f;
+    u->stats = stats;
+    spr_uniforms_set_light_dir(u, 0.5f, 0.7f, 1.0f);
+    /* Keep lit colours <= 1.0 so clamping never differs between paths */
+    spr_uniforms_set_color(u, 0.5f, 0.5f, 0.5f, 1.0f);
+    spr_uniforms_set_opacity(u, cfg->opacity, cfg->opacity, cfg->opacity);
+}
+
+static void group_uniforms(spr_shader_uniforms_t* u, const spr_mesh_group_t* group) {
+    if (!group->material) return;
+    spr_uniforms_set_color(u, group->material->Kd.x, group->material->Kd.y, group->material->Kd.z, 1.0f);
+    u->texture_ptr = group->material->map_Kd;
+    u->specular_map_ptr = group->material->map_Ks;
+    u->normal_map_ptr = group->material->norm ? group->material->norm : group->material->map_Bump;
+    u->Ks = group->material->Ks;
+    u->Ke = group->material->Ke;
+}
+
+/* The overlay: shifted, blue and 50% translucent */
+static void overlay_uniforms(spr_shader_uniforms_t* u, mat4_t projection, mat4_t modelview) {
+    u->mvp = spr_mat4_mul(projection, modelview);
+    u->model = modelview;
+    spr_uniforms_set_color(u, 0.2f, 0.4f, 0.9f, 1.0f);
+    spr_uniforms_set_opacity(u, 0.5f, 0.5f, 0.5f);
+}
+
+/* Recording the scene into command buffers: the mesh on one thread and
+   the overlay on another, each into its own buffer */
+typedef struct {
+    const test_scene_t* scene;
+    const test_config_t* cfg;
+    mat4_t projection, modelview, overlay_modelview;
+    spr_stats_t* stats;
+    const spr_shader_instance_t* inst;
+    spr_command_buffer_t* cb[2];
+} test_recording_t;
+
+static void make_pipeline(spr_pipeline_t* p, const test_config_t* cfg, spr_shader_uniforms_t* u, spr_vertex_shader_t vs, spr_vertex_shader_batch_t vs_batch,
+                          spr_fragment_shader_t fs, spr_fragment_shader_batch_t fs_batch, uint32_t sort_key) {
+    memset(p, 0, sizeof(*p));
+    p->vs = vs;
+    p->vs_batch = cfg->batch_vertices ? vs_batch : NULL;
+    p->fs = fs;
+    p->fs_batch = cfg->batch_shading ? fs_batch : NULL;
+    p->uniform_data = u;
+    p->uniform_size = sizeof(*u);
+    p->varyings = cfg->declare_varyings ? spr_shader_varyings(fs, u) : 0;
+    p->sort_key = sort_key;
+}
+
+static void record_mesh_range(spr_command_buffer_t* cb, const spr_pipeline_t* p, const test_config_t* cfg, int instances,
+                              const spr_mesh_t* mesh, int start, int count, size_t stride) {
+    int ok;
+    if (cfg->index_bits) {
+        ok = spr_cmd_draw_indexed_triangles(cb, p, count, mesh->indices + start, mesh->vertices, stride, instances);
+    } else {
+        ok = spr_cmd_draw_triangles(cb, p, count / 3, (const uint8_t*)mesh->vertices + start * stride, stride, instances);
+    }
+    assert(ok);
+}
+
+static void record_job(void* user_data, int job_index, int worker_index) {
+    test_recording_t* rec = (test_recording_t*)user_data;
+    const test_config_t* cfg = rec->cfg;
+    spr_mesh_t* mesh = rec->scene->mesh;
+    spr_command_buffer_t* cb = rec->cb[job_index];
+    size_t stride = (mesh->type == SPR_MESH_STL) ? sizeof(stl_vertex_t) : sizeof(spr_vertex_t);
+    int instances = cfg->instances ? cfg->instances : 1;
+    spr_shader_uniforms_t u;
+    spr_pipeline_t p;
+    int g;
+    (void)worker_index;
+
+    /* The pipelines copy u, so it is reused (and goes out of scope) freely */
+    scene_uniforms(&u, rec->projection, rec->modelview, rec->stats, cfg);
+    if (cfg->instances) u.instances = rec->inst;
+    if (job_index == 1) {
+        u.instances = NULL;
+        overlay_uniforms(&u, rec->projection, rec->overlay_modelview);
+        make_pipeline(&p, cfg, &u, spr_shader_plastic_vs, spr_shader_plastic_vs_batch, spr_shader_plastic_fs, spr_shader_plastic_fs_batch, 1);
+        record_mesh_range(cb, &p, cfg, 1, mesh, 0, mesh->vertex_count, stride);
+    } else if (mesh->type == SPR_MESH_STL) {
+        make_pipeline(&p, cfg, &u, spr_shader_plastic_vs, spr_shader_plastic_vs_batch, spr_shader_plastic_fs, spr_shader_plastic_fs_batch, 0);
+        record_mesh_range(cb, &p, cfg, instances, mesh, 0, mesh->vertex_count, stride);
+    } else {
+        for (g = 0; g < mesh->group_count; ++g) {
+            group_uniforms(&u, &mesh->groups[g]);
+            make_pipeline(&p, cfg, &u, spr_shader_textured_vs, spr_shader_textured_vs_batch, spr_shader_mtl_fs, spr_shader_mtl_fs_batch, 0);
+            record_mesh_range(cb, &p, cfg, instances, mesh, mesh->groups[g].start_vertex, mesh->groups[g].vertex_count, stride);
+        }
+    }
+}
+
+/* Records what draw_scene() draws and submits it: in order or, with
+   cfg->command_buffers == 2, with the buffers swapped and sorted back */
+static void submit_scene(spr_context_t* ctx, const test_scene_t* scene, const test_config_t* cfg) {
+    test_recording_t rec;
+    spr_shader_instance_t inst[TEST_INSTANCES];
+    spr_thread_pool_t* pool = spr_thread_pool_create(2);
+    int jobs = (cfg->translucent_overlay && scene->mesh->type == SPR_MESH_STL) ? 2 : 1;
+
+    make_instances(scene, inst, TEST_INSTANCES);
+    rec.scene = scene;
+    rec.cfg = cfg;
+    rec.projection = spr_get_projection_matrix(ctx);
+    rec.modelview = spr_get_modelview_matrix(ctx);
+    spr_push_matrix(ctx);
+    spr_translate(ctx, scene->size * 0.15f, scene->size * 0.1f, scene->size * 0.2f);
+    rec.overlay_modelview = spr_get_modelview_matrix(ctx);
+    spr_pop_matrix(ctx);
+    rec.stats = spr_get_stats_ptr(ctx);
+    rec.inst = inst;
+    rec.cb[0] = spr_command_buffer_create();
+    rec.cb[1] = spr_command_buffer_create();
+    assert(pool && rec.cb[0] && rec.cb[1]);
+
+    spr_thread_pool_run(pool, record_job, &rec, jobs);
+    if (cfg->command_buffers == 2) {
+        spr_command_buffer_t* swapped[2];
+        swapped[0] = rec.cb[1];
+        swapped[1] = rec.cb[0];
+        spr_submit(ctx, swapped, 2, SPR_SUBMIT_SORTED);
+    } else {
+        spr_submit(ctx, rec.cb, 2, 0);
+    }
+
+    spr_command_buffer_destroy(rec.cb[0]);
+    spr_command_buffer_destroy(rec.cb[1]);
+    spr_thread_pool_destroy(pool);
+}
+
+/* Issues the scene's draw calls with the current modelview matrix */
+static void draw_scene(spr_context_t* ctx, const test_scene_t* scene, const test_config_t* cfg) {
+    spr_mesh_t* mesh = scene->mesh;
+    spr_shader_uniforms_t u;
+    spr_shader_instance_t inst[TEST_INSTANCES];
+    size_t stride = (mesh->type == SPR_MESH_STL) ? sizeof(stl_vertex_t) : sizeof(spr_vertex_t);
+    int g;
+
+    assert(cfg->instances <= TEST_INSTANCES);
+    if (cfg->command_buffers) {
+        submit_scene(ctx, scene, cfg);
+        return;
+    }
+    make_instances(scene, inst, TEST_INSTANCES);
+    scene_uniforms(&u, spr_get_projection_matrix(ctx), spr_get_modelview_matrix(ctx), spr_get_stats_ptr(ctx), cfg);
+
+    if (mesh->type == SPR_MESH_STL) {
+        spr_set_program(ctx, spr_shader_plastic_vs, spr_shader_plastic_fs, &u);
+        if (cfg->batch_shading) spr_set_fragment_shader_batch(ctx, spr_shader_plastic_fs_batch);
+        if (cfg->batch_vertices) spr_set_vertex_shader_batch(ctx, spr_shader_plastic_vs_batch);
+        if (cfg->declare_varyings) spr_set_varyings(ctx, spr_shader_varyings(spr_shader_plastic_fs, &u));
+        draw_instances(ctx, cfg, &u, inst, mesh, 0, mesh->vertex_count, stride);
+    } else {
+        for (g = 0; g < mesh->group_count; ++g) {
+            spr_mesh_group_t* group = &mesh->groups[g];
+            group_uniforms(&u, group);
+            spr_set_program(ctx, spr_shader_textured_vs, spr_shader_mtl_fs, &u);
+            if (cfg->batch_shading) spr_set_fragment_shader_batch(ctx, spr_shader_mtl_fs_batch);
+            if (cfg->batch_vertices) spr_set_vertex_shader_batch(ctx, spr_shader_textured_vs_batch);
+            if (cfg->declare_varyings) spr_set_varyings(ctx, spr_shader_varyings(spr_shader_mtl_fs, &u));
+            draw_instances(ctx, cfg, &u, inst, mesh, group->start_vertex, group->vertex_count, stride);
+        }
+    }
+    if (cfg->translucent_overlay && mesh->type == SPR_MESH_STL) {
+        spr_push_matrix(ctx);
+        spr_translate(ctx, scene->size * 0.15f, scene->size * 0.1f, scene->size * 0.2f);
+        overlay_uniforms(&u, spr_get_projection_matrix(ctx), spr_get_modelview_matrix(ctx));
+        draw_mesh_range(ctx, mesh, 0, mesh->vertex_count, stride, cfg->index_bits);
+        spr_pop_matrix(ctx);
+    }
+}
+
+/* Loads the test camera into the projection and modelview matrices */
+static void setup_camera(spr_context_t* ctx, const test_scene_t* scene, const test_config_t* cfg) {
+    vec3_t eye = {0.0f, 0.0f, scene->size * cfg->eye_distance};
+    vec3_t center = {0.0f, 0.0f, 0.0f};
+    vec3_t up = {0.0f, 1.0f, 0.0f};
+
+    spr_matrix_mode(ctx, SPR_PROJECTION);
+    spr_load_identity(ctx);
+    spr_perspective(ctx, 45.0f, (float)TEST_WIDTH / (float)TEST_HEIGHT, scene->size * 0.01f, scene->size * 10.0f);
+    spr_matrix_mode(ctx, SPR_MODELVIEW);
+    spr_load_identity(ctx);
+    spr_lookat(ctx, eye, center, up);
+    spr_rotate(ctx, 25.0f, 1, 0, 0);
+    spr_rotate(ctx, 35.0f, 0, 1, 0);
+    spr_translate(ctx, -scene->cx, -scene->cy, -scene->cz);
+}
+
+/* Renders the scene the way the viewer does and returns a copy of the frame */
+static uint32_t* render_scene(const test_scene_t* scene, const test_config_t* cfg, spr_stats_t* stats_out) {
+    spr_context_t* ctx = spr_init(TEST_WIDTH, TEST_HEIGHT);
+    uint32_t* frame;
+    int f;
+
+    assert(ctx != NULL);
+    spr_set_rasterizer_mode(ctx, cfg->mode);
+    spr_set_thread_count(ctx, 4); /* Exercise the worker pool even on small machines */
+    spr_enable_opaque_zbuffer(ctx, cfg->opaque_zbuffer);
+    spr_set_fragment_storage(ctx, cfg->storage);
+    spr_set_fragment_budget(ctx, cfg->fragment_budget);
+    spr_set_framebuffer_layout(ctx, cfg->layout);
+    spr_enable_parallel_resolve(ctx, cfg->parallel_resolve);
+    spr_enable_parallel_geometry(ctx, cfg->parallel_geometry);
+    for (f = 0; f < (cfg->frames ? cfg->frames : 1); ++f) {
+        spr_clear(ctx, spr_make_color(30, 30, 30, 255), 1.0f);
+        setup_camera(ctx, scene, cfg);
+
+        /* Counted storage replays the geometry after a count pass */
+        draw_scene(ctx, scene, cfg);
+        if (cfg->storage == SPR_FRAGMENT_STORAGE_COUNTED) {
+            spr_end_count_pass(ctx);
+            draw_scene(ctx, scene, cfg);
+        }
+        spr_resolve(ctx);
+    }
+
+    frame = (uint32_t*)malloc(TEST_WIDTH * TEST_HEIGHT * sizeof(uint32_t));
+    assert(frame != NULL);
+    memcpy(frame, spr_get_color_buffer(ctx), TEST_WIDTH * TEST_HEIGHT * sizeof(uint32_t));
+    if (stats_out) *stats_out = spr_get_stats(ctx);
+    spr_shutdown(ctx);
+    return frame;
+}
+
+static int count_diffs(const uint32_t* a, const uint32_t* b) {
+    int i, diffs = 0;
+    for (i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i) if (a[i] != b[i]) diffs++;
+    return diffs;
+}
+
+static int count_covered(const uint32_t* frame) {
+    int i, covered = 0;
+    uint32_t bg = spr_make_color(30, 30, 30, 255);
+    for (i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i) if (frame[i] != bg) covered++;
+    return covered;
+}
+
+/* Largest per-channel difference between two frames */
+static int max_channel_diff(const uint32_t* a, const uint32_t* b) {
+    int i, c, max_diff = 0;
+    for (i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i) {
+        for (c = 0; c < 24; c += 8) {
+            int d = (int)((a[i] >> c) & 0xFF) - (int)((b[i] >> c) & 0xFF);
+            if (d < 0) d = -d;
+            if (d > max_diff) max_diff = d;
+        }
+    }
+    return max_diff;
+}
+
+static void test_tiled_matches_cpu(const test_scene_t* scene, const char* name, float opacity) {
+    test_config_t cpu_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    test_config_t tiled_cfg = default_config(SPR_RASTERIZER_TILED, opacity);
+    uint32_t* ref;
+    uint32_t* tiled;
+    int diffs;
+
+    printf("Testing SPR_RASTERIZER_TILED on %s (opacity %.2f)...\n", name, opacity);
+    ref = render_scene(scene, &cpu_cfg, NULL);
+    tiled = render_scene(scene, &tiled_cfg, NULL);
+
+    assert(count_covered(ref) > 0);
+    diffs = count_diffs(ref, tiled);
+    printf("Covered: %d pixels, differing: %d\n", count_covered(ref), diffs);
+    assert(diffs == 0);
+    printf("Pass: tiled output is bit-identical to CPU.\n");
+
+    free(ref);
+    free(tiled);
+}
+
+static void test_opaque_zbuffer(const test_scene_t* scene, const char* name, float opacity) {
+    test_config_t abuf_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    test_config_t hybrid_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    test_config_t tiled_cfg = default_config(SPR_RASTERIZER_TILED, opacity);
+    spr_stats_t abuf_stats, hybrid_stats;
+    uint32_t* ref;
+    uint32_t* hybrid;
+    uint32_t* tiled;
+    int max_diff;
+
+    printf("Testing hybrid z-buffer on %s (opacity %.2f)...\n", name, opacity);
+    hybrid_cfg.opaque_zbuffer = 1;
+    tiled_cfg.opaque_zbuffer = 1;
+    abuf_cfg.translucent_overlay = hybrid_cfg.translucent_overlay = tiled_cfg.translucent_overlay = 1;
+    ref = render_scene(scene, &abuf_cfg, &abuf_stats);
+    hybrid = render_scene(scene, &hybrid_cfg, &hybrid_stats);
+    tiled = render_scene(scene, &tiled_cfg, NULL);
+
+    /* Opaque colour is quantised before compositing: allow one step */
+    max_diff = max_channel_diff(ref, hybrid);
+    printf("Max channel difference: %d, A-buffer fragments: %d -> %d\n", max_diff, abuf_stats.peak_fragments, hybrid_stats.peak_fragments);
+    assert(max_diff <= 1);
+    assert(count_diffs(hybrid, tiled) == 0);
+    assert(hybrid_stats.peak_fragments <= abuf_stats.peak_fragments);
+    printf("Pass: hybrid z-buffer matches the A-buffer.\n");
+
+    free(ref);
+    free(hybrid);
+    free(tiled);
+}
+
+static const char* kernel_name(spr_rasterizer_mode_t kernel) {
+    switch (kernel) {
+        case SPR_RASTERIZER_SIMD: return "SSE2";
+        case SPR_RASTERIZER_AVX2: return "AVX2";
+        case SPR_RASTERIZER_AVX512: return "AVX-512";
+        default: return "scalar";
+    }
+}
+
+/* Every SIMD kernel the CPU supports must reproduce the scalar image. Kernels
+   it lacks fall back to a narrower one, which the stats must report. */
+static void test_simd_kernels(const test_scene_t* scene, const char* name, float opacity) {
+    static const spr_rasterizer_mode_t modes[] = { SPR_RASTERIZER_SIMD, SPR_RASTERIZER_AVX2, SPR_RASTERIZER_AVX512 };
+    test_config_t cpu_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    uint32_t* ref;
+    int m;
+
+    printf("Testing SIMD kernels on %s (opacity %.2f)...\n", name, opacity);
+    ref = render_scene(scene, &cpu_cfg, NULL);
+    for (m = 0; m < 3; ++m) {
+        test_config_t cfg = default_config(modes[m], opacity);
+        spr_stats_t stats;
+        uint32_t* frame = render_scene(scene, &cfg, &stats);
+        int diffs = count_diffs(ref, frame);
+
+        printf("Kernel %s (%d wide), differing: %d\n", kernel_name(stats.rasterizer_kernel), stats.simd_width, diffs);
+        assert(stats.simd_width >= 1 && stats.simd_width <= 16);
+        assert(diffs == 0);
+        free(frame);
+    }
+    printf("Pass: SIMD kernels are bit-identical to CPU.\n");
+    free(ref);
+}
+
+/* Batch shaders only differ from the scalar ones in their vector pow(), and
+   every kernel must feed them the same fragments */
+static void test_batch_shading(const test_scene_t* scene, const char* name, float opacity) {
+    test_config_t scalar_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    test_config_t batch_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    test_config_t simd_cfg = default_config(SPR_RASTERIZER_SIMD, opacity);
+    test_config_t tiled_cfg = default_config(SPR_RASTERIZER_TILED, opacity);
+    spr_stats_t scalar_stats, batch_stats;
+    uint32_t* ref;
+    uint32_t* batch;
+    uint32_t* simd;
+    uint32_t* tiled;
+    int max_diff;
+
+    printf("Testing batch shading on %s (opacity %.2f)...\n", name, opacity);
+    batch_cfg.batch_shading = simd_cfg.batch_shading = tiled_cfg.batch_shading = 1;
+    ref = render_scene(scene, &scalar_cfg, &scalar_stats);
+    batch = render_scene(scene, &batch_cfg, &batch_stats);
+    simd = render_scene(scene, &simd_cfg, NULL);
+    tiled = render_scene(scene, &tiled_cfg, NULL);
+
+    max_diff = max_channel_diff(ref, batch);
+    printf("Max channel difference: %d, texture samples: %llu -> %llu\n", max_diff,
+           (unsigned long long)scalar_stats.texture_samples, (unsigned long long)batch_stats.texture_samples);
+    assert(max_diff <= 1);
+    assert(batch_stats.texture_samples == scalar_stats.texture_samples);
+    assert(count_diffs(batch, simd) == 0);
+    assert(count_diffs(batch, tiled) == 0);
+    printf("Pass: batch shaders match the scalar shaders.\n");
+
+    free(ref);
+    free(batch);
+    free(simd);
+    free(tiled);
+}
+
+/* Pixels already hidden are rejected before shading. The CPU reference does
+   the same, so check that the test fires and that tiles skip the same pixels. */
+static void test_saturation_skip(const test_scene_t* scene, const char* name) {
+    test_config_t cpu_cfg = default_config(SPR_RASTERIZER_CPU, 1.0f);
+    test_config_t tiled_cfg = default_config(SPR_RASTERIZER_TILED, 1.0f);
+    spr_stats_t cpu_stats, tiled_stats;
+    uint32_t* ref;
+    uint32_t* tiled;
+
+    printf("Testing saturated pixel rejection on %s...\n", name);
+    ref = render_scene(scene, &cpu_cfg, &cpu_stats);
+    tiled = render_scene(scene, &tiled_cfg, &tiled_stats);
+
+    printf("Skipped: %llu fragments, texture samples: %llu\n",
+           (unsigned long long)cpu_stats.skipped_fragments, (unsigned long long)cpu_stats.texture_samples);
+    assert(cpu_stats.skipped_fragments > 0);
+    assert(tiled_stats.skipped_fragments == cpu_stats.skipped_fragments);
+    assert(count_diffs(ref, tiled) == 0);
+    printf("Pass: hidden pixels were not shaded.\n");
+
+    free(ref);
+    free(tiled);
+}
+
+/* Declaring the varyings a shader reads must not change what it sees */
+static void test_declared_varyings(const test_scene_t* scene, const char* name, float opacity) {
+    static const spr_rasterizer_mode_t modes[] = { SPR_RASTERIZER_CPU, SPR_RASTERIZER_SIMD, SPR_RASTERIZER_TILED };
+    test_config_t all_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    uint32_t* ref;
+    int m, b;
+
+    printf("Testing declared varyings on %s (opacity %.2f)...\n", name, opacity);
+    ref = render_scene(scene, &all_cfg, NULL);
+    for (m = 0; m < 3; ++m) {
+        for (b = 0; b < 2; ++b) {
+            test_config_t cfg = default_config(modes[m], opacity);
+            uint32_t* frame;
+            cfg.declare_varyings = 1;
+            cfg.batch_shading = b;
+            frame = render_scene(scene, &cfg, NULL);
+            if (b) assert(max_channel_diff(ref, frame) <= 1);
+            else assert(count_diffs(ref, frame) == 0);
+            free(frame);
+        }
+    }
+    printf("Pass: declared varyings match full interpolation.\n");
+    free(ref);
+}
+
+/* K-buffer, append and counted storage must reproduce the sorted list image exactly,
+   including pixels deep enough to overflow the k-buffer into its list, in
+   every mode that inserts. */
+static void test_fragment_storage(const test_scene_t* scene, const char* name, float opacity, spr_fragment_storage_t storage) {
+    test_config_t list_cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    const char* storage_name = storage == SPR_FRAGMENT_STORAGE_KBUFFER ? "k-buffer" :
+                               storage == SPR_FRAGMENT_STORAGE_APPEND ? "append" : "counted";
+    uint32_t* ref;
+    int m, hybrid;
+
+    printf("Testing %s storage on %s (opacity %.2f)...\n", storage_name, name, opacity);
+    list_cfg.translucent_overlay = 1;
+    list_cfg.eye_distance = 1.0f;
+    for (hybrid = 0; hybrid < 2; ++hybrid) {
+        list_cfg.opaque_zbuffer = hybrid;
+        ref = render_scene(scene, &list_cfg, NULL);
+        for (m = 0; m < 2; ++m) {
+            test_config_t cfg = list_cfg;
+            spr_stats_t stats;
+            uint32_t* frame;
+            cfg.mode = m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU;
+            cfg.storage = storage;
+            frame = render_scene(scene, &cfg, &stats);
+            printf("%s%s: peak fragments %d, overflow fragments %llu, differing: %d\n", m ? "Tiled" : "CPU", hybrid ? " + z-buffer" : "",
+                   stats.peak_fragments, (unsigned long long)stats.kbuffer_overflow_fragments, count_diffs(ref, frame));
+            assert(count_diffs(ref, frame) == 0);
+            if (storage == SPR_FRAGMENT_STORAGE_KBUFFER && !hybrid && opacity < 1.0f) assert(stats.kbuffer_overflow_fragments > 0);
+            free(frame);
+        }
+        free(ref);
+    }
+    printf("Pass: %s storage matches sorted lists.\n", storage_name);
+}
+
+/* Compact storage is lossy: colours may move by about one 8-bit step, but
+   it must agree between CPU and tiled and use well under half the memory. */
+static void test_compact_fragments(const test_scene_t* scene, const char* name, float opacity) {
+    test_config_t cfg = default_config(SPR_RASTERIZER_CPU, opacity);
+    spr_stats_t list_stats, compact_stats;
+    uint32_t* ref;
+    uint32_t* compact;
+    uint32_t* tiled;
+    int max_diff;
+
+    printf("Testing compact fragments on %s (opacity %.2f)...\n", name, opacity);
+    cfg.translucent_overlay = 1;
+    cfg.eye_distance = 1.0f;
+    ref = render_scene(scene, &cfg, &list_stats);
+    cfg.storage = SPR_FRAGMENT_STORAGE_COMPACT;
+    compact = render_scene(scene, &cfg, &compact_stats);
+    cfg.mode = SPR_RASTERIZER_TILED;
+    tiled = render_scene(scene, &cfg, NULL);
+
+    max_diff = max_channel_diff(ref, compact);
+    printf("Fragment size: %d -> %d bytes, memory: %llu -> %llu bytes, max channel diff: %d\n",
+           list_stats.fragment_size, compact_stats.fragment_size,
+           (unsigned long long)list_stats.fragment_bytes, (unsigned long long)compact_stats.fragment_bytes, max_diff);
+    assert(compact_stats.fragment_size * 2 < list_stats.fragment_size);
+    assert(compact_stats.fragment_bytes * 2 < list_stats.fragment_bytes);
+    assert(max_diff <= 2);
+    assert(count_diffs(compact, tiled) == 0);
+    printf("Pass: compact fragments within tolerance.\n");
+
+    free(ref);
+    free(compact);
+    free(tiled);
+}
+
+/* Under a budget of half what the scene needs, storage must stay within
+   it and merge layers instead: covered pixels are still drawn and the
+   image stays close to the unlimited one. A second frame in the same
+   context must use nearly all of the budget before it merges. */
+static void test_fragment_budget(const test_scene_t* scene, const char* name) {
+    const spr_fragment_storage_t storages[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_KBUFFER, SPR_FRAGMENT_STORAGE_APPEND, SPR_FRAGMENT_STORAGE_COMPACT};
+    int st, m;
+
+    printf("Testing fragment memory budget on %s...\n", name);
+    for (st = 0; st < 4; ++st) {
+        test_config_t cfg = default_config(SPR_RASTERIZER_CPU, 0.3f);
+        spr_stats_t ref_stats;
+        uint32_t* ref;
+
+        cfg.translucent_overlay = 1;
+        cfg.eye_distance = 1.0f;
+        cfg.storage = storages[st];
+        ref = render_scene(scene, &cfg, &ref_stats);
+        cfg.fragment_budget = (size_t)(ref_stats.fragment_bytes / 2);
+        for (m = 0; m < 4; ++m) {
+            spr_stats_t stats;
+            uint32_t* frame;
+            cfg.mode = m & 1 ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU;
+            cfg.frames = 1 + m / 2;
+            frame = render_scene(scene, &cfg, &stats);
+            printf("%s, storage %d, frame %d: budget %llu of %llu bytes, used %llu, merged %llu, max channel diff %d\n",
+                   m & 1 ? "Tiled" : "CPU", (int)cfg.storage, cfg.frames, (unsigned long long)cfg.fragment_budget,
+                   (unsigned long long)ref_stats.fragment_bytes, (unsigned long long)stats.fragment_bytes,
+                   (unsigned long long)stats.merged_fragments, max_channel_diff(ref, frame));
+            assert(stats.fragment_bytes <= cfg.fragment_budget);
+            assert(stats.merged_fragments > 0);
+            /* Once a frame has shown how many pixels need a first layer, only
+               those are kept back, so merging waits for the budget to be all
+               but used (k-buffer overflow gets just two chunks here). Tiled
+               workers each keep a chunk's worth back: what is left of a
+               worker's last chunk serves no other worker's tiles. */
+            if (cfg.frames > 1 && cfg.storage != SPR_FRAGMENT_STORAGE_KBUFFER) {
+                assert(stats.fragment_bytes * 8 > cfg.fragment_budget * (m & 1 ? 6 : 7));
+            }
+            assert(abs(count_covered(frame) - count_covered(ref)) * 1000 < count_covered(ref));
+            assert(max_channel_diff(ref, frame) <= 64);
+            free(frame);
+        }
+        free(ref);
+    }
+    printf("Pass: fragment budget is respected.\n");
+}
+
+/* The fragment arena keeps its chunks: after the first frame, identical
+   frames must render the same image without a single heap allocation. */
+static void test_steady_state_frames(const test_scene_t* scene, const char* name) {
+    const spr_fragment_storage_t storages[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_APPEND, SPR_FRAGMENT_STORAGE_COMPACT};
+    const unsigned int arenas[] = {0, SPR_ARENA_PRESIZE | SPR_ARENA_HUGE_PAGES};
+    int m, st, a, f;
+
+    printf("Testing steady-state frame allocations on %s...\n", name);
+    for (m = 0; m < 2; ++m) {
+        for (st = 0; st < 3; ++st) {
+            for (a = 0; a < 2; ++a) {
+                test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, 0.3f);
+                spr_context_t* ctx = spr_init(TEST_WIDTH, TEST_HEIGHT);
+                uint32_t* first = (uint32_t*)malloc(TEST_WIDTH * TEST_HEIGHT * sizeof(uint32_t));
+                uint64_t allocations[3];
+
+                assert(ctx != NULL && first != NULL);
+                cfg.translucent_overlay = 1;
+                cfg.eye_distance = 1.0f;
+                cfg.storage = storages[st];
+                spr_set_rasterizer_mode(ctx, cfg.mode);
+                spr_set_thread_count(ctx, 4);
+                spr_set_fragment_storage(ctx, cfg.storage);
+                spr_set_fragment_arena(ctx, arenas[a]);
+                for (f = 0; f < 3; ++f) {
+                    spr_clear(ctx, spr_make_color(30, 30, 30, 255), 1.0f);
+                    setup_camera(ctx, scene, &cfg);
+                    draw_scene(ctx, scene, &cfg);
+                    spr_resolve(ctx);
+                    allocations[f] = spr_get_stats(ctx).heap_allocations;
+                    if (f == 0) {
+                        memcpy(first, spr_get_color_buffer(ctx), TEST_WIDTH * TEST_HEIGHT * sizeof(uint32_t));
+                    } else {
+                        assert(count_diffs(first, spr_get_color_buffer(ctx)) == 0);
+                    }
+                }
+                printf("%s, storage %d, arena flags %u: heap allocations per frame %llu, %llu, %llu\n",
+                       m ? "Tiled" : "CPU", (int)cfg.storage, arenas[a], (unsigned long long)allocations[0],
+                       (unsigned long long)allocations[1], (unsigned long long)allocations[2]);
+                assert(allocations[0] > 0);
+                /* Frame 2 may still grow: its clear adds the arena's headroom
+                   (one chunk per pool, more with SPR_ARENA_PRESIZE), which
+                   covers tiles being shared out differently from then on */
+                assert(allocations[2] == 0);
+                free(first);
+                spr_shutdown(ctx);
+            }
+        }
+    }
+    printf("Pass: steady-state frames do not allocate.\n");
+}
+
+/* The tiled framebuffer layout only reorders memory: every storage mode,
+   rasterizer and the hybrid z-buffer must give the linear layout's image
+   (240 rows also leave the last tile row partly off screen). */
+static void test_framebuffer_layout(const test_scene_t* scene, const char* name, float opacity) {
+    const spr_fragment_storage_t storages[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_KBUFFER, SPR_FRAGMENT_STORAGE_COUNTED, SPR_FRAGMENT_STORAGE_COMPACT};
+    int m, st, hybrid;
+
+    printf("Testing tiled framebuffer layout on %s (opacity %.2f)...\n", name, opacity);
+    for (m = 0; m < 2; ++m) {
+        for (st = 0; st < 4; ++st) {
+            for (hybrid = 0; hybrid < 2; ++hybrid) {
+                test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+                uint32_t* linear;
+                uint32_t* tiled;
+                cfg.translucent_overlay = 1;
+                cfg.storage = storages[st];
+                cfg.opaque_zbuffer = hybrid;
+                linear = render_scene(scene, &cfg, NULL);
+                cfg.layout = SPR_FRAMEBUFFER_TILED;
+                tiled = render_scene(scene, &cfg, NULL);
+                printf("%s, storage %d%s: differing: %d\n", m ? "Tiled" : "CPU", (int)cfg.storage,
+                       hybrid ? " + z-buffer" : "", count_diffs(linear, tiled));
+                assert(count_covered(linear) > 0);
+                assert(count_diffs(linear, tiled) == 0);
+                free(linear);
+                free(tiled);
+            }
+        }
+    }
+    printf("Pass: tiled layout matches the linear one.\n");
+}
+
+/* The parallel resolve must reproduce the serial one exactly, whichever
+   rasterizer filled the A-buffer (append storage also exercises the
+   per-worker sort scratch) */
+static void test_parallel_resolve(const test_scene_t* scene, const char* name, float opacity) {
+    const spr_fragment_storage_t storages[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_KBUFFER, SPR_FRAGMENT_STORAGE_APPEND, SPR_FRAGMENT_STORAGE_COUNTED, SPR_FRAGMENT_STORAGE_COMPACT};
+    int m, st;
+
+    printf("Testing parallel resolve on %s (opacity %.2f)...\n", name, opacity);
+    for (m = 0; m < 2; ++m) {
+        for (st = 0; st < 5; ++st) {
+            test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+            uint32_t* serial;
+            uint32_t* parallel;
+            cfg.translucent_overlay = 1;
+            cfg.storage = storages[st];
+            cfg.layout = (st & 1) ? SPR_FRAMEBUFFER_TILED : SPR_FRAMEBUFFER_LINEAR;
+            serial = render_scene(scene, &cfg, NULL);
+            cfg.parallel_resolve = 1;
+            parallel = render_scene(scene, &cfg, NULL);
+            printf("%s, storage %d: differing: %d\n", m ? "Tiled" : "CPU", (int)cfg.storage, count_diffs(serial, parallel));
+            assert(count_covered(serial) > 0);
+            assert(count_diffs(serial, parallel) == 0);
+            free(serial);
+            free(parallel);
+        }
+    }
+    printf("Pass: parallel resolve matches the serial one.\n");
+}
+
+/* The parallel front end must feed the rasterizer the same triangles in the
+   same order, for soup and indexed draws, with and without batch vertex
+   shaders, and with the camera close enough that triangles get clipped */
+static void test_parallel_geometry(const test_scene_t* scene, const char* name, float opacity) {
+    int m, v;
+
+    printf("Testing parallel geometry on %s (opacity %.2f)...\n", name, opacity);
+    for (m = 0; m < 2; ++m) {
+        for (v = 0; v < 8; ++v) {
+            test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+            spr_stats_t serial_stats, parallel_stats;
+            uint32_t* serial;
+            uint32_t* parallel;
+            cfg.translucent_overlay = 1;
+            cfg.index_bits = (v & 1) ? 32 : 0;
+            cfg.batch_vertices = (v >> 1) & 1;
+            cfg.eye_distance = (v & 4) ? 0.1f : 1.5f;
+            serial = render_scene(scene, &cfg, &serial_stats);
+            cfg.parallel_geometry = 1;
+            parallel = render_scene(scene, &cfg, &parallel_stats);
+            printf("%s, %s%s, eye %.2f: clipped %llu, rejected %llu, differing: %d\n", m ? "Tiled" : "CPU",
+                   cfg.index_bits ? "indexed" : "soup", cfg.batch_vertices ? " (batch VS)" : "", cfg.eye_distance,
+                   (unsigned long long)parallel_stats.clipped_triangles, (unsigned long long)parallel_stats.frustum_rejected_triangles,
+                   count_diffs(serial, parallel));
+            assert(count_covered(serial) > 0);
+            assert(count_diffs(serial, parallel) == 0);
+            assert(parallel_stats.shaded_vertices == serial_stats.shaded_vertices);
+            assert(parallel_stats.clipped_triangles == serial_stats.clipped_triangles);
+            assert(parallel_stats.frustum_rejected_triangles == serial_stats.frustum_rejected_triangles);
+            if (scene->mesh->type == SPR_MESH_STL && (v & 4)) assert(parallel_stats.clipped_triangles > 0);
+            assert(parallel_stats.active_fragments == serial_stats.active_fragments);
+            free(serial);
+            free(parallel);
+        }
+    }
+    printf("Pass: parallel geometry matches the serial front end.\n");
+}
+
+/* One instanced call must draw what separate calls draw, for soup and
+   indexed meshes, scalar and batch vertex shaders, serial and parallel
+   geometry */
+static void test_instanced_drawing(const test_scene_t* scene, const char* name, float opacity) {
+    int m, v;
+
+    printf("Testing instanced drawing on %s (opacity %.2f)...\n", name, opacity);
+    for (m = 0; m < 2; ++m) {
+        for (v = 0; v < 8; ++v) {
+            test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+            spr_stats_t separate_stats, instanced_stats;
+            uint32_t* single;
+            uint32_t* separate;
+            uint32_t* instanced;
+            cfg.index_bits = (v & 1) ? 32 : 0;
+            cfg.batch_vertices = (v >> 1) & 1;
+            cfg.parallel_geometry = (v >> 2) & 1;
+            single = render_scene(scene, &cfg, NULL);
+            cfg.instances = TEST_INSTANCES;
+            cfg.separate_instances = 1;
+            separate = render_scene(scene, &cfg, &separate_stats);
+            cfg.separate_instances = 0;
+            instanced = render_scene(scene, &cfg, &instanced_stats);
+            printf("%s, %s%s%s: triangles %llu, differing: %d\n", m ? "Tiled" : "CPU",
+                   cfg.index_bits ? "indexed" : "soup", cfg.batch_vertices ? ", batch VS" : "", cfg.parallel_geometry ? ", parallel" : "",
+                   (unsigned long long)instanced_stats.total_triangles, count_diffs(separate, instanced));
+            assert(count_diffs(single, instanced) > 0);
+            assert(count_diffs(separate, instanced) == 0);
+            assert(instanced_stats.total_triangles == separate_stats.total_triangles);
+            assert(instanced_stats.shaded_vertices == separate_stats.shaded_vertices);
+            free(single);
+            free(separate);
+            free(instanced);
+        }
+    }
+    printf("Pass: instanced drawing matches separate draws.\n");
+}
+
+/* Recorded command buffers must draw what the immediate calls draw, with
+   the uniforms snapshotted at record time and the buffers recorded on two
+   threads; a sorted submit of the swapped buffers restores the order */
+static void test_command_buffers(const test_scene_t* scene, const char* name, float opacity) {
+    int m, v;
+
+    printf("Testing command buffers on %s (opacity %.2f)...\n", name, opacity);
+    for (m = 0; m < 2; ++m) {
+        for (v = 0; v < 8; ++v) {
+            test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+            spr_stats_t immediate_stats, recorded_stats;
+            uint32_t* immediate;
+            uint32_t* recorded;
+            cfg.translucent_overlay = 1;
+            cfg.parallel_geometry = m;
+            cfg.index_bits = (v & 1) ? 32 : 0;
+            cfg.batch_shading = cfg.batch_vertices = cfg.declare_varyings = (v >> 1) & 1;
+            cfg.instances = (v & 4) ? TEST_INSTANCES : 0;
+            immediate = render_scene(scene, &cfg, &immediate_stats);
+            cfg.command_buffers = 1 + ((v ^ (v >> 1)) & 1); /* Half of them sorted */
+            recorded = render_scene(scene, &cfg, &recorded_stats);
+            printf("%s, %s%s%s%s: differing: %d\n", m ? "Tiled" : "CPU",
+                   cfg.index_bits ? "indexed" : "soup", cfg.batch_shading ? ", batch" : "", cfg.instances ? ", instanced" : "",
+                   cfg.command_buffers == 2 ? ", sorted" : "", count_diffs(immediate, recorded));
+            assert(count_covered(immediate) > 0);
+            assert(count_diffs(immediate, recorded) == 0);
+            assert(recorded_stats.total_triangles == immediate_stats.total_triangles);
+            assert(recorded_stats.shaded_vertices == immediate_stats.shaded_vertices);
+            assert(recorded_stats.active_fragments == immediate_stats.active_fragments);
+            free(immediate);
+            free(recorded);
+        }
+    }
+    printf("Pass: submitted command buffers match immediate drawing.\n");
+}
+
+/* Distinct vertices referenced by the n indices from 'start' */
+static uint64_t count_distinct(const spr_mesh_t* mesh, int start, int n) {
+    char* seen = (char*)calloc(mesh->vertex_count, 1);
+    uint64_t distinct = 0;
+    int i;
+    assert(seen);
+    for (i = start; i < start + n; ++i) {
+        if (!seen[mesh->indices[i]]) distinct++;
+        seen[mesh->indices[i]] = 1;
+    }
+    free(seen);
+    return distinct;
+}
+
+/* Drawing through the loader's index buffer must give the triangle-soup
+   image while shading each distinct vertex once per draw */
+static void test_indexed_drawing(const test_scene_t* scene, const char* name, float opacity, int index_bits) {
+    const spr_mesh_t* mesh = scene->mesh;
+    uint64_t expected = 0;
+    int m, g;
+
+    printf("Testing %d-bit indexed drawing on %s (opacity %.2f)...\n", index_bits, name, opacity);
+    assert(mesh->indices != NULL);
+    if (mesh->type == SPR_MESH_STL) {
+        expected = count_distinct(mesh, 0, mesh->vertex_count) * 2; /* With the overlay */
+    } else {
+        for (g = 0; g < mesh->group_count; ++g) expected += count_distinct(mesh, mesh->groups[g].start_vertex, mesh->groups[g].vertex_count);
+    }
+    for (m = 0; m < 2; ++m) {
+        test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+        spr_stats_t soup_stats, indexed_stats;
+        uint32_t* soup;
+        uint32_t* indexed;
+        cfg.translucent_overlay = 1;
+        soup = render_scene(scene, &cfg, &soup_stats);
+        cfg.index_bits = index_bits;
+        indexed = render_scene(scene, &cfg, &indexed_stats);
+        printf("%s: vertices shaded %llu -> %llu, differing: %d\n", m ? "Tiled" : "CPU",
+               (unsigned long long)soup_stats.shaded_vertices, (unsigned long long)indexed_stats.shaded_vertices,
+               count_diffs(soup, indexed));
+        assert(count_covered(soup) > 0);
+        assert(count_diffs(soup, indexed) == 0);
+        assert(indexed_stats.total_triangles == soup_stats.total_triangles);
+        assert(indexed_stats.shaded_vertices == expected);
+        assert(indexed_stats.shaded_vertices < soup_stats.shaded_vertices);
+        free(soup);
+        free(indexed);
+    }
+    printf("Pass: indexed drawing matches and shades each vertex once.\n");
+}
+
+/* The batch vertex shaders must reproduce the scalar ones exactly, for soup
+   and for the indexed path's batched cache misses */
+static void test_batch_vertices(const test_scene_t* scene, const char* name, float opacity) {
+    int m, bits;
+
+    printf("Testing batch vertex shading on %s (opacity %.2f)...\n", name, opacity);
+    for (m = 0; m < 2; ++m) {
+        for (bits = 0; bits <= 32; bits += 32) {
+            test_config_t cfg = default_config(m ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, opacity);
+            spr_stats_t scalar_stats, batch_stats;
+            uint32_t* scalar;
+            uint32_t* batch;
+            cfg.translucent_overlay = 1;
+            cfg.index_bits = bits;
+            scalar = render_scene(scene, &cfg, &scalar_stats);
+            cfg.batch_vertices = 1;
+            batch = render_scene(scene, &cfg, &batch_stats);
+            printf("%s, %s: differing: %d\n", m ? "Tiled" : "CPU", bits ? "indexed" : "soup", count_diffs(scalar, batch));
+            assert(count_covered(scalar) > 0);
+            assert(count_diffs(scalar, batch) == 0);
+            assert(batch_stats.shaded_vertices == scalar_stats.shaded_vertices);
+            free(scalar);
+            free(batch);
+        }
+    }
+    printf("Pass: batch vertex shading matches the scalar shaders.\n");
+}
+
+/* Draws one frame into an existing context, with the scene moved right by
+   'shift' scene sizes */
+static void draw_frame(spr_context_t* ctx, const test_scene_t* scene, const test_config_t* cfg, uint32_t clear_color, float shift) {
+    spr_clear(ctx, clear_color, 1.0f);
+    setup_camera(ctx, scene, cfg);
+    spr_translate(ctx, scene->size * shift, 0.0f, 0.0f);
+    draw_scene(ctx, scene, cfg);
+    spr_resolve(ctx);
+}
+
+/* spr_clear() is lazy: tiles the previous frame drew to but this one does
+   not must still come out cleared, as if the context were new. */
+static void test_lazy_clear(const test_scene_t* scene, const char* name) {
+    const spr_fragment_storage_t storages[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_KBUFFER, SPR_FRAGMENT_STORAGE_COMPACT};
+    uint32_t first_bg = spr_make_color(200, 40, 40, 255);
+    uint32_t second_bg = spr_make_color(30, 30, 30, 255);
+    int m, st, hybrid, i;
+
+    printf("Testing lazy clear on %s...\n", name);
+    for (m = 0; m < 4; ++m) {
+        for (st = 0; st < 3; ++st) {
+            for (hybrid = 0; hybrid < 2; ++hybrid) {
+                test_config_t cfg = default_config((m & 1) ? SPR_RASTERIZER_TILED : SPR_RASTERIZER_CPU, hybrid ? 1.0f : 0.5f);
+                spr_context_t* reused = spr_init(TEST_WIDTH, TEST_HEIGHT);
+                spr_context_t* fresh = spr_init(TEST_WIDTH, TEST_HEIGHT);
+                const uint32_t* pixels;
+                int diffs;
+
+                assert(reused != NULL && fresh != NULL);
+                cfg.storage = storages[st];
+                cfg.opaque_zbuffer = hybrid;
+                cfg.layout = (m & 2) ? SPR_FRAMEBUFFER_TILED : SPR_FRAMEBUFFER_LINEAR;
+                for (i = 0; i < 2; ++i) {
+                    spr_context_t* ctx = i ? fresh : reused;
+                    spr_set_rasterizer_mode(ctx, cfg.mode);
+                    spr_set_thread_count(ctx, 4);
+                    spr_enable_opaque_zbuffer(ctx, cfg.opaque_zbuffer);
+                    spr_set_fragment_storage(ctx, cfg.storage);
+                }
+                spr_set_framebuffer_layout(reused, cfg.layout);
+
+                /* Full frame, then one that only covers the right of the screen */
+                draw_frame(reused, scene, &cfg, first_bg, 0.0f);
+                draw_frame(reused, scene, &cfg, second_bg, 0.8f);
+                draw_frame(fresh, scene, &cfg, second_bg, 0.8f);
+                diffs = count_diffs(spr_get_color_buffer(reused), spr_get_color_buffer(fresh));
+                printf("%s, storage %d%s%s: covered %d pixels, differing: %d\n", (m & 1) ? "Tiled" : "CPU", (int)cfg.storage,
+                       hybrid ? " + z-buffer" : "", (m & 2) ? ", tiled layout" : "", count_covered(spr_get_color_buffer(fresh)), diffs);
+                assert(count_covered(spr_get_color_buffer(fresh)) > 0);
+                assert(diffs == 0);
+
+                /* A clear with nothing drawn reads back as the clear colour */
+                spr_clear(reused, first_bg, 1.0f);
+                pixels = spr_get_color_buffer(reused);
+                for (i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i) assert(pixels[i] == first_bg);
+
+                spr_shutdown(reused);
+                spr_shutdown(fresh);
+            }
+        }
+    }
+    printf("Pass: lazily cleared tiles match a new context.\n");
+}
+
+/* Close up, dome triangles cover many blocks: the block pre-pass must
+   accept and reject some, and every kernel must still agree with CPU. */
+static void test_block_traversal(const test_scene_t* scene, const char* name) {
+    static const spr_rasterizer_mode_t modes[] = { SPR_RASTERIZER_SIMD, SPR_RASTERIZER_AVX2, SPR_RASTERIZER_AVX512, SPR_RASTERIZER_TILED };
+    test_config_t cpu_cfg = default_config(SPR_RASTERIZER_CPU, 0.5f);
+    spr_stats_t stats;
+    uint32_t* ref;
+    int m;
+
+    printf("Testing block traversal on a close-up of %s...\n", name);
+    cpu_cfg.eye_distance = 0.3f;
+    ref = render_scene(scene, &cpu_cfg, &stats);
+    printf("Blocks accepted: %llu, rejected: %llu\n",
+           (unsigned long long)stats.accepted_blocks, (unsigned long long)stats.rejected_blocks);
+    assert(stats.accepted_blocks > 0);
+    assert(stats.rejected_blocks > 0);
+
+    for (m = 0; m < 4; ++m) {
+        test_config_t cfg = default_config(modes[m], 0.5f);
+        uint32_t* frame;
+        cfg.eye_distance = cpu_cfg.eye_distance;
+        frame = render_scene(scene, &cfg, NULL);
+        assert(count_diffs(ref, frame) == 0);
+        free(frame);
+    }
+    printf("Pass: block traversal matches across kernels.\n");
+    free(ref);
+}
+
+/* --- Attribute accuracy --- */
+
+/* One vertex given directly in clip space */
+typedef struct {
+    vec4_t position;
+    vec4_t color;
+    vec2_t uv;
+} clip_vertex_t;
+
+/* What the capture shader saw at each pixel */
+typedef struct {
+    int written[TEST_HEIGHT][TEST_WIDTH];    /* Fragments shaded per pixel */
+    float value[TEST_HEIGHT][TEST_WIDTH][6]; /* color rgba, uv */
+} capture_t;
+
+static void clip_vs(void* user_data, const void* input_vertex, spr_vertex_out_t* out) {
+    const clip_vertex_t* in = (const clip_vertex_t*)input_vertex;
+    (void)user_data;
+    memset(out, 0, sizeof(*out));
+    out->position = in->position;
+    out->color = in->color;
+    out->uv = in->uv;
+}
+
+static spr_fs_output_t capture_fs(void* user_data, const spr_vertex_out_t* interpolated) {
+    capture_t* cap = (capture_t*)user_data;
+    int x = (int)interpolated->position.x;
+    int y = (int)interpolated->position.y;
+    spr_fs_output_t out;
+    cap->written[y][x]++;
+    cap->value[y][x][0] = interpolated->color.x;
+    cap->value[y][x][1] = interpolated->color.y;
+    cap->value[y][x][2] = interpolated->color.z;
+    cap->value[y][x][3] = interpolated->color.w;
+    cap->value[y][x][4] = interpolated->uv.x;
+    cap->value[y][x][5] = interpolated->uv.y;
+    out.color.x = out.color.y = out.color.z = 0.0f;
+    out.opacity.x = out.opacity.y = out.opacity.z = 1.0f;
+    return out;
+}
+
+/* Triangle setup turns attributes into screen-space planes. Compare what the
+   fragment shader receives against perspective-correct interpolation done
+   in double precision; the documented tolerance is 1e-4 of the attribute's
+   largest vertex magnitude. */
+static void test_attribute_planes(void) {
+    static const float ndc[3][3] = { {-0.8f, -0.7f, 0.2f}, {0.9f, -0.4f, -0.3f}, {-0.1f, 0.85f, 0.6f} };
+    static const float w[3] = { 0.5f, 1.5f, 4.0f };
+    static const float attr[3][6] = {
+        {0.1f, 0.9f, 0.25f, 1.0f, 0.0f, 0.0f},
+        {0.8f, 0.2f, 0.6f, 0.5f, 40.0f, 3.0f},
+        {0.4f, 0.5f, 0.95f, 0.0f, 10.0f, 25.0f}
+    };
+    capture_t* cap = (capture_t*)calloc(1, sizeof(capture_t));
+    clip_vertex_t tri[3];
+    double sx[3], sy[3], range[6];
+    double worst = 0.0;
+    int i, k, x, y, covered = 0;
+    spr_context_t* ctx = spr_init(TEST_WIDTH, TEST_HEIGHT);
+
+    printf("Testing attribute interpolation accuracy...\n");
+    assert(ctx && cap);
+    for (i = 0; i < 3; ++i) {
+        tri[i].position.x = ndc[i][0] * w[i];
+        tri[i].position.y = ndc[i][1] * w[i];
+        tri[i].position.z = ndc[i][2] * w[i];
+        tri[i].position.w = w[i];
+        tri[i].color.x = attr[i][0]; tri[i].color.y = attr[i][1];
+        tri[i].color.z = attr[i][2]; tri[i].color.w = attr[i][3];
+        tri[i].uv.x = attr[i][4]; tri[i].uv.y = attr[i][5];
+        /* Vertices snap to 1/256 pixel before setup */
+        sx[i] = floor((ndc[i][0] + 1.0) * 0.5 * TEST_WIDTH * 256.0 + 0.5) / 256.0;
+        sy[i] = floor((1.0 - ndc[i][1]) * 0.5 * TEST_HEIGHT * 256.0 + 0.5) / 256.0;
+    }
+    for (k = 0; k < 6; ++k) {
+        range[k] = 0.0;
+        for (i = 0; i < 3; ++i) if (fabs(attr[i][k]) > range[k]) range[k] = fabs(attr[i][k]);
+    }
+
+    spr_clear(ctx, 0, 1.0f);
+    spr_set_program(ctx, clip_vs, capture_fs, cap);
+    spr_set_varyings(ctx, SPR_VARYING_COLOR | SPR_VARYING_UV);
+    spr_draw_triangles(ctx, 1, tri, sizeof(clip_vertex_t));
+
+    for (y = 0; y < TEST_HEIGHT; ++y) {
+        for (x = 0; x < TEST_WIDTH; ++x) {
+            double px = x + 0.5, py = y + 0.5;
+            double area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+            double b[3], denom = 0.0;
+            if (!cap->written[y][x]) continue;
+            b[0] = ((sx[2] - sx[1]) * (py - sy[1]) - (sy[2] - sy[1]) * (px - sx[1])) / area;
+            b[1] = ((sx[0] - sx[2]) * (py - sy[2]) - (sy[0] - sy[2]) * (px - sx[2])) / area;
+            b[2] = 1.0 - b[0] - b[1];
+            for (i = 0; i < 3; ++i) denom += b[i] / w[i];
+            for (k = 0; k < 6; ++k) {
+                double expected = 0.0, err;
+                for (i = 0; i < 3; ++i) expected += b[i] * attr[i][k] / w[i];
+                expected /= denom;
+                err = fabs(cap->value[y][x][k] - expected) / range[k];
+                if (err > worst) worst = err;
+            }
+            covered++;
+        }
+    }
+    printf("Covered %d pixels, worst relative error %.3g\n", covered, worst);
+    assert(covered > 1000);
+    assert(worst <= 1e-4);
+    printf("Pass: attributes are within tolerance.\n");
+
+    spr_shutdown(ctx);
+    free(cap);
+}
+
+/* Frustum rejection and guard-band clipping */
+static void test_frustum_clipping(const test_scene_t* scene, const char* name) {
+    /* Far beyond the guard band on both sides: clipped, yet covers the screen */
+    static const float huge[3][4] = { {-60.0f, -60.0f, 0.0f, 1.0f}, {60.0f, -60.0f, 0.0f, 1.0f}, {0.0f, 60.0f, 0.0f, 1.0f} };
+    /* Behind the far plane */
+    static const float far[3][4] = { {-0.5f, -0.5f, 1.5f, 1.0f}, {0.5f, -0.5f, 1.5f, 1.0f}, {0.0f, 0.5f, 1.5f, 1.0f} };
+    test_config_t cfg = default_config(SPR_RASTERIZER_CPU, 1.0f);
+    capture_t* cap = (capture_t*)calloc(1, sizeof(capture_t));
+    spr_context_t* ctx = spr_init(TEST_WIDTH, TEST_HEIGHT);
+    clip_vertex_t tri[3];
+    spr_stats_t stats;
+    int i, x, y, covered = 0;
+
+    printf("Testing frustum clipping on %s...\n", name);
+    assert(ctx && cap);
+    cfg.eye_distance = 0.3f;
+    free(render_scene(scene, &cfg, &stats));
+    printf("Rejected: %llu, clipped: %llu of %llu triangles\n", (unsigned long long)stats.frustum_rejected_triangles,
+           (unsigned long long)stats.clipped_triangles, (unsigned long long)stats.total_triangles);
+    assert(stats.frustum_rejected_triangles > 0);
+
+    memset(tri, 0, sizeof(tri));
+    spr_clear(ctx, 0, 1.0f);
+    spr_set_program(ctx, clip_vs, capture_fs, cap);
+    for (i = 0; i < 3; ++i) {
+        tri[i].position.x = huge[i][0]; tri[i].position.y = huge[i][1];
+        tri[i].position.z = huge[i][2]; tri[i].position.w = huge[i][3];
+    }
+    spr_draw_triangles(ctx, 1, tri, sizeof(clip_vertex_t));
+    for (i = 0; i < 3; ++i) {
+        tri[i].position.x = far[i][0]; tri[i].position.y = far[i][1];
+        tri[i].position.z = far[i][2]; tri[i].position.w = far[i][3];
+    }
+    spr_draw_triangles(ctx, 1, tri, sizeof(clip_vertex_t));
+    stats = spr_get_stats(ctx);
+    for (y = 0; y < TEST_HEIGHT; ++y) {
+        for (x = 0; x < TEST_WIDTH; ++x) covered += cap->written[y][x];
+    }
+    assert(stats.clipped_triangles == 1);
+    assert(stats.frustum_rejected_triangles == 1);
+    assert(covered == TEST_WIDTH * TEST_HEIGHT);
+    printf("Pass: off-screen triangles rejected, oversized ones clipped.\n");
+
+    spr_shutdown(ctx);
+    free(cap);
+}
+
+/* Horizontal slivers a few float ulps tall that straddle the snapping
+   boundary just below a row of pixel centres: some snap to a 1/256 px
+   high triangle whose top edge covers the centres, some to nothing.
+   Every mode must draw the same pixels, the tiled binning included. */
+static void check_sliver_triangles(void) {
+    static const spr_rasterizer_mode_t modes[] = { SPR_RASTERIZER_CPU, SPR_RASTERIZER_SIMD, SPR_RASTERIZER_AVX2, SPR_RASTERIZER_AVX512, SPR_RASTERIZER_TILED };
+    enum { SLIVERS = 126, PER_ROW = 14 };
+    clip_vertex_t* tris = (clip_vertex_t*)calloc(SLIVERS * 3, sizeof(clip_vertex_t));
+    capture_t* ref = (capture_t*)malloc(sizeof(capture_t));
+    capture_t* cap = (capture_t*)malloc(sizeof(capture_t));
+    int m, i, k, x, y, covered = 0;
+
+    assert(tris && ref && cap);
+    for (i = 0; i < SLIVERS; ++i) {
+        double sx = 8 + (i % PER_ROW) * 22;
+        double sy = 10 + (i / PER_ROW) * 24 + 0.5 + 1.0 / 512.0;
+        float top = (float)(1.0 - sy / TEST_HEIGHT * 2.0);
+        float bottom;
+        /* Top edge -3..3 ulps around the boundary, 1..4 ulps tall */
+        for (k = 0; k < i % 7 - 3; ++k) top = nextafterf(top, 2.0f);
+        for (k = 0; k > i % 7 - 3; --k) top = nextafterf(top, -2.0f);
+        bottom = top;
+        for (k = 0; k < 1 + (i / 7) % 4; ++k) bottom = nextafterf(bottom, -2.0f);
+        for (k = 0; k < 3; ++k) {
+            tris[i * 3 + k].position.x = (float)((k ? sx + 12.0 : sx) / TEST_WIDTH * 2.0 - 1.0);
+            tris[i * 3 + k].position.y = k == 2 ? bottom : top;
+            tris[i * 3 + k].position.w = 1.0f;
+        }
+    }
+
+    for (m = 0; m < 5; ++m) {
+        spr_context_t* ctx = spr_init(TEST_WIDTH, TEST_HEIGHT);
+        capture_t* out = m ? cap : ref;
+        assert(ctx);
+        memset(out, 0, sizeof(*out));
+        spr_set_rasterizer_mode(ctx, modes[m]);
+        spr_clear(ctx, 0, 1.0f);
+        spr_set_program(ctx, clip_vs, capture_fs, out);
+        spr_draw_triangles(ctx, SLIVERS, tris, sizeof(clip_vertex_t));
+        for (y = 0; y < TEST_HEIGHT; ++y) {
+            for (x = 0; x < TEST_WIDTH; ++x) {
+                if (!m) covered += ref->written[y][x];
+                assert(out->written[y][x] == ref->written[y][x]);
+            }
+        }
+        spr_shutdown(ctx);
+    }
+    printf("Slivers: %d fragments in every mode\n", covered);
+    assert(covered > 0);
+    free(tris);
+    free(ref);
+    free(cap);
+}
+
+/* A grid of quads whose vertices and diagonals pass exactly through pixel
+   centres. The top-left rule must give every pixel exactly one fragment,
+   with no holes, in every kernel. Slivers thinner than the snapping grid
+   must then come out the same in every mode. */
+static void test_fill_rule(void) {
+    static const spr_rasterizer_mode_t modes[] = { SPR_RASTERIZER_CPU, SPR_RASTERIZER_SIMD, SPR_RASTERIZER_AVX2, SPR_RASTERIZER_AVX512, SPR_RASTERIZER_TILED };
+    enum { CELLS_X = 6, CELLS_Y = 4, CELL = 40, LEFT = 40, TOP = 40 };
+    clip_vertex_t* tris = (clip_vertex_t*)calloc(CELLS_X * CELLS_Y * 6, sizeof(clip_vertex_t));
+    capture_t* cap = (capture_t*)malloc(sizeof(capture_t));
+    int m, i, j, k, x, y, n = 0;
+
+    printf("Testing top-left fill rule on shared edges...\n");
+    assert(tris && cap);
+    for (j = 0; j < CELLS_Y; ++j) {
+        for (i = 0; i < CELLS_X; ++i) {
+            /* Pixel-centre corners; alternate the diagonal direction */
+            static const int quad[2][6][2] = {
+                { {0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1} },
+                { {0, 0}, {1, 0}, {0, 1}, {1, 0}, {1, 1}, {0, 1} }
+            };
+            for (k = 0; k < 6; ++k) {
+                double sx = LEFT + (i + quad[(i + j) & 1][k][0]) * CELL + 0.5;
+                double sy = TOP + (j + quad[(i + j) & 1][k][1]) * CELL + 0.5;
+                tris[n].position.x = (float)(sx / TEST_WIDTH * 2.0 - 1.0);
+                tris[n].position.y = (float)(1.0 - sy / TEST_HEIGHT * 2.0);
+                tris[n].position.w = 1.0f;
+                n++;
+            }
+        }
+    }
+
+    for (m = 0; m < 5; ++m) {
+        spr_context_t* ctx = spr_init(TEST_WIDTH, TEST_HEIGHT);
+        assert(ctx);
+        memset(cap, 0, sizeof(*cap));
+        spr_set_rasterizer_mode(ctx, modes[m]);
+        spr_clear(ctx, 0, 1.0f);
+        spr_set_program(ctx, clip_vs, capture_fs, cap);
+        spr_draw_triangles(ctx, n / 3, tris, sizeof(clip_vertex_t));
+        for (y = 0; y < TEST_HEIGHT; ++y) {
+            for (x = 0; x < TEST_WIDTH; ++x) {
+                int inside = x >= LEFT && x < LEFT + CELLS_X * CELL && y >= TOP && y < TOP + CELLS_Y * CELL;
+                assert(cap->written[y][x] == inside);
+            }
+        }
+        spr_shutdown(ctx);
+    }
+    check_sliver_triangles();
+    printf("Pass: every pixel covered exactly once, slivers alike in every mode.\n");
+    free(tris);
+    free(cap);
+}
+
+/* A colour/opacity pattern with opaque (resolve's fast path), translucent
+   and over-bright (clamped) fragments; user_data, if set, is a capture_t */
+static spr_fs_output_t pattern_fs(void* user_data, const spr_vertex_out_t* interpolated) {
+    int x = (int)interpolated->position.x;
+    int y = (int)interpolated->position.y;
+    spr_fs_output_t out;
+    if (user_data) ((capture_t*)user_data)->written[y][x]++;
+    out.color.x = (x % 5) * 0.3f;
+    out.color.y = (y % 3) * 0.2f;
+    out.color.z = 0.1f;
+    out.opacity.x = out.opacity.y = out.opacity.z = (x % 3 == 0) ? 1.0f : 0.3f + 0.1f * (y % 4);
+    return out;
+}
+
+/* spr_resolve blends a batch of pixels at a time. Check it against the
+   scalar formula on a width that leaves partial batches, for a triangle
+   covering part of the screen (so whole batches are empty too). */
+static void test_resolve_blend(void) {
+    enum { W = 37, H = 9 };
+    static const spr_fragment_storage_t storages[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_KBUFFER, SPR_FRAGMENT_STORAGE_COUNTED};
+    static const float corners[3][2] = { {-1.0f, 1.0f}, {0.6f, 1.0f}, {-1.0f, -1.0f} };
+    uint32_t bg = spr_make_color(200, 100, 50, 255);
+    capture_t* cap = (capture_t*)malloc(sizeof(capture_t));
+    clip_vertex_t tri[3];
+    int st, layout, i, x, y, shaded = 0;
+
+    printf("Testing resolve blending...\n");
+    assert(cap);
+    memset(tri, 0, sizeof(tri));
+    for (i = 0; i < 3; ++i) {
+        tri[i].position.x = corners[i][0];
+        tri[i].position.y = corners[i][1];
+        tri[i].position.w = 1.0f;
+    }
+    for (layout = 0; layout < 2; ++layout) {
+        for (st = 0; st < 3; ++st) {
+            spr_context_t* ctx = spr_init(W, H);
+            const uint32_t* pixels;
+            assert(ctx);
+            memset(cap, 0, sizeof(*cap));
+            spr_set_fragment_storage(ctx, storages[st]);
+            spr_set_framebuffer_layout(ctx, layout ? SPR_FRAMEBUFFER_TILED : SPR_FRAMEBUFFER_LINEAR);
+            spr_clear(ctx, bg, 1.0f);
+            spr_set_program(ctx, clip_vs, pattern_fs, cap);
+            spr_draw_triangles(ctx, 1, tri, sizeof(clip_vertex_t));
+            if (storages[st] == SPR_FRAGMENT_STORAGE_COUNTED) {
+                spr_end_count_pass(ctx);
+                spr_draw_triangles(ctx, 1, tri, sizeof(clip_vertex_t));
+            }
+            spr_resolve(ctx);
+            pixels = spr_get_color_buffer(ctx);
+            for (y = 0; y < H; ++y) {
+                for (x = 0; x < W; ++x) {
+                    spr_vertex_out_t v;
+                    spr_fs_output_t f;
+                    float c[3];
+                    uint32_t expected = bg;
+                    v.position.x = x + 0.5f;
+                    v.position.y = y + 0.5f;
+                    f = pattern_fs(NULL, &v);
+                    c[0] = f.color.x + (200 / 255.0f) * (1.0f - f.opacity.x);
+                    c[1] = f.color.y + (100 / 255.0f) * (1.0f - f.opacity.y);
+                    c[2] = f.color.z + (50 / 255.0f) * (1.0f - f.opacity.z);
+                    for (i = 0; i < 3; ++i) if (c[i] > 1.0f) c[i] = 1.0f;
+                    if (cap->written[y][x]) {
+                        expected = spr_make_color((uint8_t)(c[0] * 255.0f), (uint8_t)(c[1] * 255.0f), (uint8_t)(c[2] * 255.0f), 255);
+                        shaded++;
+                    }
+                    assert(pixels[y * W + x] == expected);
+                }
+            }
+            spr_shutdown(ctx);
+        }
+    }
+    assert(shaded > W * H); /* Several batches in every run */
+    printf("Pass: resolve matches the scalar blend.\n");
+    free(cap);
+}
+
+int main() {
+    test_scene_t dome, diablo;
+    int loaded;
+
+    printf("Running Rasterizer Tests...\n");
+
+    loaded = load_scene(&dome, "stl/dome.stl");
+    assert(loaded);
+    loaded = load_scene(&diablo, "obj/diablo3_pose/diablo3_pose.obj");
+    assert(loaded);
+
+    test_tiled_matches_cpu(&dome, "dome.stl", 1.0f);
+    test_tiled_matches_cpu(&dome, "dome.stl", 0.5f);
+    test_tiled_matches_cpu(&diablo, "diablo3_pose.obj", 1.0f);
+
+    test_opaque_zbuffer(&dome, "dome.stl", 1.0f);
+    test_opaque_zbuffer(&dome, "dome.stl", 0.5f);
+    test_opaque_zbuffer(&diablo, "diablo3_pose.obj", 1.0f);
+
+    test_simd_kernels(&dome, "dome.stl", 1.0f);
+    test_simd_kernels(&dome, "dome.stl", 0.5f);
+    test_simd_kernels(&diablo, "diablo3_pose.obj", 1.0f);
+
+    test_batch_shading(&dome, "dome.stl", 1.0f);
+    test_batch_shading(&dome, "dome.stl", 0.5f);
+    test_batch_shading(&diablo, "diablo3_pose.obj", 1.0f);
+
+    test_declared_varyings(&dome, "dome.stl", 0.5f);
+    test_declared_varyings(&diablo, "diablo3_pose.obj", 1.0f);
+
+    test_fragment_storage(&dome, "dome.stl", 0.3f, SPR_FRAGMENT_STORAGE_KBUFFER);
+    test_fragment_storage(&diablo, "diablo3_pose.obj", 1.0f, SPR_FRAGMENT_STORAGE_KBUFFER);
+    test_fragment_storage(&dome, "dome.stl", 0.3f, SPR_FRAGMENT_STORAGE_APPEND);
+    test_fragment_storage(&diablo, "diablo3_pose.obj", 1.0f, SPR_FRAGMENT_STORAGE_APPEND);
+    test_fragment_storage(&dome, "dome.stl", 0.3f, SPR_FRAGMENT_STORAGE_COUNTED);
+    test_fragment_storage(&diablo, "diablo3_pose.obj", 1.0f, SPR_FRAGMENT_STORAGE_COUNTED);
+    test_compact_fragments(&dome, "dome.stl", 0.3f);
+    test_steady_state_frames(&dome, "dome.stl");
+    test_fragment_budget(&dome, "dome.stl");
+    test_lazy_clear(&dome, "dome.stl");
+    test_framebuffer_layout(&dome, "dome.stl", 0.5f);
+    test_framebuffer_layout(&diablo, "diablo3_pose.obj", 1.0f);
+    test_parallel_resolve(&dome, "dome.stl", 0.5f);
+    test_indexed_drawing(&dome, "dome.stl", 0.5f, 32);
+    test_indexed_drawing(&diablo, "diablo3_pose.obj", 1.0f, 16);
+    test_batch_vertices(&dome, "dome.stl", 0.5f);
+    test_batch_vertices(&diablo, "diablo3_pose.obj", 1.0f);
+    test_parallel_geometry(&dome, "dome.stl", 0.5f);
+    test_parallel_geometry(&diablo, "diablo3_pose.obj", 1.0f);
+    test_instanced_drawing(&dome, "dome.stl", 0.5f);
+    test_instanced_drawing(&diablo, "diablo3_pose.obj", 1.0f);
+    test_command_buffers(&dome, "dome.stl", 0.5f);
+    test_command_buffers(&diablo, "diablo3_pose.obj", 1.0f);
+
+    test_attribute_planes();
+    test_resolve_blend();
+    test_fill_rule();
+    test_block_traversal(&dome, "dome.stl");
+    test_frustum_clipping(&dome, "dome.stl");
+
+    test_saturation_skip(&dome, "dome.stl");
+    test_saturation_skip(&diablo, "diablo3_pose.obj");
+
+    spr_free_mesh(dome.mesh);
+    spr_free_mesh(diablo.mesh);
+
+    printf("Rasterizer Tests Passed.\n");
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <stdlib.h>
 
 /* --- Window Settings --- */
 
@@ -52,8 +53,12 @@ void print_help(const char* prog_name) {
     printf("Usage: %s <model_file> [texture_file] [options]\n", prog_name);
     printf("Supported formats: .obj, .stl, .gltf, .glb\n");
     printf("\nOptions:\n");
-    printf("  -simd       Use SIMD rasterizer (if available)\n");
+    printf("  -simd       Use the widest SIMD rasterizer the CPU supports (SSE2/AVX2/AVX-512)\n");
     printf("  -cpu        Use CPU rasterizer (default)\n");
+    printf("  -tiled      Use multithreaded tiled rasterizer\n");
+    printf("  -budget MB  Cap fragment memory, merging layers beyond it\n");
+    printf("  -tiledfb    Store per-pixel state in 64x64 tile order\n");
+    printf("  -pgeom      Shade vertices on the worker pool (pays off on heavy vertex work)\n");
     printf("  -h, --help  Show this help message\n");
     printf("\nControls:\n");
     printf("  Left Drag   Rotate Camera (Orbit)\n");
@@ -65,6 +70,9 @@ void print_help(const char* prog_name) {
     printf("  'c'         Toggle Base Color (Grey/Red)\n");
     printf("  'b'         Toggle Back-face Culling\n");
     printf("  'w'         Cycle Wireframe Mode (Off/Overlay/Only)\n");
+    printf("  'z'         Toggle Hybrid Z-Buffer (opaque fragments skip the A-Buffer)\n");
+    printf("  'k'         Cycle Fragment Storage (Lists/K-Buffer/Append/Compact)\n");
+    printf("  'f'         Toggle Batched (SoA) Fragment Shading\n");
     printf("  '1'-'6'     Switch Shaders (..., Painted, MTL)\n");
     printf("  ESC         Exit\n");
 }
@@ -82,6 +90,9 @@ int main(int argc, char* argv[]) {
     const char* tex_filename = NULL;
     spr_rasterizer_mode_t mode = SPR_RASTERIZER_CPU; /* Default to CPU */
     shader_type_t current_shader = SHADER_PLASTIC;
+    size_t fragment_budget = 0; /* Unlimited */
+    spr_framebuffer_layout_t fb_layout = SPR_FRAMEBUFFER_LINEAR;
+    int parallel_geometry = 0; /* Serial front end: cheaper for the built-in shaders */
 
     /* Parse Args */
     for (int i = 1; i < argc; ++i) {
@@ -89,6 +100,14 @@ int main(int argc, char* argv[]) {
             mode = SPR_RASTERIZER_SIMD;
         } else if (strcmp(argv[i], "-cpu") == 0) {
             mode = SPR_RASTERIZER_CPU;
+        } else if (strcmp(argv[i], "-tiled") == 0) {
+            mode = SPR_RASTERIZER_TILED;
+        } else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc) {
+            fragment_budget = (size_t)(atof(argv[++i]) * 1024.0 * 1024.0);
+        } else if (strcmp(argv[i], "-tiledfb") == 0) {
+            fb_layout = SPR_FRAMEBUFFER_TILED;
+        } else if (strcmp(argv[i], "-pgeom") == 0) {
+            parallel_geometry = 1;
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             print_help(argv[0]);
             return 0;
@@ -106,6 +125,8 @@ int main(int argc, char* argv[]) {
 
     if (mode == SPR_RASTERIZER_SIMD) {
         printf("Mode: SIMD (if available)\n");
+    } else if (mode == SPR_RASTERIZER_TILED) {
+        printf("Mode: Tiled (multithreaded)\n");
     } else {
         printf("Mode: CPU\n");
     }
@@ -183,7 +204,11 @@ int main(int argc, char* argv[]) {
     /* Init SPR */
     spr_context_t* ctx = spr_init(win_width, win_height);
     spr_stats_t* stats_ptr = spr_get_stats_ptr(ctx);
-    spr_set_rasterizer_mode(ctx, mode);
+    if (spr_set_rasterizer_mode(ctx, mode) == SPR_RASTERIZER_CPU && mode == SPR_RASTERIZER_SIMD) {
+        printf("SIMD not available, using the scalar rasterizer\n");
+    }
+    spr_enable_parallel_resolve(ctx, 1);
+    spr_enable_parallel_geometry(ctx, parallel_geometry); /* The built-in vertex shaders are reentrant */
     
     /* View State */
     view_state_t view = {0};
@@ -203,6 +228,13 @@ int main(int argc, char* argv[]) {
     int opacity_mode = 0; /* 0: Opaque, 1: Transparent (0.5) */
     int cull_mode = 0; /* 0: None, 1: Backface */
     int wire_mode = 0; /* 0: Off, 1: Overlay, 2: Wireframe only */
+    int zbuf_mode = 0; /* 0: A-Buffer only, 1: Hybrid Z-Buffer */
+    /* Fragment storage modes cycled by 'k' (counted storage needs two passes per frame) */
+    const spr_fragment_storage_t storage_modes[] = {SPR_FRAGMENT_STORAGE_LIST, SPR_FRAGMENT_STORAGE_KBUFFER,
+                                                    SPR_FRAGMENT_STORAGE_APPEND, SPR_FRAGMENT_STORAGE_COMPACT};
+    const char* storage_names[] = {"Lists", "K-Buffer", "Append", "Compact"};
+    int storage_mode = 0;
+    int batch_mode = 0; /* Use the batch fragment shaders where available */
     double current_render_ms = 0.0;
     double accumulated_render_ms = 0.0;
     uint32_t last_time = SDL_GetTicks();
@@ -221,6 +253,8 @@ int main(int argc, char* argv[]) {
                 spr_shutdown(ctx);
                 ctx = spr_init(win_width, win_height);
                 spr_set_rasterizer_mode(ctx, mode);
+                spr_enable_parallel_resolve(ctx, 1);
+                spr_enable_parallel_geometry(ctx, parallel_geometry);
                 
                 SDL_DestroyTexture(texture);
                 texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, win_width, win_height);
@@ -233,6 +267,9 @@ int main(int argc, char* argv[]) {
                     case SDLK_o: opacity_mode = !opacity_mode; break;
                     case SDLK_b: cull_mode = !cull_mode; break;
                     case SDLK_w: wire_mode = (wire_mode + 1) % 3; break;
+                    case SDLK_z: zbuf_mode = !zbuf_mode; break;
+                    case SDLK_k: storage_mode = (storage_mode + 1) % 4; break;
+                    case SDLK_f: batch_mode = !batch_mode; break;
                     case SDLK_1: current_shader = SHADER_CONSTANT; break;
                     case SDLK_2: current_shader = SHADER_MATTE; break;
                     case SDLK_3: current_shader = SHADER_PLASTIC; break;
@@ -281,6 +318,10 @@ int main(int argc, char* argv[]) {
         uint64_t start_time = SDL_GetPerformanceCounter();
 
         uint32_t clear_col = spr_make_color(30, 30, 30, 255);
+        spr_enable_opaque_zbuffer(ctx, zbuf_mode);
+        spr_set_fragment_storage(ctx, storage_modes[storage_mode]);
+        spr_set_fragment_budget(ctx, fragment_budget);
+        spr_set_framebuffer_layout(ctx, fb_layout);
         spr_clear(ctx, clear_col, 1.0f);
         
         /* Reset Texture Stats */
@@ -399,6 +440,8 @@ int main(int argc, char* argv[]) {
             /* Shader Selection */
             spr_vertex_shader_t vs = NULL;
             spr_fragment_shader_t fs = NULL;
+            spr_fragment_shader_batch_t fs_batch = NULL;
+            spr_vertex_shader_batch_t vs_batch = NULL;
             
             shader_type_t shader = current_shader;
             /* Auto-switch to Painted if texture available and using default Plastic */
@@ -409,12 +452,17 @@ int main(int argc, char* argv[]) {
             switch (shader) {
                 case SHADER_CONSTANT:
                     fs = spr_shader_constant_fs; vs = spr_shader_constant_vs;
+                    vs_batch = spr_shader_constant_vs_batch;
                     break;
                 case SHADER_MATTE:
                     fs = spr_shader_matte_fs; vs = spr_shader_matte_vs;
+                    vs_batch = spr_shader_matte_vs_batch;
+                    fs_batch = spr_shader_matte_fs_batch;
                     break;
                 case SHADER_PLASTIC:
                     fs = spr_shader_plastic_fs; vs = spr_shader_plastic_vs;
+                    vs_batch = spr_shader_plastic_vs_batch;
+                    fs_batch = spr_shader_plastic_fs_batch;
                     break;
                 case SHADER_METAL:
                     if (color_mode == 0 && !group->material) { 
@@ -422,25 +470,40 @@ int main(int argc, char* argv[]) {
                     }
                     u.roughness = 64.0f;
                     fs = spr_shader_metal_fs; vs = spr_shader_metal_vs;
+                    vs_batch = spr_shader_metal_vs_batch;
+                    fs_batch = spr_shader_metal_fs_batch;
                     break;
                 case SHADER_PAINTED_PLASTIC:
                     fs = spr_shader_paintedplastic_fs; vs = spr_shader_paintedplastic_vs;
+                    vs_batch = spr_shader_paintedplastic_vs_batch;
                     break;
                 case SHADER_MTL:
                     fs = spr_shader_mtl_fs; vs = spr_shader_matte_vs;
+                    vs_batch = spr_shader_matte_vs_batch;
+                    fs_batch = spr_shader_mtl_fs_batch;
                     break;
             }
             
             /* If OBJ, override VS to standard textured VS */
             if (mesh->type == SPR_MESH_OBJ) {
                 vs = spr_shader_textured_vs;
+                vs_batch = spr_shader_textured_vs_batch;
             }
             
             spr_set_program(ctx, vs, fs, &u);
+            spr_set_varyings(ctx, spr_shader_varyings(fs, &u));
+            if (batch_mode && fs_batch) spr_set_fragment_shader_batch(ctx, fs_batch);
+            /* Bit-identical to the scalar vertex shaders, so always on */
+            spr_set_vertex_shader_batch(ctx, vs_batch);
             
-            /* Draw Group */
-            void* start_ptr = (uint8_t*)mesh->vertices + (group->start_vertex * stride);
-            spr_draw_triangles(ctx, group->vertex_count / 3, start_ptr, stride);
+            /* Draw Group: through the loader's index buffer, so shared
+               vertices are shaded once */
+            if (mesh->indices) {
+                spr_draw_indexed_triangles(ctx, group->vertex_count, mesh->indices + group->start_vertex, mesh->vertices, stride);
+            } else {
+                void* start_ptr = (uint8_t*)mesh->vertices + (group->start_vertex * stride);
+                spr_draw_triangles(ctx, group->vertex_count / 3, start_ptr, stride);
+            }
         }
         
         /* Resolve A-Buffer */
@@ -468,7 +531,21 @@ int main(int argc, char* argv[]) {
             snprintf(stats_buf, sizeof(stats_buf), "Tex Samples: %llu", (unsigned long long)stats.texture_samples);
             spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
 
-            snprintf(stats_buf, sizeof(stats_buf), "Triangles: %llu", (unsigned long long)stats.total_triangles);
+            snprintf(stats_buf, sizeof(stats_buf), "Skipped: %llu", (unsigned long long)stats.skipped_fragments);
+            spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+
+            snprintf(stats_buf, sizeof(stats_buf), "Kernel: %s x%d",
+                     stats.rasterizer_kernel == SPR_RASTERIZER_AVX512 ? "AVX-512" :
+                     stats.rasterizer_kernel == SPR_RASTERIZER_AVX2 ? "AVX2" :
+                     stats.rasterizer_kernel == SPR_RASTERIZER_SIMD ? "SSE2" : "Scalar", stats.simd_width);
+            spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+
+            snprintf(stats_buf, sizeof(stats_buf), "Triangles: %llu  Vertices: %llu", (unsigned long long)stats.total_triangles,
+                     (unsigned long long)stats.shaded_vertices);
+            spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+
+            snprintf(stats_buf, sizeof(stats_buf), "Off-screen: %llu  Clipped: %llu",
+                     (unsigned long long)stats.frustum_rejected_triangles, (unsigned long long)stats.clipped_triangles);
             spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
 
             snprintf(stats_buf, sizeof(stats_buf), "Shader: %s", get_shader_name(current_shader));
@@ -480,6 +557,25 @@ int main(int argc, char* argv[]) {
             const char* wire_names[] = {"OFF", "Overlay", "Only"};
             snprintf(stats_buf, sizeof(stats_buf), "Wire: %s", wire_names[wire_mode]);
             spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+
+            snprintf(stats_buf, sizeof(stats_buf), "Z-Buffer: %s", zbuf_mode ? "Hybrid" : "OFF");
+            spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+
+            snprintf(stats_buf, sizeof(stats_buf), "Storage: %s, %d B/frag, %.1f MB, %llu allocs", storage_names[storage_mode],
+                     stats.fragment_size, stats.fragment_bytes / (1024.0 * 1024.0), (unsigned long long)stats.heap_allocations);
+            spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+            if (storage_modes[storage_mode] == SPR_FRAGMENT_STORAGE_KBUFFER) {
+                snprintf(stats_buf, sizeof(stats_buf), "K-Buffer Overflow: %llu", (unsigned long long)stats.kbuffer_overflow_fragments);
+                spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+            }
+            if (fragment_budget) {
+                snprintf(stats_buf, sizeof(stats_buf), "Budget: %.1f MB, %llu merged", fragment_budget / (1024.0 * 1024.0),
+                         (unsigned long long)stats.merged_fragments);
+                spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
+            }
+
+            snprintf(stats_buf, sizeof(stats_buf), "Batch FS: %s", batch_mode ? "ON" : "OFF");
+            spr_draw_string_overlay(spr_get_color_buffer(ctx), win_width, win_height, 10, y, stats_buf, col); y += 12;
             
             /* Per-Texture Stats */
             if (tex_filename && spr_tex) {
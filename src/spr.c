@@ -1,20 +1,67 @@
 #include "spr.h"
+#include "spr_thread.h"
+#include "spr_texture.h" /* Sample tallies are published after each job */
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
 
-#if defined(__SSE2__)
+#if defined(__linux__)
+#include <sys/mman.h> /* Huge page backed fragment arena */
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/* AVX2 / AVX-512 kernels are compiled with target attributes and chosen at
+   runtime, so one binary runs on any x86 CPU */
+#define SPR_X86_DISPATCH
+#endif
+
+#if defined(__SSE2__) || defined(SPR_X86_DISPATCH)
 #include <immintrin.h>
 #endif
 
+#if defined(__GNUC__)
+#define SPR_NOINLINE __attribute__((noinline))
+#define SPR_INLINE inline __attribute__((always_inline))
+#else
+#define SPR_NOINLINE
+#define SPR_INLINE inline
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+/* No FMA contraction: the wide kernels must round exactly like the scalar one */
+#define SPR_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#else
+#define SPR_TARGET(isa) __attribute__((target(isa)))
+#endif
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
 #define MAX_MATRIX_STACK 32
-#define SPR_CHUNK_SIZE 4096
+#define SPR_CHUNK_SHIFT 12
+#define SPR_CHUNK_SIZE (1 << SPR_CHUNK_SHIFT)
+#ifndef SPR_COMPACT_MAX_CHUNKS
+#define SPR_COMPACT_MAX_CHUNKS 65536 /* Compact chunk table entries: 2^28 fragments */
+#endif
+#define SPR_CFRAG_NIL 0xFFFFFFFFu
+#define SPR_HUGE_PAGE_SIZE ((size_t)2 << 20)
 #define SPR_OPACITY_THRESHOLD 0.999f
+#define SPR_TILE_SHIFT 6
+#define SPR_TILE_SIZE (1 << SPR_TILE_SHIFT) /* Screen tile edge (pixels) for SPR_RASTERIZER_TILED */
+#ifndef SPR_KBUFFER_K
+#define SPR_KBUFFER_K 4  /* Fragments stored inline per pixel in SPR_FRAGMENT_STORAGE_KBUFFER */
+#endif
+#if SPR_KBUFFER_K < 2 || SPR_KBUFFER_K > 255
+#error "SPR_KBUFFER_K must be 2..255: a full k-buffer merges its last two slots, and kcount is 8-bit"
+#endif
+#ifndef SPR_MERGE_KEEP
+#define SPR_MERGE_KEEP 3 /* Over the fragment budget, deeper pixels give a node back when they merge */
+#endif
+#ifndef SPR_BLOCK_SIZE
+#define SPR_BLOCK_SIZE 8 /* Coverage pre-pass block edge; a power of two dividing SPR_TILE_SIZE */
+#endif
 
 typedef struct spr_fragment_t {
     float z;
@@ -23,12 +70,137 @@ typedef struct spr_fragment_t {
     struct spr_fragment_t* next;
 } spr_fragment_t;
 
+/* A fragment stored inline: a k-buffer slot, or an entry of the counted array */
+typedef struct {
+    float z;
+    vec3_t color;
+    vec3_t opacity;
+} spr_kslot_t;
+
+/* Packed fragment of SPR_FRAGMENT_STORAGE_COMPACT, 16 bytes instead of 40.
+   Nodes live in ctx->cfrag_chunks and are linked by index: chunk number
+   << SPR_CHUNK_SHIFT | slot. */
+typedef struct {
+    uint32_t depth_opacity; /* 24-bit depth (NDC z mapped to 0..2^24-1) << 8 | red opacity */
+    uint32_t color;         /* Premultiplied RGB, 10 bits each, clamped to 0..1 */
+    uint32_t opacity_gb;    /* Green | blue << 8 opacity */
+    uint32_t next;          /* SPR_CFRAG_NIL ends the list */
+} spr_cfrag_t;
+
 typedef struct spr_fragment_chunk_t {
     spr_fragment_t fragments[SPR_CHUNK_SIZE];
     struct spr_fragment_chunk_t* next;
 } spr_fragment_chunk_t;
 
-typedef void (*spr_rasterize_t)(spr_context_t* ctx, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2);
+/* One heap allocation (or huge page mapping) holding consecutive chunks */
+typedef struct spr_arena_block_t {
+    struct spr_arena_block_t* next;
+    size_t mapped;                    /* Mapping length, 0 if malloc'd */
+    int chunk_count;
+} spr_arena_block_t;
+
+/* Persistent fragment arena shared by all pools of a context. Chunks are
+   kept across frames; a frame reset just points next_free back at the first
+   one, so steady-state frames allocate nothing. Pools claim whole chunks
+   with a lock-free pop. */
+typedef struct {
+    spr_fragment_chunk_t* chunk_head; /* Every chunk, in allocation order */
+    spr_fragment_chunk_t* chunk_tail;
+    spr_fragment_chunk_t* next_free;  /* First chunk not handed out this frame */
+    spr_arena_block_t* blocks;
+    int total_chunks;
+    int high_water;                   /* Most chunks' worth a frame has carved */
+    unsigned int flags;               /* SPR_ARENA_* */
+    uint64_t heap_allocations;        /* Made by the last reset (headroom) */
+    size_t bytes;                     /* List blocks plus compact chunks held */
+    size_t budget;                    /* Cap on 'bytes', 0 = unlimited */
+
+    /* Budget headroom, tracked only under a budget (see budget_reset()) */
+    size_t claimed;                   /* Chunk bytes handed out this frame */
+    size_t layer_bytes;               /* Node size of the storage in use */
+    int first_layers;                 /* Pixels whose list got a node this frame */
+    int first_layers_high_water;      /* Most first layers a frame has had */
+    int reserved_layers;              /* First layers kept back for this frame */
+    int pools;                        /* Pools allocating this frame, each mid-chunk */
+    int tight;                        /* Headroom down to that reserve: pixels with a layer merge */
+} spr_fragment_arena_t;
+
+/* Fragment allocator. The serial rasterizers use ctx->pool; every worker of
+   the tiled rasterizer owns one so that allocation never needs a lock. Pools
+   take chunks from the arena; when it runs dry a pool allocates its own,
+   which join the arena at the next frame reset. */
+typedef struct {
+    spr_fragment_arena_t* arena;
+    spr_fragment_chunk_t* chunk_current; /* Chunk the cursor is in */
+    spr_arena_block_t* blocks;        /* Grown this frame, not yet in the arena */
+    spr_fragment_chunk_t* spare;      /* Unused chunks of the newest block */
+    int spare_count;
+    spr_fragment_t* free_list;        /* Recycled fragments */
+    size_t pool_cursor;               /* Index in current chunk */
+
+    int active_fragments;
+    int peak_fragments;
+    int total_chunks;                 /* Chunks in 'blocks' */
+    int chunks_used;                  /* Chunks taken since the last reset */
+    uint64_t skipped_fragments;       /* Hidden pixels that were never shaded */
+    uint64_t accepted_blocks;         /* Fully covered blocks shaded without edge tests */
+    uint64_t rejected_blocks;         /* Empty blocks skipped by the block pre-pass */
+    uint64_t overflow_fragments;      /* K-buffer fragments spilled to the linked list */
+    uint64_t merged_fragments;        /* Merges forced by the memory budget */
+
+    /* Compact storage: packed nodes come from chunks claimed in ctx->cfrag_chunks */
+    uint32_t cfree;                   /* Recycled nodes, SPR_CFRAG_NIL if none */
+    uint32_t ccursor, cend;           /* Unused range of the current chunk */
+    int compact_chunks;               /* Chunks claimed since the last reset */
+    uint64_t heap_allocations;        /* malloc/mmap calls since the last reset */
+} spr_fragment_pool_t;
+
+/* Append storage resolve: a growable array a pixel's list is gathered into.
+   The serial resolve has one; a parallel one uses one per worker. */
+typedef struct {
+    spr_fragment_t** frags;
+    int capacity;
+} spr_sort_scratch_t;
+
+/* Parallel geometry: one job's triangle range and what it produced. Its
+   screen-space triangles go to its slice of ctx->geometry_tris. */
+typedef struct {
+    int first, end;      /* Triangles (or pending cache entries) [first, end) */
+    int count;           /* Triangles written to the slice */
+    spr_stats_t stats;   /* Clip counters, added to ctx->stats after the round */
+} spr_geometry_job_t;
+
+/* Where a rasterizer writes: an inclusive pixel rectangle (the whole screen,
+   or one tile) and the pool new fragments come from. */
+typedef struct {
+    int min_x, min_y, max_x, max_y;
+    spr_fragment_pool_t* pool;
+} spr_raster_target_t;
+
+typedef void (*spr_rasterize_t)(spr_context_t* ctx, spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2);
+
+/* Per-pixel interpolation + shading, specialised on the declared varyings */
+typedef struct spr_fs_queue_t spr_fs_queue_t;
+typedef struct spr_triangle_setup_t spr_triangle_setup_t;
+typedef void (*spr_shade_pixel_t)(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int x, int y);
+
+/* A post-clip, screen-space triangle waiting in the tile bins */
+typedef struct {
+    spr_vertex_out_t v[3];
+} spr_bin_triangle_t;
+
+typedef struct {
+    int* tris;    /* Indices into bin_tris, in submission order */
+    int count;
+    int capacity;
+} spr_tile_bin_t;
+
+/* A command in spr_submit()'s execution order */
+typedef struct {
+    uint32_t key;        /* Pipeline sort_key, or 0 when not sorting */
+    int buffer;          /* Index into the submitted buffers */
+    int command;         /* Index into that buffer's commands */
+} spr_submit_ref_t;
 
 struct spr_context_t {
     spr_framebuffer_t fb;
@@ -42,19 +214,115 @@ struct spr_context_t {
     spr_matrix_mode_enum current_mode;
     
     spr_vertex_shader_t current_vs;
+    spr_vertex_shader_batch_t current_vs_batch; /* Used instead of current_vs when set */
+    int instance_id;                  /* Of the vertices being shaded, see shade_vertex() */
     spr_fragment_shader_t current_fs;
+    spr_fragment_shader_batch_t current_fs_batch; /* Used instead of current_fs when set */
+    unsigned int varyings;            /* SPR_VARYING_* the fragment shader reads */
+    spr_shade_pixel_t shade_pixel;    /* Interpolator for 'varyings' */
     void* current_uniforms;
 
+    spr_rasterizer_mode_t rasterizer_mode;
     spr_rasterize_t rasterizer_func;
+    spr_rasterizer_mode_t simd_kernel; /* Widest kernel the CPU supports, found by spr_init */
+
+    /* Per-pixel arrays below hold pixel_slots entries (whole tiles) and are
+       indexed by pixel_index(), row-major or, in the tiled layout, one
+       contiguous run per tile. The public colour buffer is always linear:
+       in the tiled layout the rasterizers write 'color' and spr_resolve()
+       converts it into fb.color_buffer. */
+    int tiled_layout;
+    int pixel_slots;
+    uint32_t* color;                 /* fb.color_buffer, or tile_color when tiled */
+    uint32_t* tile_color;            /* [pixel_slots], allocated for the tiled layout */
 
     /* A-Buffer State */
-    spr_fragment_t** fragment_heads; /* Array of pointers [width * height] */
+    spr_fragment_t** fragment_heads; /* Array of pointers [pixel_slots] */
+    float* saturated_z;              /* [pixel_slots] z where the list's opacity
+                                        crosses SPR_OPACITY_THRESHOLD, INFINITY if not */
+
+    /* K-buffer storage: the nearest SPR_KBUFFER_K fragments of a pixel live
+       in kbuffer[idx * K ...], sorted; fragment_heads[idx] then holds the
+       overflow, i.e. the fragments behind them, as a sorted list */
+    spr_fragment_storage_t storage;
+    spr_kslot_t* kbuffer;            /* [pixel_slots * SPR_KBUFFER_K] */
+    uint8_t* kcount;                 /* [pixel_slots] slots in use */
+
+    /* Append storage: lists are unsorted (newest first) and get sorted
+       one pixel at a time by spr_resolve() */
+    spr_sort_scratch_t sort_scratch;
+
+    /* Counted storage: pixel i owns frag_array[frag_offset[i] .. frag_offset[i + 1]).
+       During the count pass frag_cursor[i] counts the pixel's fragments; in
+       the write pass it is the next free entry of the pixel's slice. */
+    int counting;                    /* Count pass: pixels are counted, not shaded */
+    uint32_t* frag_offset;           /* [pixel_slots + 1] exclusive prefix sum */
+    uint32_t* frag_cursor;           /* [pixel_slots] */
+    spr_kslot_t* frag_array;
+    size_t frag_capacity;
+
+    /* Compact storage: sorted lists of spr_cfrag_t. Chunks are claimed with an
+       atomic counter (so workers share one index space) and stay allocated
+       across frames; the table itself never moves. */
+    uint32_t* cfrag_heads;           /* [pixel_slots] */
+    spr_cfrag_t** cfrag_chunks;      /* [SPR_COMPACT_MAX_CHUNKS], NULL until first used */
+    int cfrag_chunk_count;           /* Claimed this frame */
+    int cfrag_high_water;            /* Most chunks' worth a frame has carved */
     
-    spr_fragment_chunk_t* chunk_head; /* Linked list of memory blocks */
-    spr_fragment_t* free_list;        /* Recycled fragments */
-    size_t pool_cursor;               /* Index in current chunk */
+    spr_fragment_arena_t arena;       /* Chunks for every pool, kept across frames */
+    spr_fragment_pool_t pool;         /* Serial rasterizers */
+    spr_raster_target_t screen;       /* Full-screen target using 'pool' */
+
+    /* Tiled Rasterizer State */
+    int thread_count;                 /* Requested workers, 0 = one per CPU */
+    spr_thread_pool_t* threads;       /* Created on first tiled draw */
+    spr_fragment_pool_t* worker_pools;/* One per thread */
+    spr_sort_scratch_t* worker_scratch;/* One per thread, for a parallel resolve */
+    int parallel_resolve;             /* spr_resolve() runs its tiles on 'threads' */
+    int parallel_geometry;            /* Draws run vertex shading and clipping on 'threads' */
+    spr_geometry_job_t* geometry_jobs;/* One per thread */
+    spr_vertex_out_t* geometry_tris;  /* A slice per job, 3 vertices per triangle */
+    int geometry_slice;               /* Triangles per slice */
+    const uint8_t* geometry_vertices; /* The draw being processed */
+    size_t geometry_stride;
+    const uint16_t* geometry_idx16;   /* Indexed draws read the vertex cache */
+    const uint32_t* geometry_idx32;
+    uint32_t geometry_lo;
+    int tiles_x, tiles_y;
+    spr_tile_bin_t* tile_bins;        /* [tiles_x * tiles_y] */
+    int* active_tiles;                /* Tiles with work in the current batch */
+    spr_bin_triangle_t* bin_tris;
+    int bin_tri_count;
+    int bin_tri_capacity;
 
     int cull_backface;
+
+    /* Command buffers: while submitting, binned work is flushed when the
+       pipeline changes rather than after every draw */
+    int submitting;
+    spr_submit_ref_t* submit_refs;
+    int submit_ref_capacity;
+
+    /* Indexed drawing: post-transform cache with one slot per index in the
+       draw's range. A slot is valid for the draw whose tag it carries, so
+       each vertex is shaded once per draw and nothing is cleared between. */
+    spr_vertex_out_t* vcache;
+    uint32_t* vcache_tag;
+    uint32_t* vcache_pending;         /* Misses to shade up front, in first-use order */
+    int vcache_capacity;
+    uint32_t vcache_draw;
+
+    /* Hybrid mode: opaque fragments go to fb.depth_buffer/color */
+    int opaque_zbuffer;
+    float clear_depth;
+
+    /* Lazy clear: spr_clear() only bumps clear_gen. A tile whose stamp is
+       older reads as cleared (colour, depth and fragment heads) and is
+       filled in when a triangle first reaches it. */
+    uint32_t* tile_gen;               /* [tiles_x * tiles_y] */
+    uint32_t clear_gen;
+    uint32_t clear_color;
+    int color_pending;                /* Stale tiles still show the last frame */
     
     spr_stats_t stats;
 };
@@ -138,55 +406,539 @@ static float edge_function(vec2_t a, vec2_t b, vec2_t c) {
 }
 
 /* --- Internal Helpers --- */
-static spr_fragment_t* alloc_fragment(spr_context_t* ctx) {
+
+/* Size of the block arena_block_alloc() makes for 'count' chunks */
+static size_t arena_block_bytes(int count, unsigned int flags) {
+    size_t bytes = sizeof(spr_arena_block_t) + (size_t)count * sizeof(spr_fragment_chunk_t);
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    if (flags & SPR_ARENA_HUGE_PAGES) {
+        bytes = (bytes + SPR_HUGE_PAGE_SIZE - 1) & ~(SPR_HUGE_PAGE_SIZE - 1);
+    }
+#else
+    (void)flags;
+#endif
+    return bytes;
+}
+
+/* Allocates a block of at least 'count' chunks (not linked yet). With huge
+   pages the block is an anonymous mapping rounded up to 2 MB, advised as a
+   transparent huge page on Linux, and holds as many chunks as fit. */
+static spr_arena_block_t* arena_block_alloc(int count, unsigned int flags) {
+    size_t bytes = sizeof(spr_arena_block_t) + (size_t)count * sizeof(spr_fragment_chunk_t);
+    spr_arena_block_t* block = NULL;
+    size_t mapped = 0;
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    if (flags & SPR_ARENA_HUGE_PAGES) {
+        size_t len = arena_block_bytes(count, flags);
+        void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(p, len, MADV_HUGEPAGE);
+#endif
+            block = (spr_arena_block_t*)p;
+            mapped = len;
+            count = (int)((len - sizeof(spr_arena_block_t)) / sizeof(spr_fragment_chunk_t));
+        }
+    }
+#else
+    (void)flags;
+#endif
+    if (!block) {
+        block = (spr_arena_block_t*)malloc(bytes);
+        if (!block) return NULL;
+    }
+    block->next = NULL;
+    block->mapped = mapped;
+    block->chunk_count = count;
+    return block;
+}
+
+static void arena_block_free(spr_arena_block_t* block) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    if (block->mapped) {
+        munmap(block, block->mapped);
+        return;
+    }
+#endif
+    free(block);
+}
+
+static spr_fragment_chunk_t* block_chunks(spr_arena_block_t* block) {
+    return (spr_fragment_chunk_t*)(block + 1);
+}
+
+/* Hands the block's chunks to the arena, after the existing ones */
+static void arena_add_block(spr_fragment_arena_t* arena, spr_arena_block_t* block) {
+    spr_fragment_chunk_t* chunks = block_chunks(block);
+    int i;
+    for (i = 0; i < block->chunk_count; ++i) {
+        chunks[i].next = NULL;
+        if (arena->chunk_tail) {
+            arena->chunk_tail->next = &chunks[i];
+        } else {
+            arena->chunk_head = &chunks[i];
+        }
+        arena->chunk_tail = &chunks[i];
+    }
+    arena->total_chunks += block->chunk_count;
+    block->next = arena->blocks;
+    arena->blocks = block;
+}
+
+/* Pops the next free chunk. Chunk links do not change during a frame, so a
+   compare-and-swap on next_free is enough for concurrent pools. */
+static spr_fragment_chunk_t* arena_claim(spr_fragment_arena_t* arena) {
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    spr_fragment_chunk_t* chunk = __atomic_load_n(&arena->next_free, __ATOMIC_ACQUIRE);
+    while (chunk && !__atomic_compare_exchange_n(&arena->next_free, &chunk, chunk->next, 1,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    return chunk;
+#else
+    spr_fragment_chunk_t* chunk = arena->next_free;
+    if (chunk) arena->next_free = chunk->next;
+    return chunk;
+#endif
+}
+
+/* Pixels that already have a layer merge from now until the next clear */
+static void budget_set_tight(spr_fragment_arena_t* arena) {
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    __atomic_store_n(&arena->tight, 1, __ATOMIC_RELAXED);
+#else
+    arena->tight = 1;
+#endif
+}
+
+static int budget_tight(const spr_fragment_arena_t* arena) {
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    return __atomic_load_n(&arena->tight, __ATOMIC_RELAXED);
+#else
+    return arena->tight;
+#endif
+}
+
+/* Accounts for 'bytes' more fragment memory. Fails, reserving nothing and
+   turning the budget tight, if that would take the arena over its budget. */
+static int arena_reserve(spr_fragment_arena_t* arena, size_t bytes) {
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    size_t held = __atomic_add_fetch(&arena->bytes, bytes, __ATOMIC_RELAXED);
+    if (arena->budget && held > arena->budget) {
+        __atomic_sub_fetch(&arena->bytes, bytes, __ATOMIC_RELAXED);
+        budget_set_tight(arena);
+        return 0;
+    }
+#else
+    if (arena->budget && arena->bytes + bytes > arena->budget) {
+        budget_set_tight(arena);
+        return 0;
+    }
+    arena->bytes += bytes;
+#endif
+    return 1;
+}
+
+static void arena_unreserve(spr_fragment_arena_t* arena, size_t bytes) {
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    __atomic_sub_fetch(&arena->bytes, bytes, __ATOMIC_RELAXED);
+#else
+    arena->bytes -= bytes;
+#endif
+}
+
+/* Under a budget, accounts for a chunk of 'bytes' handed to a pool. Once the
+   headroom left after one more chunk per pool would no longer cover a node
+   for each first layer still reserved, the budget turns tight: the nodes
+   left in a pool's chunk serve only that pool's tiles. */
+static void budget_charge(spr_fragment_arena_t* arena, size_t bytes) {
+    size_t claimed, reserve;
+    int started;
+
+    if (!arena->budget) return;
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    claimed = __atomic_add_fetch(&arena->claimed, bytes, __ATOMIC_RELAXED);
+    started = __atomic_load_n(&arena->first_layers, __ATOMIC_RELAXED);
+#else
+    claimed = arena->claimed += bytes;
+    started = arena->first_layers;
+#endif
+    reserve = arena->reserved_layers > started ? (size_t)(arena->reserved_layers - started) * arena->layer_bytes : 0;
+    if (claimed + (size_t)arena->pools * bytes + reserve > arena->budget) budget_set_tight(arena);
+}
+
+/* Under a budget, counts a pixel whose list just got its first node */
+static void budget_first_layer(spr_fragment_arena_t* arena) {
+    if (!arena->budget) return;
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    __atomic_add_fetch(&arena->first_layers, 1, __ATOMIC_RELAXED);
+#else
+    arena->first_layers++;
+#endif
+}
+
+static void arena_release(spr_fragment_arena_t* arena) {
+    spr_arena_block_t* block = arena->blocks;
+    while (block) {
+        spr_arena_block_t* next = block->next;
+        arena_block_free(block);
+        block = next;
+    }
+    arena->chunk_head = arena->chunk_tail = arena->next_free = NULL;
+    arena->blocks = NULL;
+    arena->total_chunks = 0;
+    arena->bytes = 0;
+}
+
+/* The arena is empty: allocate a private block (one chunk, or a 2 MB huge
+   page worth) for this pool, unless the memory budget is used up. */
+static int pool_grow(spr_fragment_pool_t* pool) {
+    size_t bytes = arena_block_bytes(1, pool->arena->flags);
+    spr_arena_block_t* block;
+    if (!arena_reserve(pool->arena, bytes)) return 0;
+    block = arena_block_alloc(1, pool->arena->flags);
+    if (!block) {
+        arena_unreserve(pool->arena, bytes);
+        return 0;
+    }
+    block->next = pool->blocks;
+    pool->blocks = block;
+    pool->spare = block_chunks(block);
+    pool->spare_count = block->chunk_count;
+    pool->total_chunks += block->chunk_count;
+    pool->heap_allocations++;
+    return 1;
+}
+
+static spr_fragment_t* alloc_fragment(spr_fragment_pool_t* pool) {
     spr_fragment_t* node = NULL;
 
     /* 1. Try Free List */
-    if (ctx->free_list) {
-        node = ctx->free_list;
-        ctx->free_list = node->next;
+    if (pool->free_list) {
+        node = pool->free_list;
+        pool->free_list = node->next;
     }
     /* 2. Try Current Chunk */
-    else if (ctx->chunk_head && ctx->pool_cursor < SPR_CHUNK_SIZE) {
-        node = &ctx->chunk_head->fragments[ctx->pool_cursor++];
+    else if (pool->pool_cursor < SPR_CHUNK_SIZE) {
+        node = &pool->chunk_current->fragments[pool->pool_cursor++];
     }
-    /* 3. Allocate New Chunk */
+    /* 3. Take a Chunk from the Arena, or Grow */
     else {
-        spr_fragment_chunk_t* new_chunk = (spr_fragment_chunk_t*)malloc(sizeof(spr_fragment_chunk_t));
-        if (!new_chunk) return NULL;
-        
-        new_chunk->next = ctx->chunk_head;
-        ctx->chunk_head = new_chunk;
-        ctx->pool_cursor = 0;
-        ctx->stats.total_chunks++;
-        
-        node = &new_chunk->fragments[ctx->pool_cursor++];
+        spr_fragment_chunk_t* chunk = arena_claim(pool->arena);
+        if (!chunk) {
+            if (!pool->spare_count && !pool_grow(pool)) return NULL;
+            chunk = pool->spare++;
+            pool->spare_count--;
+        }
+        budget_charge(pool->arena, sizeof(spr_fragment_chunk_t));
+        pool->chunks_used++;
+        pool->chunk_current = chunk;
+        pool->pool_cursor = 0;
+        node = &chunk->fragments[pool->pool_cursor++];
     }
 
-    if (node) {
-        ctx->stats.active_fragments++;
-        if (ctx->stats.active_fragments > ctx->stats.peak_fragments) {
-            ctx->stats.peak_fragments = ctx->stats.active_fragments;
-        }
+    pool->active_fragments++;
+    if (pool->active_fragments > pool->peak_fragments) {
+        pool->peak_fragments = pool->active_fragments;
     }
     return node;
 }
 
-static void free_fragment(spr_context_t* ctx, spr_fragment_t* node) {
+static void free_fragment(spr_fragment_pool_t* pool, spr_fragment_t* node) {
     if (!node) return;
-    node->next = ctx->free_list;
-    ctx->free_list = node;
-    ctx->stats.active_fragments--;
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pool->active_fragments--;
+}
+
+static void pool_init(spr_fragment_pool_t* pool, spr_fragment_arena_t* arena) {
+    memset(pool, 0, sizeof(*pool));
+    pool->arena = arena;
+    pool->pool_cursor = SPR_CHUNK_SIZE; /* Force new chunk on first alloc */
+    pool->cfree = SPR_CFRAG_NIL;
+}
+
+/* Frame reset of the counters and cursor; the chunks themselves are
+   recycled by arena_reset(), which must run first. */
+static void pool_reset(spr_fragment_pool_t* pool) {
+    pool->free_list = NULL;
+    pool->chunk_current = NULL;
+    pool->pool_cursor = SPR_CHUNK_SIZE;
+    pool->chunks_used = 0;
+    pool->heap_allocations = 0;
+    pool->active_fragments = 0;
+    pool->peak_fragments = 0;
+    pool->skipped_fragments = 0;
+    pool->accepted_blocks = 0;
+    pool->rejected_blocks = 0;
+    pool->overflow_fragments = 0;
+    pool->merged_fragments = 0;
+    pool->cfree = SPR_CFRAG_NIL;
+    pool->ccursor = pool->cend = 0;
+    pool->compact_chunks = 0;
+}
+
+/* Frees the pool's private blocks; arena chunks belong to the arena */
+static void pool_release(spr_fragment_pool_t* pool) {
+    spr_arena_block_t* block = pool->blocks;
+    while (block) {
+        spr_arena_block_t* next = block->next;
+        arena_block_free(block);
+        block = next;
+    }
+    pool_init(pool, pool->arena);
+}
+
+/* Move src's private blocks into dst. Fragments stored in them stay valid
+   until the next reset; src's free list and spare chunks are simply dropped. */
+static void pool_absorb(spr_fragment_pool_t* dst, spr_fragment_pool_t* src) {
+    spr_arena_block_t* block = src->blocks;
+    if (block) {
+        while (block->next) block = block->next;
+        block->next = dst->blocks;
+        dst->blocks = src->blocks;
+    }
+    dst->active_fragments += src->active_fragments;
+    dst->peak_fragments += src->peak_fragments;
+    dst->total_chunks += src->total_chunks;
+    dst->chunks_used += src->chunks_used;
+    dst->skipped_fragments += src->skipped_fragments;
+    dst->accepted_blocks += src->accepted_blocks;
+    dst->rejected_blocks += src->rejected_blocks;
+    dst->overflow_fragments += src->overflow_fragments;
+    dst->merged_fragments += src->merged_fragments;
+    dst->compact_chunks += src->compact_chunks;
+    dst->heap_allocations += src->heap_allocations;
+    pool_init(src, src->arena);
+}
+
+/* Frame reset of the arena, O(pools): blocks the pools grew join the arena
+   and every chunk becomes free again. The arena is then topped up, in one
+   block, to the most fragments a frame has carved (in chunks) plus one
+   chunk per pool. Each pool leaves its last chunk partly used, and how
+   much depends on how tiles were shared out, so the fragment count rather
+   than the chunk count is the measure, and a frame like that one never
+   grows mid-draw. SPR_ARENA_PRESIZE adds a quarter on top, topped up once
+   less than an eighth is left, so frames that need a chunk more do not
+   trigger a growth each. Growth stops at the memory budget. */
+static void arena_reset(spr_context_t* ctx) {
+    spr_fragment_arena_t* arena = &ctx->arena;
+    int pools = 1 + (ctx->worker_pools ? spr_thread_pool_size(ctx->threads) : 0);
+    size_t carved = 0;
+    int used, keep, want, i;
+
+    arena->heap_allocations = 0;
+    for (i = 0; i < pools; ++i) {
+        spr_fragment_pool_t* pool = i ? &ctx->worker_pools[i - 1] : &ctx->pool;
+        spr_arena_block_t* block = pool->blocks;
+        while (block) {
+            spr_arena_block_t* next = block->next;
+            arena_add_block(arena, block);
+            block = next;
+        }
+        pool->blocks = NULL;
+        pool->spare = NULL;
+        pool->spare_count = 0;
+        pool->total_chunks = 0;
+        if (pool->chunks_used) carved += (size_t)(pool->chunks_used - 1) * SPR_CHUNK_SIZE + pool->pool_cursor;
+    }
+
+    used = (int)((carved + SPR_CHUNK_SIZE - 1) / SPR_CHUNK_SIZE);
+    if (used > arena->high_water) arena->high_water = used;
+    keep = want = arena->high_water + pools;
+    if (arena->flags & SPR_ARENA_PRESIZE) {
+        keep += arena->high_water / 8;
+        want += arena->high_water / 4;
+    }
+    if (arena->high_water > 0 && keep > arena->total_chunks) {
+        int count = want - arena->total_chunks;
+        if (arena->budget) {
+            size_t room = arena->budget > arena->bytes ? arena->budget - arena->bytes : 0;
+            if (arena->flags & SPR_ARENA_HUGE_PAGES) room &= ~(SPR_HUGE_PAGE_SIZE - 1);
+            if (room < arena_block_bytes(1, arena->flags)) {
+                count = 0;
+            } else if (arena_block_bytes(count, arena->flags) > room) {
+                count = (int)((room - sizeof(spr_arena_block_t)) / sizeof(spr_fragment_chunk_t));
+            }
+        }
+        if (count > 0 && arena_reserve(arena, arena_block_bytes(count, arena->flags))) {
+            spr_arena_block_t* block = arena_block_alloc(count, arena->flags);
+            if (block) {
+                arena_add_block(arena, block);
+                arena->heap_allocations++;
+            } else {
+                arena_unreserve(arena, arena_block_bytes(count, arena->flags));
+            }
+        }
+    }
+    arena->next_free = arena->chunk_head;
+}
+
+/* Fold the per-pool counters into ctx->stats. Fragments freed by one worker
+   may belong to another worker's pool, so only the sums are meaningful. */
+static void update_fragment_stats(spr_context_t* ctx) {
+    int active = ctx->pool.active_fragments;
+    int peak = ctx->pool.peak_fragments;
+    int chunks = ctx->arena.total_chunks + ctx->pool.total_chunks;
+    uint64_t skipped = ctx->pool.skipped_fragments;
+    uint64_t accepted = ctx->pool.accepted_blocks;
+    uint64_t rejected = ctx->pool.rejected_blocks;
+    uint64_t overflow = ctx->pool.overflow_fragments;
+    uint64_t merged = ctx->pool.merged_fragments;
+    int compact_chunks = ctx->pool.compact_chunks;
+    uint64_t allocations = ctx->arena.heap_allocations + ctx->pool.heap_allocations;
+    int i;
+
+    spr_texture_flush_samples(); /* Serial draws shade on this thread */
+    if (ctx->worker_pools) {
+        for (i = 0; i < spr_thread_pool_size(ctx->threads); ++i) {
+            active += ctx->worker_pools[i].active_fragments;
+            peak += ctx->worker_pools[i].peak_fragments;
+            chunks += ctx->worker_pools[i].total_chunks;
+            skipped += ctx->worker_pools[i].skipped_fragments;
+            accepted += ctx->worker_pools[i].accepted_blocks;
+            rejected += ctx->worker_pools[i].rejected_blocks;
+            overflow += ctx->worker_pools[i].overflow_fragments;
+            merged += ctx->worker_pools[i].merged_fragments;
+            compact_chunks += ctx->worker_pools[i].compact_chunks;
+            allocations += ctx->worker_pools[i].heap_allocations;
+        }
+    }
+    ctx->stats.active_fragments = active;
+    if (peak > ctx->stats.peak_fragments) ctx->stats.peak_fragments = peak;
+    ctx->stats.total_chunks = chunks;
+    ctx->stats.skipped_fragments = skipped;
+    ctx->stats.accepted_blocks = accepted;
+    ctx->stats.rejected_blocks = rejected;
+    ctx->stats.kbuffer_overflow_fragments = overflow;
+    ctx->stats.merged_fragments = merged;
+    ctx->stats.heap_allocations = allocations;
+
+    /* Fragment memory in use, to compare encodings */
+    ctx->stats.fragment_bytes = (uint64_t)chunks * sizeof(spr_fragment_chunk_t) +
+                                (uint64_t)compact_chunks * SPR_CHUNK_SIZE * sizeof(spr_cfrag_t);
+    ctx->stats.fragment_size = (int)sizeof(spr_fragment_t);
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_COMPACT) {
+        ctx->stats.fragment_size = (int)sizeof(spr_cfrag_t);
+    } else if (ctx->storage == SPR_FRAGMENT_STORAGE_COUNTED) {
+        ctx->stats.fragment_bytes += ctx->frag_capacity * sizeof(spr_kslot_t);
+        ctx->stats.fragment_size = (int)sizeof(spr_kslot_t);
+    }
+}
+
+/* Accumulates one layer front to back; returns 1 once the pixel is opaque */
+static int accumulate_opacity(vec3_t* total_opacity, vec3_t opacity) {
+    total_opacity->x += (1.0f - total_opacity->x) * opacity.x;
+    total_opacity->y += (1.0f - total_opacity->y) * opacity.y;
+    total_opacity->z += (1.0f - total_opacity->z) * opacity.z;
+    return spr_min3(total_opacity->x, total_opacity->y, total_opacity->z) > SPR_OPACITY_THRESHOLD;
+}
+
+/* Folds the layer behind into the one in front ('back' under 'front'), as
+   compositing the two in order would. The result keeps the front depth. */
+static void merge_layers(vec3_t* color, vec3_t* opacity, vec3_t back_color, vec3_t back_opacity) {
+    color->x += (1.0f - opacity->x) * back_color.x;
+    color->y += (1.0f - opacity->y) * back_color.y;
+    color->z += (1.0f - opacity->z) * back_color.z;
+    opacity->x += (1.0f - opacity->x) * back_opacity.x;
+    opacity->y += (1.0f - opacity->y) * back_opacity.y;
+    opacity->z += (1.0f - opacity->z) * back_opacity.z;
+}
+
+static void free_fragments(spr_fragment_pool_t* pool, spr_fragment_t* to_free) {
+    while (to_free) {
+        spr_fragment_t* next = to_free->next;
+        free_fragment(pool, to_free);
+        to_free = next;
+    }
+}
+
+/* Continues the opacity accumulation through 'curr' and the nodes after it.
+   If the pixel saturates, everything behind that node is freed. */
+static void cull_behind(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, spr_fragment_t* curr, vec3_t total_opacity) {
+    while (curr) {
+        if (accumulate_opacity(&total_opacity, curr->opacity)) {
+            /* Cull remaining */
+            free_fragments(pool, curr->next);
+            curr->next = NULL;
+            ctx->saturated_z[idx] = curr->z;
+            return;
+        }
+        curr = curr->next;
+    }
+    ctx->saturated_z[idx] = INFINITY;
+}
+
+/* Out of fragment memory: stores the fragment in a sorted list without a
+   new node by merging the two farthest layers of the pixel (the new one
+   included). A pixel left with SPR_MERGE_KEEP layers or more also merges
+   its last two and frees a node, so that pixels with no layer yet can
+   still get one. Returns 0 if the list is empty and there is nothing to
+   merge. */
+static int list_merge_insert(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out) {
+    spr_fragment_t* last = ctx->fragment_heads[idx];
+    spr_fragment_t* prev = NULL;
+    spr_fragment_t** link;
+    int count;
+
+    if (!last) return 0;
+    while (last->next) {
+        prev = last;
+        last = last->next;
+    }
+
+    if (z > last->z) {
+        /* The new fragment is the farthest: fold it into the last layer */
+        merge_layers(&last->color, &last->opacity, out.color, out.opacity);
+    } else if (!prev || z > prev->z) {
+        /* It lands just in front of the last layer: fold that into it */
+        merge_layers(&out.color, &out.opacity, last->color, last->opacity);
+        last->z = z;
+        last->color = out.color;
+        last->opacity = out.opacity;
+    } else {
+        /* Fold the last layer into the one before and reuse its node */
+        merge_layers(&prev->color, &prev->opacity, last->color, last->opacity);
+        prev->next = NULL;
+        link = &ctx->fragment_heads[idx];
+        while (*link && (*link)->z < z) link = &(*link)->next;
+        last->z = z;
+        last->color = out.color;
+        last->opacity = out.opacity;
+        last->next = *link;
+        *link = last;
+    }
+    pool->merged_fragments++;
+
+    /* Give a node back */
+    prev = NULL;
+    last = ctx->fragment_heads[idx];
+    for (count = 1; last->next; ++count) {
+        prev = last;
+        last = last->next;
+    }
+    if (count >= SPR_MERGE_KEEP) {
+        merge_layers(&prev->color, &prev->opacity, last->color, last->opacity);
+        prev->next = NULL;
+        free_fragment(pool, last);
+        pool->merged_fragments++;
+    }
+    return 1;
 }
 
-static void insert_fragment(spr_context_t* ctx, int idx, float z, spr_fs_output_t out) {
+/* Under a tight budget, a pixel that already has a layer merges rather
+   than take one of the nodes kept back for first layers */
+static int list_at_cap(const spr_context_t* ctx, const spr_fragment_t* f) {
+    return f && budget_tight(&ctx->arena);
+}
+
+/* Sorted insert into the pixel's list. 'total_opacity' is the opacity of
+   whatever lies in front of the list (the k-buffer slots, or nothing). */
+static void list_insert(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out, vec3_t total_opacity) {
     spr_fragment_t* new_frag;
     spr_fragment_t* curr;
     spr_fragment_t* prev;
-    
-    /* Accumulator for opacity (Front-to-Back) */
-    /* Accum = Accum + (1 - Accum) * Opacity */
-    vec3_t total_opacity = {0.0f, 0.0f, 0.0f};
+    vec3_t front_opacity = total_opacity;
     
     /* 1. Check for Full Occlusion before insertion point */
     curr = ctx->fragment_heads[idx];
@@ -194,24 +946,21 @@ static void insert_fragment(spr_context_t* ctx, int idx, float z, spr_fs_output_
     
     /* Sorted Insertion: Ascending Z (Near -> Far) */
     while (curr && curr->z < z) {
-        /* Update opacity with current node */
-        total_opacity.x += (1.0f - total_opacity.x) * curr->opacity.x;
-        total_opacity.y += (1.0f - total_opacity.y) * curr->opacity.y;
-        total_opacity.z += (1.0f - total_opacity.z) * curr->opacity.z;
-        
-        /* Early Out: Occluded? */
-        if (spr_min3(total_opacity.x, total_opacity.y, total_opacity.z) > SPR_OPACITY_THRESHOLD) {
-            /* We are hidden behind existing fragments. Discard. */
-            return;
-        }
+        /* Early Out: Occluded? We are hidden behind existing fragments. Discard. */
+        if (accumulate_opacity(&total_opacity, curr->opacity)) return;
         
         prev = curr;
         curr = curr->next;
     }
     
     /* 2. Insert New Fragment */
-    new_frag = alloc_fragment(ctx);
-    if (!new_frag) return;
+    new_frag = list_at_cap(ctx, ctx->fragment_heads[idx]) ? NULL : alloc_fragment(pool);
+    if (!new_frag) {
+        if (list_merge_insert(ctx, pool, idx, z, out)) {
+            cull_behind(ctx, pool, idx, ctx->fragment_heads[idx], front_opacity);
+        }
+        return;
+    }
     
     new_frag->z = z;
     new_frag->color = out.color;
@@ -220,423 +969,1230 @@ static void insert_fragment(spr_context_t* ctx, int idx, float z, spr_fs_output_
     if (prev) {
         prev->next = new_frag;
     } else {
+        if (!curr) budget_first_layer(&ctx->arena);
         ctx->fragment_heads[idx] = new_frag;
     }
     new_frag->next = curr;
     
-    /* 3. Update Opacity with New Fragment */
-    total_opacity.x += (1.0f - total_opacity.x) * new_frag->opacity.x;
-    total_opacity.y += (1.0f - total_opacity.y) * new_frag->opacity.y;
-    total_opacity.z += (1.0f - total_opacity.z) * new_frag->opacity.z;
-    
-    /* 4. Cull Fragments Behind */
-    if (spr_min3(total_opacity.x, total_opacity.y, total_opacity.z) > SPR_OPACITY_THRESHOLD) {
-        /* Everything after new_frag is occluded */
-        spr_fragment_t* to_free = new_frag->next;
-        new_frag->next = NULL;
-        
-        while (to_free) {
-            spr_fragment_t* next = to_free->next;
-            free_fragment(ctx, to_free);
-            to_free = next;
-        }
+    /* 3. Update opacity with the new fragment and cull whatever it (or a
+       fragment behind it) now hides */
+    cull_behind(ctx, pool, idx, new_frag, total_opacity);
+}
+
+/* K-buffer insert: a shift within the pixel's slot array. When the array is
+   full, the farthest slot is pushed onto the front of the overflow list
+   (it lies in front of everything there); fragments behind all K slots go
+   straight into the list. Culling is the same as list_insert() over the
+   concatenation, so the image does not depend on the storage mode. */
+static void kbuffer_insert(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out) {
+    spr_kslot_t* slots = &ctx->kbuffer[(size_t)idx * SPR_KBUFFER_K];
+    int n = ctx->kcount[idx];
+    vec3_t total_opacity = {0.0f, 0.0f, 0.0f};
+    int i, j;
+
+    for (i = 0; i < n && slots[i].z < z; ++i) {
+        if (accumulate_opacity(&total_opacity, slots[i].opacity)) return;
+    }
+    if (i == SPR_KBUFFER_K) {
+        list_insert(ctx, pool, idx, z, out, total_opacity);
         return;
     }
-    
-    /* 5. Continue Traversal (if we didn't cull everything immediately) */
-    /* Note: If we inserted, we need to check if SUBSEQUENT fragments cause occlusion */
-    /* Only need to continue if there were fragments after us */
-    prev = new_frag;
-    curr = new_frag->next;
-    
-    while (curr) {
-        total_opacity.x += (1.0f - total_opacity.x) * curr->opacity.x;
-        total_opacity.y += (1.0f - total_opacity.y) * curr->opacity.y;
-        total_opacity.z += (1.0f - total_opacity.z) * curr->opacity.z;
-        
-        if (spr_min3(total_opacity.x, total_opacity.y, total_opacity.z) > SPR_OPACITY_THRESHOLD) {
-            /* Cull remaining */
-            spr_fragment_t* to_free = curr->next;
-            curr->next = NULL;
-             while (to_free) {
-                spr_fragment_t* next = to_free->next;
-                free_fragment(ctx, to_free);
-                to_free = next;
+
+    if (n == SPR_KBUFFER_K) {
+        spr_fragment_t* spill = list_at_cap(ctx, ctx->fragment_heads[idx]) ? NULL : alloc_fragment(pool);
+        if (spill) {
+            spill->z = slots[n - 1].z;
+            spill->color = slots[n - 1].color;
+            spill->opacity = slots[n - 1].opacity;
+            spill->next = ctx->fragment_heads[idx];
+            ctx->fragment_heads[idx] = spill;
+            pool->overflow_fragments++;
+        } else {
+            /* Out of memory: merge the spilled slot into the list, or into
+               the slot before it if the list is empty */
+            spr_fs_output_t last;
+            last.color = slots[n - 1].color;
+            last.opacity = slots[n - 1].opacity;
+            if (!list_merge_insert(ctx, pool, idx, slots[n - 1].z, last)) {
+                merge_layers(&slots[n - 2].color, &slots[n - 2].opacity, last.color, last.opacity);
+                pool->merged_fragments++;
             }
+        }
+        n--;
+    }
+    for (j = n; j > i; --j) slots[j] = slots[j - 1];
+    slots[i].z = z;
+    slots[i].color = out.color;
+    slots[i].opacity = out.opacity;
+    n++;
+
+    for (j = i; j < n; ++j) {
+        if (accumulate_opacity(&total_opacity, slots[j].opacity)) {
+            ctx->kcount[idx] = (uint8_t)(j + 1);
+            free_fragments(pool, ctx->fragment_heads[idx]);
+            ctx->fragment_heads[idx] = NULL;
+            ctx->saturated_z[idx] = slots[j].z;
             return;
         }
-        prev = curr;
-        curr = curr->next;
     }
+    ctx->kcount[idx] = (uint8_t)n;
+    cull_behind(ctx, pool, idx, ctx->fragment_heads[idx], total_opacity);
 }
 
-void spr_draw_triangle_2d_flat(spr_context_t* ctx, vec2_t v0, vec2_t v1, vec2_t v2, uint32_t color) {
-    /* Legacy Function: Just draw opaque to buffer for debug */
-    /* Not using A-Buffer here */
-    int min_x, min_y, max_x, max_y;
-    int x, y;
-    float area;
-    int width = ctx->fb.width;
-    int height = ctx->fb.height;
-
-    min_x = (int)spr_min3(v0.x, v1.x, v2.x);
-    min_y = (int)spr_min3(v0.y, v1.y, v2.y);
-    max_x = (int)spr_max3(v0.x, v1.x, v2.x);
-    max_y = (int)spr_max3(v0.y, v1.y, v2.y);
-
-    if (min_x < 0) min_x = 0;
-    if (min_y < 0) min_y = 0;
-    if (max_x >= width) max_x = width - 1;
-    if (max_y >= height) max_y = height - 1;
-
-    area = edge_function(v0, v1, v2);
-    
-    for (y = min_y; y <= max_y; ++y) {
-        for (x = min_x; x <= max_x; ++x) {
-            vec2_t p; p.x = x + 0.5f; p.y = y + 0.5f;
-            float w0 = edge_function(v1, v2, p);
-            float w1 = edge_function(v2, v0, p);
-            float w2 = edge_function(v0, v1, p);
-            
-            int inside = (area > 0) ? (w0 >= 0 && w1 >= 0 && w2 >= 0) : (w0 <= 0 && w1 <= 0 && w2 <= 0);
-            if (inside) ctx->fb.color_buffer[y * width + x] = color;
+/* list_merge_insert() for the unsorted append list: the two farthest
+   layers are found by a scan. Merging rewrites nodes in place, which is
+   safe because the tiled rasterizer gives each pixel a single writer. */
+static void append_merge(spr_fragment_pool_t* pool, spr_fragment_t** head, float z, spr_fs_output_t out) {
+    spr_fragment_t** far_link = NULL;
+    spr_fragment_t* far = NULL;  /* Farthest layer */
+    spr_fragment_t* near = NULL; /* Second farthest */
+    spr_fragment_t** link;
+    int depth = 0;
+
+    for (link = head; *link; link = &(*link)->next) {
+        spr_fragment_t* f = *link;
+        if (!far || f->z > far->z) {
+            near = far;
+            far = f;
+        } else if (!near || f->z > near->z) {
+            near = f;
+        }
+        depth++;
+    }
+    if (!far) return;
+
+    if (z > far->z) {
+        merge_layers(&far->color, &far->opacity, out.color, out.opacity);
+    } else if (!near || z > near->z) {
+        merge_layers(&out.color, &out.opacity, far->color, far->opacity);
+        far->z = z;
+        far->color = out.color;
+        far->opacity = out.opacity;
+    } else {
+        merge_layers(&near->color, &near->opacity, far->color, far->opacity);
+        far->z = z;
+        far->color = out.color;
+        far->opacity = out.opacity;
+    }
+    pool->merged_fragments++;
+    if (depth < SPR_MERGE_KEEP) return;
+
+    /* Give a node back: merge the (new) farthest layer into the next one */
+    far = near = NULL;
+    for (link = head; *link; link = &(*link)->next) {
+        spr_fragment_t* f = *link;
+        if (!far || f->z > far->z) {
+            near = far;
+            far = f;
+            far_link = link;
+        } else if (!near || f->z > near->z) {
+            near = f;
         }
     }
+    merge_layers(&near->color, &near->opacity, far->color, far->opacity);
+    *far_link = far->next;
+    free_fragment(pool, far);
+    pool->merged_fragments++;
 }
 
-/* --- Rasterizers (A-Buffer) --- */
+/* Append insert: O(1), no sorting or culling. The node is pushed onto the
+   head with an atomic exchange, so appends to one pixel may race; the list
+   ends up newest first, which is the order the sorted path gives z ties. */
+static void append_fragment(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out) {
+    spr_fragment_t* new_frag = list_at_cap(ctx, ctx->fragment_heads[idx]) ? NULL : alloc_fragment(pool);
+    if (!new_frag) {
+        append_merge(pool, &ctx->fragment_heads[idx], z, out);
+        return;
+    }
 
-static void spr_rasterize_triangle_cpu(spr_context_t* ctx, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
-    int min_x, min_y, max_x, max_y;
-    int x, y;
-    float area;
-    int width, height;
-    
-    if (!ctx) return;
-    width = ctx->fb.width;
-    height = ctx->fb.height;
+    new_frag->z = z;
+    new_frag->color = out.color;
+    new_frag->opacity = out.opacity;
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    new_frag->next = __atomic_exchange_n(&ctx->fragment_heads[idx], new_frag, __ATOMIC_ACQ_REL);
+#else
+    new_frag->next = ctx->fragment_heads[idx];
+    ctx->fragment_heads[idx] = new_frag;
+#endif
+    if (!new_frag->next) budget_first_layer(&ctx->arena);
+}
 
-    float v0x = v0->position.x; float v0y = v0->position.y;
-    float v1x = v1->position.x; float v1y = v1->position.y;
-    float v2x = v2->position.x; float v2y = v2->position.y;
+/* --- Compact storage --- */
 
-    min_x = (int)spr_min3(v0x, v1x, v2x);
-    min_y = (int)spr_min3(v0y, v1y, v2y);
-    max_x = (int)spr_max3(v0x, v1x, v2x);
-    max_y = (int)spr_max3(v0y, v1y, v2y);
+static SPR_INLINE spr_cfrag_t* cfrag(const spr_context_t* ctx, uint32_t node) {
+    return &ctx->cfrag_chunks[node >> SPR_CHUNK_SHIFT][node & (SPR_CHUNK_SIZE - 1)];
+}
 
-    if (min_x < 0) min_x = 0;
-    if (min_y < 0) min_y = 0;
-    if (max_x >= width) max_x = width - 1;
-    if (max_y >= height) max_y = height - 1;
+/* floor((z + 1) * 2^23): monotonic in z, so sorting on it keeps the order */
+static uint32_t encode_depth(float z) {
+    float u = (z + 1.0f) * 8388608.0f;
+    if (!(u > 0.0f)) return 0;
+    if (u >= 16777215.0f) return 0xFFFFFF;
+    return (uint32_t)u;
+}
 
-    vec2_t p0 = {v0x, v0y};
-    vec2_t p1 = {v1x, v1y};
-    vec2_t p2 = {v2x, v2y};
+/* Largest z that fragment_hidden() may let through for saturation depth d.
+   Every z above it encodes to more than d, i.e. lies strictly behind. */
+static float compact_saturated_z(uint32_t depth) {
+    if (depth >= 0xFFFFFF) return 1.0f;
+    return nextafterf((float)(depth + 1) / 8388608.0f - 1.0f, -INFINITY);
+}
 
-    area = edge_function(p0, p1, p2);
-    if (ctx->cull_backface && area < 0) return;
-    if (fabs(area) < 0.0001f) return;
-    
-    float one_over_area = 1.0f / area;
+static uint32_t encode_unorm(float v, float scale) {
+    if (!(v > 0.0f)) return 0;
+    if (v >= 1.0f) return (uint32_t)scale;
+    return (uint32_t)(v * scale + 0.5f);
+}
 
-    float step_x_w0 = v2y - v1y; float step_y_w0 = v1x - v2x;
-    float step_x_w1 = v0y - v2y; float step_y_w1 = v2x - v0x;
-    float step_x_w2 = v1y - v0y; float step_y_w2 = v0x - v1x;
+static void encode_layer(spr_cfrag_t* f, uint32_t depth, vec3_t color, vec3_t opacity) {
+    f->depth_opacity = depth << 8 | encode_unorm(opacity.x, 255.0f);
+    f->color = encode_unorm(color.x, 1023.0f) | encode_unorm(color.y, 1023.0f) << 10 |
+               encode_unorm(color.z, 1023.0f) << 20;
+    f->opacity_gb = encode_unorm(opacity.y, 255.0f) | encode_unorm(opacity.z, 255.0f) << 8;
+}
 
-    vec2_t start_p; start_p.x = (float)min_x + 0.5f; start_p.y = (float)min_y + 0.5f;
-    float row_w0 = edge_function(p1, p2, start_p);
-    float row_w1 = edge_function(p2, p0, start_p);
-    float row_w2 = edge_function(p0, p1, start_p);
+static void encode_fragment(spr_cfrag_t* f, float z, spr_fs_output_t out) {
+    encode_layer(f, encode_depth(z), out.color, out.opacity);
+}
 
-    if (area < 0) {
-        area = -area; one_over_area = -one_over_area;
-        row_w0 = -row_w0; step_x_w0 = -step_x_w0; step_y_w0 = -step_y_w0;
-        row_w1 = -row_w1; step_x_w1 = -step_x_w1; step_y_w1 = -step_y_w1;
-        row_w2 = -row_w2; step_x_w2 = -step_x_w2; step_y_w2 = -step_y_w2;
-    }
+static vec3_t decode_opacity(const spr_cfrag_t* f) {
+    vec3_t o;
+    o.x = (float)(f->depth_opacity & 0xFF) * (1.0f / 255.0f);
+    o.y = (float)(f->opacity_gb & 0xFF) * (1.0f / 255.0f);
+    o.z = (float)(f->opacity_gb >> 8 & 0xFF) * (1.0f / 255.0f);
+    return o;
+}
 
-    for (y = min_y; y <= max_y; ++y) {
-        float w0 = row_w0;
-        float w1 = row_w1;
-        float w2 = row_w2;
-        
-        for (x = min_x; x <= max_x; ++x) {
-            if (w0 >= 0 && w1 >= 0 && w2 >= 0) {
-                float alpha = w0 * one_over_area;
-                float beta = w1 * one_over_area;
-                float gamma = w2 * one_over_area;
-                
-                float inv_w0 = v0->position.w;
-                float inv_w1 = v1->position.w;
-                float inv_w2 = v2->position.w;
-                
-                float w_recip = alpha * inv_w0 + beta * inv_w1 + gamma * inv_w2;
-                float w_final = 1.0f / w_recip;
-                
-                float z = alpha * v0->position.z + beta * v1->position.z + gamma * v2->position.z;
-                
-                /* No Depth Test here - Just A-Buffer Insertion */
-                /* Assuming Near/Far clipping happens in vertex stage (partially) */
-                if (z >= -1.0f && z <= 1.0f) {
-                    spr_vertex_out_t interp;
-                    interp.position.x = (float)x + 0.5f;
-                    interp.position.y = (float)y + 0.5f;
-                    interp.position.z = z;
-                    interp.position.w = w_final;
-                    
-                    /* Interpolate attributes */
-                    float wa = alpha * inv_w0 * w_final;
-                    float wb = beta * inv_w1 * w_final;
-                    float wg = gamma * inv_w2 * w_final;
-                    
-                    interp.color.x = v0->color.x * wa + v1->color.x * wb + v2->color.x * wg;
-                    interp.color.y = v0->color.y * wa + v1->color.y * wb + v2->color.y * wg;
-                    interp.color.z = v0->color.z * wa + v1->color.z * wb + v2->color.z * wg;
-                    interp.color.w = v0->color.w * wa + v1->color.w * wb + v2->color.w * wg;
-
-                    interp.uv.x = v0->uv.x * wa + v1->uv.x * wb + v2->uv.x * wg;
-                    interp.uv.y = v0->uv.y * wa + v1->uv.y * wb + v2->uv.y * wg;
-
-                    interp.normal.x = v0->normal.x * wa + v1->normal.x * wb + v2->normal.x * wg;
-                    interp.normal.y = v0->normal.y * wa + v1->normal.y * wb + v2->normal.y * wg;
-                    interp.normal.z = v0->normal.z * wa + v1->normal.z * wb + v2->normal.z * wg;
-
-                    interp.tangent.x = v0->tangent.x * wa + v1->tangent.x * wb + v2->tangent.x * wg;
-                    interp.tangent.y = v0->tangent.y * wa + v1->tangent.y * wb + v2->tangent.y * wg;
-                    interp.tangent.z = v0->tangent.z * wa + v1->tangent.z * wb + v2->tangent.z * wg;
-                    interp.tangent.w = v0->tangent.w;
-
-                    interp.barycentric.x = v0->barycentric.x * wa + v1->barycentric.x * wb + v2->barycentric.x * wg;
-                    interp.barycentric.y = v0->barycentric.y * wa + v1->barycentric.y * wb + v2->barycentric.y * wg;
-                    interp.barycentric.z = v0->barycentric.z * wa + v1->barycentric.z * wb + v2->barycentric.z * wg;
-
-                    spr_fs_output_t out = ctx->current_fs(ctx->current_uniforms, &interp);
-                    insert_fragment(ctx, y * width + x, z, out);
+static vec3_t decode_color(const spr_cfrag_t* f) {
+    vec3_t c;
+    c.x = (float)(f->color & 0x3FF) * (1.0f / 1023.0f);
+    c.y = (float)(f->color >> 10 & 0x3FF) * (1.0f / 1023.0f);
+    c.z = (float)(f->color >> 20 & 0x3FF) * (1.0f / 1023.0f);
+    return c;
+}
+
+static uint32_t alloc_cfrag(spr_context_t* ctx, spr_fragment_pool_t* pool) {
+    uint32_t node;
+    if (pool->cfree != SPR_CFRAG_NIL) {
+        node = pool->cfree;
+        pool->cfree = cfrag(ctx, node)->next;
+    } else {
+        if (pool->ccursor == pool->cend) {
+            /* Claim the next chunk of the shared table; its owner allocates it */
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+            int c = __atomic_fetch_add(&ctx->cfrag_chunk_count, 1, __ATOMIC_RELAXED);
+#else
+            int c = ctx->cfrag_chunk_count++;
+#endif
+            if (c >= SPR_COMPACT_MAX_CHUNKS) return SPR_CFRAG_NIL;
+            if (!ctx->cfrag_chunks[c]) {
+                size_t bytes = SPR_CHUNK_SIZE * sizeof(spr_cfrag_t);
+                if (!arena_reserve(&ctx->arena, bytes)) return SPR_CFRAG_NIL;
+                ctx->cfrag_chunks[c] = (spr_cfrag_t*)malloc(bytes);
+                if (!ctx->cfrag_chunks[c]) {
+                    arena_unreserve(&ctx->arena, bytes);
+                    return SPR_CFRAG_NIL;
                 }
+                pool->heap_allocations++;
             }
-            w0 += step_x_w0; w1 += step_x_w1; w2 += step_x_w2;
+            budget_charge(&ctx->arena, SPR_CHUNK_SIZE * sizeof(spr_cfrag_t));
+            pool->ccursor = (uint32_t)c << SPR_CHUNK_SHIFT;
+            pool->cend = pool->ccursor + SPR_CHUNK_SIZE;
+            pool->compact_chunks++;
         }
-        row_w0 += step_y_w0; row_w1 += step_y_w1; row_w2 += step_y_w2;
+        node = pool->ccursor++;
     }
-}
-
-static void spr_rasterize_triangle_simd(spr_context_t* ctx, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
-#if defined(__SSE2__)
-    int min_x, min_y, max_x, max_y;
-    int y;
-    float area;
-    int width, height;
-    
-    if (!ctx) return;
-    width = ctx->fb.width;
-    height = ctx->fb.height;
 
-    float v0x = v0->position.x; float v0y = v0->position.y;
-    float v1x = v1->position.x; float v1y = v1->position.y;
-    float v2x = v2->position.x; float v2y = v2->position.y;
+    pool->active_fragments++;
+    if (pool->active_fragments > pool->peak_fragments) {
+        pool->peak_fragments = pool->active_fragments;
+    }
+    return node;
+}
 
-    min_x = (int)spr_min3(v0x, v1x, v2x);
-    min_y = (int)spr_min3(v0y, v1y, v2y);
-    max_x = (int)spr_max3(v0x, v1x, v2x);
-    max_y = (int)spr_max3(v0y, v1y, v2y);
+/* Frame reset headroom for compact storage, with the same rule as
+   arena_reset(), within the budget. Runs before the pools are reset. */
+static void compact_reserve(spr_context_t* ctx, int pools) {
+    size_t bytes = SPR_CHUNK_SIZE * sizeof(spr_cfrag_t);
+    size_t carved = 0;
+    int used, keep, want, have = 0, c, i;
 
-    if (min_x < 0) min_x = 0;
+    for (i = 0; i < pools; ++i) {
+        const spr_fragment_pool_t* pool = i ? &ctx->worker_pools[i - 1] : &ctx->pool;
+        if (pool->compact_chunks) carved += (size_t)(pool->compact_chunks - 1) * SPR_CHUNK_SIZE + (pool->ccursor - (pool->cend - SPR_CHUNK_SIZE));
+    }
+    used = (int)((carved + SPR_CHUNK_SIZE - 1) / SPR_CHUNK_SIZE);
+
+    if (used > ctx->cfrag_high_water) ctx->cfrag_high_water = used;
+    if (!ctx->cfrag_high_water) return;
+    keep = want = ctx->cfrag_high_water + pools;
+    if (ctx->arena.flags & SPR_ARENA_PRESIZE) {
+        keep += ctx->cfrag_high_water / 8;
+        want += ctx->cfrag_high_water / 4;
+    }
+    while (have < SPR_COMPACT_MAX_CHUNKS && ctx->cfrag_chunks[have]) have++;
+    if (keep <= have) return;
+    if (want > SPR_COMPACT_MAX_CHUNKS) want = SPR_COMPACT_MAX_CHUNKS;
+    for (c = have; c < want; ++c) {
+        if (ctx->cfrag_chunks[c]) continue;
+        if (!arena_reserve(&ctx->arena, bytes)) return;
+        ctx->cfrag_chunks[c] = (spr_cfrag_t*)malloc(bytes);
+        if (!ctx->cfrag_chunks[c]) {
+            arena_unreserve(&ctx->arena, bytes);
+            return;
+        }
+        ctx->arena.heap_allocations++;
+    }
+}
+
+/* Frame reset of the budget headroom. Pixels only start merging once what
+   is left of the budget would not give a first node to every pixel still
+   expected to need one: as many as the busiest frame gave one to, or every
+   pixel before a frame has been drawn. A k-buffer pixel with an empty list
+   merges into its slots instead, so k-buffer storage keeps nothing back. */
+static void budget_reset(spr_context_t* ctx, int pixel_count) {
+    spr_fragment_arena_t* arena = &ctx->arena;
+
+    if (arena->first_layers > arena->first_layers_high_water) arena->first_layers_high_water = arena->first_layers;
+    arena->reserved_layers = arena->first_layers_high_water ? arena->first_layers_high_water : pixel_count;
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_KBUFFER) arena->reserved_layers = 0;
+    arena->layer_bytes = ctx->storage == SPR_FRAGMENT_STORAGE_COMPACT ? sizeof(spr_cfrag_t) : sizeof(spr_fragment_t);
+    arena->pools = 1;
+    if (ctx->rasterizer_mode == SPR_RASTERIZER_TILED) {
+        /* The workers, which the first tiled draw may not have started yet */
+        arena->pools = ctx->threads ? spr_thread_pool_size(ctx->threads) :
+                       ctx->thread_count > 0 ? ctx->thread_count : spr_cpu_count();
+    }
+    arena->first_layers = 0;
+    arena->claimed = 0;
+    arena->tight = 0;
+}
+
+static void free_cfrags(spr_context_t* ctx, spr_fragment_pool_t* pool, uint32_t node) {
+    while (node != SPR_CFRAG_NIL) {
+        spr_cfrag_t* f = cfrag(ctx, node);
+        uint32_t next = f->next;
+        f->next = pool->cfree;
+        pool->cfree = node;
+        pool->active_fragments--;
+        node = next;
+    }
+}
+
+/* Continues the opacity accumulation from 'curr' and frees the nodes
+   behind the point where the pixel saturates, as cull_behind() does. */
+static void compact_cull(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, uint32_t curr, vec3_t total_opacity) {
+    for (; curr != SPR_CFRAG_NIL; curr = cfrag(ctx, curr)->next) {
+        spr_cfrag_t* f = cfrag(ctx, curr);
+        if (accumulate_opacity(&total_opacity, decode_opacity(f))) {
+            free_cfrags(ctx, pool, f->next);
+            f->next = SPR_CFRAG_NIL;
+            ctx->saturated_z[idx] = compact_saturated_z(f->depth_opacity >> 8);
+            return;
+        }
+    }
+    ctx->saturated_z[idx] = INFINITY;
+}
+
+/* Re-encodes 'front' with 'back' merged under it */
+static void compact_merge_layers(spr_cfrag_t* front, const spr_cfrag_t* back) {
+    vec3_t color = decode_color(front);
+    vec3_t opacity = decode_opacity(front);
+    merge_layers(&color, &opacity, decode_color(back), decode_opacity(back));
+    encode_layer(front, front->depth_opacity >> 8, color, opacity);
+}
+
+static int compact_at_cap(const spr_context_t* ctx, uint32_t node) {
+    return node != SPR_CFRAG_NIL && budget_tight(&ctx->arena);
+}
+
+/* list_merge_insert() on packed nodes */
+static int compact_merge_insert(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, spr_cfrag_t* enc) {
+    uint32_t depth = enc->depth_opacity >> 8;
+    uint32_t last = ctx->cfrag_heads[idx];
+    uint32_t prev = SPR_CFRAG_NIL;
+    uint32_t* link;
+    int count;
+
+    if (last == SPR_CFRAG_NIL) return 0;
+    while (cfrag(ctx, last)->next != SPR_CFRAG_NIL) {
+        prev = last;
+        last = cfrag(ctx, last)->next;
+    }
+
+    if (depth > (cfrag(ctx, last)->depth_opacity >> 8)) {
+        compact_merge_layers(cfrag(ctx, last), enc);
+    } else if (prev == SPR_CFRAG_NIL || depth > (cfrag(ctx, prev)->depth_opacity >> 8)) {
+        compact_merge_layers(enc, cfrag(ctx, last));
+        enc->next = SPR_CFRAG_NIL;
+        *cfrag(ctx, last) = *enc;
+    } else {
+        compact_merge_layers(cfrag(ctx, prev), cfrag(ctx, last));
+        cfrag(ctx, prev)->next = SPR_CFRAG_NIL;
+        link = &ctx->cfrag_heads[idx];
+        while (*link != SPR_CFRAG_NIL && (cfrag(ctx, *link)->depth_opacity >> 8) < depth) {
+            link = &cfrag(ctx, *link)->next;
+        }
+        enc->next = *link;
+        *cfrag(ctx, last) = *enc;
+        *link = last;
+    }
+    pool->merged_fragments++;
+
+    /* Give a node back */
+    prev = SPR_CFRAG_NIL;
+    last = ctx->cfrag_heads[idx];
+    for (count = 1; cfrag(ctx, last)->next != SPR_CFRAG_NIL; ++count) {
+        prev = last;
+        last = cfrag(ctx, last)->next;
+    }
+    if (count >= SPR_MERGE_KEEP) {
+        compact_merge_layers(cfrag(ctx, prev), cfrag(ctx, last));
+        cfrag(ctx, prev)->next = SPR_CFRAG_NIL;
+        free_cfrags(ctx, pool, last);
+        pool->merged_fragments++;
+    }
+    return 1;
+}
+
+/* list_insert() on packed nodes. Depth and opacity are compared in their
+   encoded form, so insertion, culling and resolve all see the same values. */
+static void compact_insert(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out) {
+    spr_cfrag_t enc;
+    uint32_t depth, node, curr, prev = SPR_CFRAG_NIL;
+    vec3_t total_opacity = {0.0f, 0.0f, 0.0f};
+
+    encode_fragment(&enc, z, out);
+    depth = enc.depth_opacity >> 8;
+
+    /* Sorted Insertion: Ascending depth, ties in front */
+    curr = ctx->cfrag_heads[idx];
+    while (curr != SPR_CFRAG_NIL && (cfrag(ctx, curr)->depth_opacity >> 8) < depth) {
+        if (accumulate_opacity(&total_opacity, decode_opacity(cfrag(ctx, curr)))) return;
+        prev = curr;
+        curr = cfrag(ctx, curr)->next;
+    }
+
+    node = compact_at_cap(ctx, ctx->cfrag_heads[idx]) ? SPR_CFRAG_NIL : alloc_cfrag(ctx, pool);
+    if (node == SPR_CFRAG_NIL) {
+        vec3_t none = {0.0f, 0.0f, 0.0f};
+        if (compact_merge_insert(ctx, pool, idx, &enc)) {
+            compact_cull(ctx, pool, idx, ctx->cfrag_heads[idx], none);
+        }
+        return;
+    }
+    enc.next = curr;
+    *cfrag(ctx, node) = enc;
+    if (prev != SPR_CFRAG_NIL) {
+        cfrag(ctx, prev)->next = node;
+    } else {
+        if (curr == SPR_CFRAG_NIL) budget_first_layer(&ctx->arena);
+        ctx->cfrag_heads[idx] = node;
+    }
+
+    /* Cull behind the point where the pixel saturates */
+    compact_cull(ctx, pool, idx, node, total_opacity);
+}
+
+/* Counted insert: the next entry of the pixel's slice. A pixel can only run
+   out of room if the write pass draws more than the count pass did. */
+static void counted_insert(spr_context_t* ctx, int idx, float z, spr_fs_output_t out) {
+    uint32_t at = ctx->frag_cursor[idx];
+    spr_kslot_t* f;
+    if (at == ctx->frag_offset[idx + 1]) return;
+
+    f = &ctx->frag_array[at];
+    f->z = z;
+    f->color = out.color;
+    f->opacity = out.opacity;
+    ctx->frag_cursor[idx] = at + 1;
+}
+
+static void insert_fragment(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out) {
+    vec3_t total_opacity = {0.0f, 0.0f, 0.0f};
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_COUNTED) {
+        counted_insert(ctx, idx, z, out);
+        return;
+    }
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_COMPACT) {
+        compact_insert(ctx, pool, idx, z, out);
+        return;
+    }
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_APPEND) {
+        append_fragment(ctx, pool, idx, z, out);
+        return;
+    }
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_KBUFFER) {
+        kbuffer_insert(ctx, pool, idx, z, out);
+        return;
+    }
+    list_insert(ctx, pool, idx, z, out, total_opacity);
+}
+
+static uint32_t pack_color(float r, float g, float b) {
+    if (r > 1.0f) r = 1.0f;
+    if (g > 1.0f) g = 1.0f;
+    if (b > 1.0f) b = 1.0f;
+    return spr_make_color((uint8_t)(r * 255.0f), (uint8_t)(g * 255.0f), (uint8_t)(b * 255.0f), 255);
+}
+
+/* Rasterizer output stage. In hybrid mode fully opaque fragments are
+   depth-tested against fb.depth_buffer and written straight to the colour
+   buffer; only translucent fragments in front of the opaque surface reach the
+   A-buffer. spr_resolve() then composites the lists over the opaque result. */
+static void write_fragment(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z, spr_fs_output_t out) {
+    if (ctx->opaque_zbuffer) {
+        float* depth = &ctx->fb.depth_buffer[idx];
+        if (z > *depth) return; /* Behind the nearest opaque surface */
+
+        if (spr_min3(out.opacity.x, out.opacity.y, out.opacity.z) > SPR_OPACITY_THRESHOLD) {
+            /* '<=' keeps the A-buffer rule that later fragments win depth ties */
+            *depth = z;
+            ctx->color[idx] = pack_color(out.color.x, out.color.y, out.color.z);
+            return;
+        }
+    }
+    insert_fragment(ctx, pool, idx, z, out);
+}
+
+/* Early rejection, run by the rasterizers before interpolation and shading.
+   A fragment strictly behind the saturation point would be discarded by
+   insert_fragment() anyway (ties are inserted in front, so they still count),
+   and in hybrid mode anything behind the opaque depth is dropped by
+   write_fragment(). Skipping it early never changes the image. */
+static int fragment_hidden(spr_context_t* ctx, spr_fragment_pool_t* pool, int idx, float z) {
+    if (z > ctx->saturated_z[idx] || (ctx->opaque_zbuffer && z > ctx->fb.depth_buffer[idx])) {
+        pool->skipped_fragments++;
+        return 1;
+    }
+    return 0;
+}
+
+/* --- Pixel Layout --- */
+
+/* Index of pixel (x, y) in the per-pixel arrays. The tiled layout stores
+   each SPR_TILE_SIZE tile contiguously (tiles in row-major order), as 8x8
+   blocks of 64 consecutive pixels, so a triangle's pixels share cache lines
+   and pages, and a tiled rasterizer worker only touches its own run. */
+static SPR_INLINE int pixel_index(const spr_context_t* ctx, int x, int y) {
+    if (!ctx->tiled_layout) return y * ctx->fb.width + x;
+    return ((y >> SPR_TILE_SHIFT) * ctx->tiles_x + (x >> SPR_TILE_SHIFT)) << (2 * SPR_TILE_SHIFT) |
+           (y & (SPR_TILE_SIZE - 1)) >> 3 << (SPR_TILE_SHIFT + 3) |
+           (x & (SPR_TILE_SIZE - 1)) >> 3 << 6 |
+           (y & 7) << 3 | (x & 7);
+}
+
+/* --- Lazy Clear --- */
+
+static void tile_bounds(const spr_context_t* ctx, int tile, int* x0, int* y0, int* x1, int* y1) {
+    *x0 = (tile % ctx->tiles_x) * SPR_TILE_SIZE;
+    *y0 = (tile / ctx->tiles_x) * SPR_TILE_SIZE;
+    *x1 = *x0 + SPR_TILE_SIZE < ctx->fb.width ? *x0 + SPR_TILE_SIZE : ctx->fb.width;
+    *y1 = *y0 + SPR_TILE_SIZE < ctx->fb.height ? *y0 + SPR_TILE_SIZE : ctx->fb.height;
+}
+
+static int tile_stale(const spr_context_t* ctx, int tile) {
+    return ctx->tile_gen[tile] != ctx->clear_gen;
+}
+
+/* Writes the clear colour over a stale tile; its other state stays stale */
+static void clear_tile_color(spr_context_t* ctx, int tile) {
+    int x0, y0, x1, y1, x, y;
+    tile_bounds(ctx, tile, &x0, &y0, &x1, &y1);
+    for (y = y0; y < y1; ++y) {
+        uint32_t* row = &ctx->fb.color_buffer[y * ctx->fb.width];
+        for (x = x0; x < x1; ++x) row[x] = ctx->clear_color;
+    }
+}
+
+/* Clears n consecutive entries of the per-pixel arrays */
+static void clear_pixels(spr_context_t* ctx, int first, size_t n) {
+    size_t i;
+    for (i = 0; i < n; ++i) {
+        ctx->color[first + i] = ctx->clear_color;
+        ctx->saturated_z[first + i] = INFINITY;
+    }
+    if (ctx->fb.depth_buffer) {
+        for (i = 0; i < n; ++i) ctx->fb.depth_buffer[first + i] = ctx->clear_depth;
+    }
+    memset(&ctx->fragment_heads[first], 0, n * sizeof(spr_fragment_t*));
+    if (ctx->kcount) memset(&ctx->kcount[first], 0, n);
+    if (ctx->cfrag_heads) memset(&ctx->cfrag_heads[first], 0xFF, n * sizeof(uint32_t));
+}
+
+/* Performs the deferred clear of one tile: one run in the tiled layout,
+   one per row otherwise */
+static void materialize_tile(spr_context_t* ctx, int tile) {
+    int x0, y0, x1, y1, y;
+    if (ctx->tiled_layout) {
+        clear_pixels(ctx, tile << (2 * SPR_TILE_SHIFT), (size_t)SPR_TILE_SIZE * SPR_TILE_SIZE);
+    } else {
+        tile_bounds(ctx, tile, &x0, &y0, &x1, &y1);
+        for (y = y0; y < y1; ++y) clear_pixels(ctx, y * ctx->fb.width + x0, (size_t)(x1 - x0));
+    }
+    ctx->tile_gen[tile] = ctx->clear_gen;
+}
+
+/* Makes every tile stale */
+static void invalidate_tiles(spr_context_t* ctx) {
+    if (++ctx->clear_gen == 0) {
+        /* Wrapped: make sure no tile's stamp matches by accident */
+        memset(ctx->tile_gen, 0, (size_t)ctx->tiles_x * ctx->tiles_y * sizeof(uint32_t));
+        ctx->clear_gen = 1;
+    }
+    ctx->color_pending = 1;
+}
+
+/* Brings the tiles under a pixel rectangle up to date before drawing. A
+   tiled rasterizer worker only reaches its own tile, so this needs no lock. */
+static void touch_tiles(spr_context_t* ctx, int min_x, int min_y, int max_x, int max_y) {
+    int tx, ty;
+    for (ty = min_y / SPR_TILE_SIZE; ty <= max_y / SPR_TILE_SIZE; ++ty) {
+        for (tx = min_x / SPR_TILE_SIZE; tx <= max_x / SPR_TILE_SIZE; ++tx) {
+            int tile = ty * ctx->tiles_x + tx;
+            if (tile_stale(ctx, tile)) materialize_tile(ctx, tile);
+        }
+    }
+}
+
+void spr_draw_triangle_2d_flat(spr_context_t* ctx, vec2_t v0, vec2_t v1, vec2_t v2, uint32_t color) {
+    /* Legacy Function: Just draw opaque to buffer for debug */
+    /* Not using A-Buffer here */
+    int min_x, min_y, max_x, max_y;
+    int x, y;
+    float area;
+    int width = ctx->fb.width;
+    int height = ctx->fb.height;
+
+    min_x = (int)spr_min3(v0.x, v1.x, v2.x);
+    min_y = (int)spr_min3(v0.y, v1.y, v2.y);
+    max_x = (int)spr_max3(v0.x, v1.x, v2.x);
+    max_y = (int)spr_max3(v0.y, v1.y, v2.y);
+
+    if (min_x < 0) min_x = 0;
     if (min_y < 0) min_y = 0;
     if (max_x >= width) max_x = width - 1;
     if (max_y >= height) max_y = height - 1;
 
-    vec2_t p0 = {v0x, v0y};
-    vec2_t p1 = {v1x, v1y};
-    vec2_t p2 = {v2x, v2y};
-
-    area = edge_function(p0, p1, p2);
-    if (ctx->cull_backface && area < 0) return;
-    if (fabs(area) < 0.0001f) return;
+    area = edge_function(v0, v1, v2);
+    if (min_x > max_x || min_y > max_y) return;
+    touch_tiles(ctx, min_x, min_y, max_x, max_y);
     
-    float one_over_area = 1.0f / area;
+    for (y = min_y; y <= max_y; ++y) {
+        for (x = min_x; x <= max_x; ++x) {
+            vec2_t p; p.x = x + 0.5f; p.y = y + 0.5f;
+            float w0 = edge_function(v1, v2, p);
+            float w1 = edge_function(v2, v0, p);
+            float w2 = edge_function(v0, v1, p);
+            
+            int inside = (area > 0) ? (w0 >= 0 && w1 >= 0 && w2 >= 0) : (w0 <= 0 && w1 <= 0 && w2 <= 0);
+            if (inside) ctx->color[pixel_index(ctx, x, y)] = color;
+        }
+    }
+}
+
+/* --- Rasterizers (A-Buffer) --- */
+
+/* A quantity that is linear in screen space: value = a + dy * ddy + dx * ddx,
+   with (dx, dy) the pixel offset from the setup origin. */
+typedef struct {
+    float a, ddx, ddy;
+} spr_plane_t;
+
+/* Vertices are snapped to 1/SPR_SUBPIXEL_SCALE of a pixel so coverage can
+   be decided with exact integer edge functions. */
+#define SPR_SUBPIXEL_BITS 8
+#define SPR_SUBPIXEL_SCALE (1 << SPR_SUBPIXEL_BITS)
+
+typedef struct {
+    int64_t a, b, c; /* d/dx, d/dy, value at the origin with the fill-rule bias */
+} spr_edge_t;
+
+/* Per-triangle edge setup shared by the kernels. Edges are negated for
+   clockwise triangles so that "inside" is always w0, w1, w2 >= 0.
+   Attributes are stored as planes of attr/w next to a plane of 1/w, so a
+   pixel costs one reciprocal plus one plane evaluation and one multiply per
+   attribute instead of a barycentric weighting of all three vertices. */
+struct spr_triangle_setup_t {
+    /* Coverage: exact integer edge functions in pixel units, e = c + dy * b + dx * a
+       at the pixel offset (dx, dy) from the origin; inside when e >= 0 */
+    spr_edge_t edge[3];
+    int fits32;                      /* Every e in the bounding box fits in int32 */
+
+    /* The same edges in float (sub-pixel units) for the attribute planes */
+    float one_over_area;
+    float base_w0, base_w1, base_w2; /* Edge values at pixel (origin_x, origin_y) */
+    float step_x_w0, step_x_w1, step_x_w2;
+    float step_y_w0, step_y_w1, step_y_w2;
+    int origin_x, origin_y;          /* Screen-clamped bounding box corner */
+    int min_x, min_y, max_x, max_y;  /* Bounding box clipped to the target */
+
+    spr_plane_t z, inv_w;            /* Screen-linear depth and 1/w */
+    spr_plane_t color[4], uv[2], normal[3], tangent[3], barycentric[3]; /* attr/w, declared varyings only */
+    float tangent_w;                 /* Handedness, taken from v0 */
+};
+
+static void plane_setup(spr_plane_t* p, const spr_triangle_setup_t* ts, float q0, float q1, float q2) {
+    p->a   = (q0 * ts->base_w0   + q1 * ts->base_w1   + q2 * ts->base_w2)   * ts->one_over_area;
+    p->ddx = (q0 * ts->step_x_w0 + q1 * ts->step_x_w1 + q2 * ts->step_x_w2) * ts->one_over_area;
+    p->ddy = (q0 * ts->step_y_w0 + q1 * ts->step_y_w1 + q2 * ts->step_y_w2) * ts->one_over_area;
+}
+
+static float plane_eval(const spr_plane_t* p, float dx, float dy) {
+    return p->a + dy * p->ddy + dx * p->ddx;
+}
 
-    float step_x_w0 = v2y - v1y; float step_y_w0 = v1x - v2x;
-    float step_x_w1 = v0y - v2y; float step_y_w1 = v2x - v0x;
-    float step_x_w2 = v1y - v0y; float step_y_w2 = v0x - v1x;
+/* Planes of a vec attribute premultiplied by 1/w */
+#define SPR_PLANE_ATTR(ts, plane, field) \
+    plane_setup(&(ts)->plane, (ts), v0->field * iw0, v1->field * iw1, v2->field * iw2)
 
-    vec2_t start_p; start_p.x = (float)min_x + 0.5f; start_p.y = (float)min_y + 0.5f;
-    float row_w0 = edge_function(p1, p2, start_p);
-    float row_w1 = edge_function(p2, p0, start_p);
-    float row_w2 = edge_function(p0, p1, start_p);
+static void triangle_setup_planes(spr_context_t* ctx, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2, spr_triangle_setup_t* ts) {
+    unsigned int varyings = ctx->varyings;
+    float iw0 = v0->position.w, iw1 = v1->position.w, iw2 = v2->position.w;
 
-    if (area < 0) {
-        area = -area; one_over_area = -one_over_area;
-        row_w0 = -row_w0; step_x_w0 = -step_x_w0; step_y_w0 = -step_y_w0;
-        row_w1 = -row_w1; step_x_w1 = -step_x_w1; step_y_w1 = -step_y_w1;
-        row_w2 = -row_w2; step_x_w2 = -step_x_w2; step_y_w2 = -step_y_w2;
+    plane_setup(&ts->z, ts, v0->position.z, v1->position.z, v2->position.z);
+    plane_setup(&ts->inv_w, ts, iw0, iw1, iw2);
+    if (varyings & SPR_VARYING_COLOR) {
+        SPR_PLANE_ATTR(ts, color[0], color.x); SPR_PLANE_ATTR(ts, color[1], color.y);
+        SPR_PLANE_ATTR(ts, color[2], color.z); SPR_PLANE_ATTR(ts, color[3], color.w);
+    }
+    if (varyings & SPR_VARYING_UV) {
+        SPR_PLANE_ATTR(ts, uv[0], uv.x); SPR_PLANE_ATTR(ts, uv[1], uv.y);
+    }
+    if (varyings & SPR_VARYING_NORMAL) {
+        SPR_PLANE_ATTR(ts, normal[0], normal.x); SPR_PLANE_ATTR(ts, normal[1], normal.y);
+        SPR_PLANE_ATTR(ts, normal[2], normal.z);
+    }
+    if (varyings & SPR_VARYING_TANGENT) {
+        SPR_PLANE_ATTR(ts, tangent[0], tangent.x); SPR_PLANE_ATTR(ts, tangent[1], tangent.y);
+        SPR_PLANE_ATTR(ts, tangent[2], tangent.z);
     }
+    if (varyings & SPR_VARYING_BARYCENTRIC) {
+        SPR_PLANE_ATTR(ts, barycentric[0], barycentric.x); SPR_PLANE_ATTR(ts, barycentric[1], barycentric.y);
+        SPR_PLANE_ATTR(ts, barycentric[2], barycentric.z);
+    }
+    ts->tangent_w = v0->tangent.w;
+}
 
-    __m128 v_step_x_w0 = _mm_set1_ps(step_x_w0);
-    __m128 v_step_x_w1 = _mm_set1_ps(step_x_w1);
-    __m128 v_step_x_w2 = _mm_set1_ps(step_x_w2);
-    
-    __m128 v_step_x_w0_4 = _mm_mul_ps(v_step_x_w0, _mm_set1_ps(4.0f));
-    __m128 v_step_x_w1_4 = _mm_mul_ps(v_step_x_w1, _mm_set1_ps(4.0f));
-    __m128 v_step_x_w2_4 = _mm_mul_ps(v_step_x_w2, _mm_set1_ps(4.0f));
+/* floor(v / SPR_SUBPIXEL_SCALE) for negative values too */
+static int64_t subpixel_floor(int64_t v) {
+    return v >= 0 ? v / SPR_SUBPIXEL_SCALE : -((-v + SPR_SUBPIXEL_SCALE - 1) / SPR_SUBPIXEL_SCALE);
+}
 
-    __m128 v_off_w0 = _mm_mul_ps(_mm_set_ps(3,2,1,0), v_step_x_w0);
-    __m128 v_off_w1 = _mm_mul_ps(_mm_set_ps(3,2,1,0), v_step_x_w1);
-    __m128 v_off_w2 = _mm_mul_ps(_mm_set_ps(3,2,1,0), v_step_x_w2);
-    
-    __m128 zero = _mm_setzero_ps();
+static int32_t snap_subpixel(float v) {
+    return (int32_t)floorf(v * (float)SPR_SUBPIXEL_SCALE + 0.5f);
+}
 
-    for (y = min_y; y <= max_y; ++y) {
-        float w0 = row_w0;
-        float w1 = row_w1;
-        float w2 = row_w2;
-        int x = min_x;
-
-        __m128 v_w0 = _mm_add_ps(_mm_set1_ps(w0), v_off_w0);
-        __m128 v_w1 = _mm_add_ps(_mm_set1_ps(w1), v_off_w1);
-        __m128 v_w2 = _mm_add_ps(_mm_set1_ps(w2), v_off_w2);
-        
-        int x_end_simd = min_x + ((max_x - min_x + 1) & ~3);
-        
-        for (; x < x_end_simd; x += 4) {
-            __m128 mask = _mm_and_ps(_mm_cmpge_ps(v_w0, zero),
-                          _mm_and_ps(_mm_cmpge_ps(v_w1, zero),
-                                     _mm_cmpge_ps(v_w2, zero)));
-            
-            int m = _mm_movemask_ps(mask);
-            if (m) {
-                /* We have to de-vectorize to insert nodes anyway, so keep it simple */
-                float w0s[4], w1s[4], w2s[4];
-                _mm_storeu_ps(w0s, v_w0);
-                _mm_storeu_ps(w1s, v_w1);
-                _mm_storeu_ps(w2s, v_w2);
-                
-                for (int i=0; i<4; ++i) {
-                    if (m & (1 << i)) {
-                        /* Scalar Insertion Code (Copied from CPU version logic) */
-                        int px = x + i;
-                        float lw0 = w0s[i]; float lw1 = w1s[i]; float lw2 = w2s[i];
-                        
-                        float alpha = lw0 * one_over_area;
-                        float beta = lw1 * one_over_area;
-                        float gamma = lw2 * one_over_area;
-                        
-                        float inv_w0 = v0->position.w;
-                        float inv_w1 = v1->position.w;
-                        float inv_w2 = v2->position.w;
-                        
-                        float w_recip = alpha * inv_w0 + beta * inv_w1 + gamma * inv_w2;
-                        float w_final = 1.0f / w_recip;
-                        
-                        float z = alpha * v0->position.z + beta * v1->position.z + gamma * v2->position.z;
-                        
-                        if (z >= -1.0f && z <= 1.0f) {
-                            spr_vertex_out_t interp;
-                            interp.position.x = (float)px + 0.5f;
-                            interp.position.y = (float)y + 0.5f;
-                            interp.position.z = z;
-                            interp.position.w = w_final;
-                            
-                            float wa = alpha * inv_w0 * w_final;
-                            float wb = beta * inv_w1 * w_final;
-                            float wg = gamma * inv_w2 * w_final;
-                            
-                            interp.color.x = v0->color.x * wa + v1->color.x * wb + v2->color.x * wg;
-                            interp.color.y = v0->color.y * wa + v1->color.y * wb + v2->color.y * wg;
-                            interp.color.z = v0->color.z * wa + v1->color.z * wb + v2->color.z * wg;
-                            interp.color.w = v0->color.w * wa + v1->color.w * wb + v2->color.w * wg;
-
-                            interp.uv.x = v0->uv.x * wa + v1->uv.x * wb + v2->uv.x * wg;
-                            interp.uv.y = v0->uv.y * wa + v1->uv.y * wb + v2->uv.y * wg;
-
-                            interp.normal.x = v0->normal.x * wa + v1->normal.x * wb + v2->normal.x * wg;
-                            interp.normal.y = v0->normal.y * wa + v1->normal.y * wb + v2->normal.y * wg;
-                            interp.normal.z = v0->normal.z * wa + v1->normal.z * wb + v2->normal.z * wg;
-
-                            interp.tangent.x = v0->tangent.x * wa + v1->tangent.x * wb + v2->tangent.x * wg;
-                            interp.tangent.y = v0->tangent.y * wa + v1->tangent.y * wb + v2->tangent.y * wg;
-                            interp.tangent.z = v0->tangent.z * wa + v1->tangent.z * wb + v2->tangent.z * wg;
-                            interp.tangent.w = v0->tangent.w;
-
-                            interp.barycentric.x = v0->barycentric.x * wa + v1->barycentric.x * wb + v2->barycentric.x * wg;
-                            interp.barycentric.y = v0->barycentric.y * wa + v1->barycentric.y * wb + v2->barycentric.y * wg;
-                            interp.barycentric.z = v0->barycentric.z * wa + v1->barycentric.z * wb + v2->barycentric.z * wg;
-
-                            spr_fs_output_t out = ctx->current_fs(ctx->current_uniforms, &interp);
-                            insert_fragment(ctx, y * width + px, z, out);
-                        }
-                    }
-                }
-            }
-            v_w0 = _mm_add_ps(v_w0, v_step_x_w0_4);
-            v_w1 = _mm_add_ps(v_w1, v_step_x_w1_4);
-            v_w2 = _mm_add_ps(v_w2, v_step_x_w2_4);
+/* Edge (ax,ay)->(bx,by) in sub-pixel units. The edge value at pixel
+   centres is SCALE * (a * dx + b * dy) + C. With SCALE * k + C >= 0 being
+   k + floor(C / SCALE) >= 0 for integer k, the test runs in pixel units. A
+   pixel centre exactly on the edge counts only for top and left edges (the
+   gradient points right, or straight down for a horizontal edge), so pixels
+   on an edge shared by two triangles are covered once. */
+static void edge_setup(spr_edge_t* e, int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t px, int64_t py, int flip) {
+    int64_t a = by - ay;
+    int64_t b = ax - bx;
+    int64_t c = (px - ax) * (by - ay) - (py - ay) * (bx - ax);
+    int top_left;
+    if (flip) { a = -a; b = -b; c = -c; }
+    top_left = a > 0 || (a == 0 && b > 0);
+    e->a = a;
+    e->b = b;
+    e->c = subpixel_floor(top_left ? c : c - 1);
+}
+
+/* The screen-wide rejection tests of triangle_setup(), for culling ahead of
+   the raster stage: 1 means no target would draw the triangle */
+static int triangle_rejected(const spr_context_t* ctx, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
+    int64_t x0 = snap_subpixel(v0->position.x), y0 = snap_subpixel(v0->position.y);
+    int64_t x1 = snap_subpixel(v1->position.x), y1 = snap_subpixel(v1->position.y);
+    int64_t x2 = snap_subpixel(v2->position.x), y2 = snap_subpixel(v2->position.y);
+    int64_t area;
+
+    if (subpixel_floor(x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2)) < 0) return 1;
+    if (subpixel_floor(y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2)) < 0) return 1;
+    if (subpixel_floor(x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2)) >= ctx->fb.width) return 1;
+    if (subpixel_floor(y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2)) >= ctx->fb.height) return 1;
+
+    area = (x2 - x0) * (y1 - y0) - (y2 - y0) * (x1 - x0);
+    if (ctx->cull_backface && area < 0) return 1;
+    return area == 0;
+}
+
+/* Returns 0 if the triangle is culled, degenerate or outside the target */
+static int triangle_setup(spr_context_t* ctx, const spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2, spr_triangle_setup_t* ts) {
+    int64_t x0 = snap_subpixel(v0->position.x), y0 = snap_subpixel(v0->position.y);
+    int64_t x1 = snap_subpixel(v1->position.x), y1 = snap_subpixel(v1->position.y);
+    int64_t x2 = snap_subpixel(v2->position.x), y2 = snap_subpixel(v2->position.y);
+    int64_t area, px, py, c0, c1, c2, bound;
+    int flip, i;
+
+    ts->min_x = (int)subpixel_floor(x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2));
+    ts->min_y = (int)subpixel_floor(y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2));
+    ts->max_x = (int)subpixel_floor(x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2));
+    ts->max_y = (int)subpixel_floor(y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2));
+
+    if (ts->min_x < 0) ts->min_x = 0;
+    if (ts->min_y < 0) ts->min_y = 0;
+    if (ts->max_x >= ctx->fb.width) ts->max_x = ctx->fb.width - 1;
+    if (ts->max_y >= ctx->fb.height) ts->max_y = ctx->fb.height - 1;
+    if (ts->min_x > ts->max_x || ts->min_y > ts->max_y) return 0;
+
+    area = (x2 - x0) * (y1 - y0) - (y2 - y0) * (x1 - x0);
+    if (ctx->cull_backface && area < 0) return 0;
+    if (area == 0) return 0;
+    flip = area < 0;
+
+    /* Pixel centre of the origin, in sub-pixel units */
+    px = (int64_t)ts->min_x * SPR_SUBPIXEL_SCALE + SPR_SUBPIXEL_SCALE / 2;
+    py = (int64_t)ts->min_y * SPR_SUBPIXEL_SCALE + SPR_SUBPIXEL_SCALE / 2;
+    c0 = (px - x1) * (y2 - y1) - (py - y1) * (x2 - x1);
+    c1 = (px - x2) * (y0 - y2) - (py - y2) * (x0 - x2);
+    c2 = (px - x0) * (y1 - y0) - (py - y0) * (x1 - x0);
+    edge_setup(&ts->edge[0], x1, y1, x2, y2, px, py, flip);
+    edge_setup(&ts->edge[1], x2, y2, x0, y0, px, py, flip);
+    edge_setup(&ts->edge[2], x0, y0, x1, y1, px, py, flip);
+
+    /* The SIMD spans use 32-bit lanes when no edge value in the box (plus
+       the 16 lanes a span chunk may run past its end) can overflow */
+    ts->fits32 = 1;
+    for (i = 0; i < 3; ++i) {
+        const spr_edge_t* e = &ts->edge[i];
+        bound = (e->c < 0 ? -e->c : e->c)
+              + (e->a < 0 ? -e->a : e->a) * (ts->max_x - ts->min_x + 16)
+              + (e->b < 0 ? -e->b : e->b) * (ts->max_y - ts->min_y + 1);
+        if (bound > INT32_MAX) ts->fits32 = 0;
+    }
+
+    ts->one_over_area = 1.0f / (float)(flip ? -area : area);
+    ts->base_w0 = (float)(flip ? -c0 : c0);
+    ts->base_w1 = (float)(flip ? -c1 : c1);
+    ts->base_w2 = (float)(flip ? -c2 : c2);
+    ts->step_x_w0 = (float)(ts->edge[0].a * SPR_SUBPIXEL_SCALE); ts->step_y_w0 = (float)(ts->edge[0].b * SPR_SUBPIXEL_SCALE);
+    ts->step_x_w1 = (float)(ts->edge[1].a * SPR_SUBPIXEL_SCALE); ts->step_y_w1 = (float)(ts->edge[1].b * SPR_SUBPIXEL_SCALE);
+    ts->step_x_w2 = (float)(ts->edge[2].a * SPR_SUBPIXEL_SCALE); ts->step_y_w2 = (float)(ts->edge[2].b * SPR_SUBPIXEL_SCALE);
+
+    /* Edge values are evaluated from the triangle's own origin (min_x, min_y)
+       rather than from wherever the loop starts. That makes every pixel's
+       coverage independent of the target rectangle, so a triangle split
+       across tiles rasterizes bit-identically to the full-screen pass. */
+    ts->origin_x = ts->min_x;
+    ts->origin_y = ts->min_y;
+    if (ts->min_x < rt->min_x) ts->min_x = rt->min_x;
+    if (ts->min_y < rt->min_y) ts->min_y = rt->min_y;
+    if (ts->max_x > rt->max_x) ts->max_x = rt->max_x;
+    if (ts->max_y > rt->max_y) ts->max_y = rt->max_y;
+    if (ts->min_x > ts->max_x || ts->min_y > ts->max_y) return 0;
+
+    touch_tiles(ctx, ts->min_x, ts->min_y, ts->max_x, ts->max_y);
+    triangle_setup_planes(ctx, v0, v1, v2, ts);
+    return 1;
+}
+
+/* Covered pixels of one triangle waiting for the batch fragment shader */
+struct spr_fs_queue_t {
+    spr_fs_batch_t in;
+    int idx[SPR_FS_BATCH];
+    float z[SPR_FS_BATCH];
+    int count;
+};
+
+/* Kernels call this once per triangle; NULL means shade pixel by pixel */
+static spr_fs_queue_t* fs_queue_begin(spr_context_t* ctx, spr_fs_queue_t* q) {
+    if (!ctx->current_fs_batch) return NULL;
+    memset(q, 0, sizeof(*q)); /* Dead lanes must hold finite values */
+    return q;
+}
+
+static void fs_queue_flush(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q) {
+    spr_fs_batch_output_t out;
+    int i;
+    if (!q || q->count == 0) return;
+
+    q->in.mask = (1u << q->count) - 1u;
+    ctx->current_fs_batch(ctx->current_uniforms, &q->in, &out);
+    for (i = 0; i < q->count; ++i) {
+        spr_fs_output_t o;
+        o.color.x = out.color_r[i]; o.color.y = out.color_g[i]; o.color.z = out.color_b[i];
+        o.opacity.x = out.opacity_r[i]; o.opacity.y = out.opacity_g[i]; o.opacity.z = out.opacity_b[i];
+        write_fragment(ctx, pool, q->idx[i], q->z[i], o);
+    }
+    q->count = 0;
+}
+
+/* A triangle covers each pixel once, so deferring its writes to the flush
+   cannot change what fragment_hidden() sees for the other queued pixels. */
+static void fs_queue_push(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, int idx, const spr_vertex_out_t* f) {
+    int i = q->count;
+    q->in.position_x[i] = f->position.x; q->in.position_y[i] = f->position.y;
+    q->in.position_z[i] = f->position.z; q->in.position_w[i] = f->position.w;
+    q->in.color_r[i] = f->color.x; q->in.color_g[i] = f->color.y;
+    q->in.color_b[i] = f->color.z; q->in.color_a[i] = f->color.w;
+    q->in.uv_x[i] = f->uv.x; q->in.uv_y[i] = f->uv.y;
+    q->in.normal_x[i] = f->normal.x; q->in.normal_y[i] = f->normal.y; q->in.normal_z[i] = f->normal.z;
+    q->in.tangent_x[i] = f->tangent.x; q->in.tangent_y[i] = f->tangent.y;
+    q->in.tangent_z[i] = f->tangent.z; q->in.tangent_w[i] = f->tangent.w;
+    q->in.barycentric_x[i] = f->barycentric.x; q->in.barycentric_y[i] = f->barycentric.y;
+    q->in.barycentric_z[i] = f->barycentric.z;
+    q->idx[i] = idx;
+    q->z[i] = f->position.z;
+    if (++q->count == SPR_FS_BATCH) fs_queue_flush(ctx, pool, q);
+}
+
+/* Shades one covered pixel from the triangle's planes and hands the result
+   to write_fragment(), or queues it for the batch shader. Only the varyings
+   in 'varyings' are interpolated, the rest are left at zero. Callers below
+   pass a constant, so each variant compiles to straight-line code for its
+   attribute set.
+
+   The planes are evaluated at the pixel's offset from the setup origin, like
+   the edge values, so results do not depend on which kernel or tile reached
+   the pixel. Versus weighting the three vertices by barycentrics per pixel,
+   attributes differ only by float rounding: within 1e-4 of the attribute's
+   magnitude over the triangle (checked by test_raster), i.e. well below one
+   8-bit colour step. */
+SPR_INLINE static void shade_pixel_varyings(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int x, int y, unsigned int varyings) {
+    int idx = pixel_index(ctx, x, y);
+    float dx = (float)(x - ts->origin_x);
+    float dy = (float)(y - ts->origin_y);
+
+    float z = plane_eval(&ts->z, dx, dy);
+
+    /* No Depth Test here - Just A-Buffer Insertion (minus pixels already saturated) */
+    /* Assuming Near/Far clipping happens in vertex stage (partially) */
+    if (z < -1.0f || z > 1.0f) return;
+    if (fragment_hidden(ctx, pool, idx, z)) return;
+
+    float w_final = 1.0f / plane_eval(&ts->inv_w, dx, dy);
+    spr_vertex_out_t interp;
+    memset(&interp, 0, sizeof(interp));
+    interp.position.x = (float)x + 0.5f;
+    interp.position.y = (float)y + 0.5f;
+    interp.position.z = z;
+    interp.position.w = w_final;
+
+    /* Interpolate attributes (perspective-correct: (attr/w) * w) */
+    if (varyings & SPR_VARYING_COLOR) {
+        interp.color.x = plane_eval(&ts->color[0], dx, dy) * w_final;
+        interp.color.y = plane_eval(&ts->color[1], dx, dy) * w_final;
+        interp.color.z = plane_eval(&ts->color[2], dx, dy) * w_final;
+        interp.color.w = plane_eval(&ts->color[3], dx, dy) * w_final;
+    }
+
+    if (varyings & SPR_VARYING_UV) {
+        interp.uv.x = plane_eval(&ts->uv[0], dx, dy) * w_final;
+        interp.uv.y = plane_eval(&ts->uv[1], dx, dy) * w_final;
+    }
+
+    if (varyings & SPR_VARYING_NORMAL) {
+        interp.normal.x = plane_eval(&ts->normal[0], dx, dy) * w_final;
+        interp.normal.y = plane_eval(&ts->normal[1], dx, dy) * w_final;
+        interp.normal.z = plane_eval(&ts->normal[2], dx, dy) * w_final;
+    }
+
+    if (varyings & SPR_VARYING_TANGENT) {
+        interp.tangent.x = plane_eval(&ts->tangent[0], dx, dy) * w_final;
+        interp.tangent.y = plane_eval(&ts->tangent[1], dx, dy) * w_final;
+        interp.tangent.z = plane_eval(&ts->tangent[2], dx, dy) * w_final;
+        interp.tangent.w = ts->tangent_w;
+    }
+
+    if (varyings & SPR_VARYING_BARYCENTRIC) {
+        interp.barycentric.x = plane_eval(&ts->barycentric[0], dx, dy) * w_final;
+        interp.barycentric.y = plane_eval(&ts->barycentric[1], dx, dy) * w_final;
+        interp.barycentric.z = plane_eval(&ts->barycentric[2], dx, dy) * w_final;
+    }
+
+    if (q) {
+        fs_queue_push(ctx, pool, q, idx, &interp);
+        return;
+    }
+    spr_fs_output_t out = ctx->current_fs(ctx->current_uniforms, &interp);
+    write_fragment(ctx, pool, idx, z, out);
+}
+
+/* The variants are kept out of line so they are always compiled for the
+   baseline ISA: inlined into an AVX-512 kernel they could pick up FMA
+   contractions and round differently from the scalar kernel. */
+#define SPR_SHADE_PIXEL_VARIANT(name, mask) \
+    SPR_NOINLINE static void name(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int x, int y) { \
+        shade_pixel_varyings(ctx, pool, q, ts, x, y, mask); \
+    }
+
+SPR_SHADE_PIXEL_VARIANT(shade_pixel_all, SPR_VARYING_ALL)
+SPR_SHADE_PIXEL_VARIANT(shade_pixel_color, SPR_VARYING_COLOR)
+SPR_SHADE_PIXEL_VARIANT(shade_pixel_color_normal, SPR_VARYING_COLOR | SPR_VARYING_NORMAL)
+SPR_SHADE_PIXEL_VARIANT(shade_pixel_any, ctx->varyings) /* Other combinations */
+
+/* Count pass of the counted storage: no interpolation or shading, just one
+   more fragment for the pixel. Hybrid opaque fragments are counted too (their
+   opacity is unknown until shaded), so slices may have spare room. */
+static void count_pixel(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int x, int y) {
+    int idx = pixel_index(ctx, x, y);
+    float z = plane_eval(&ts->z, (float)(x - ts->origin_x), (float)(y - ts->origin_y));
+    (void)q;
+
+    if (z < -1.0f || z > 1.0f) return;
+    if (fragment_hidden(ctx, pool, idx, z)) return;
+    ctx->frag_cursor[idx]++;
+}
+
+static spr_shade_pixel_t select_shade_pixel(const spr_context_t* ctx) {
+    if (ctx->counting) return count_pixel;
+    switch (ctx->varyings) {
+        case SPR_VARYING_ALL: return shade_pixel_all;
+        case SPR_VARYING_COLOR: return shade_pixel_color;
+        case SPR_VARYING_COLOR | SPR_VARYING_NORMAL: return shade_pixel_color_normal;
+        default: return shade_pixel_any;
+    }
+}
+
+/* The kernels below differ only in how they test a span of one row: the
+   block traversal in rasterize_blocks() is shared. Coverage is exact integer
+   arithmetic, so every kernel produces the same image as SPR_RASTERIZER_CPU
+   and any of them can serve the tiled rasterizer. */
+typedef void (*spr_raster_span_t)(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int y, int x0, int x1);
+
+/* Edge value at pixel (x, y) */
+static int64_t edge_at(const spr_edge_t* e, const spr_triangle_setup_t* ts, int x, int y) {
+    return e->c + (int64_t)(y - ts->origin_y) * e->b + (int64_t)(x - ts->origin_x) * e->a;
+}
+
+static void raster_span_cpu(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int y, int x0, int x1) {
+    int64_t w0 = edge_at(&ts->edge[0], ts, x0, y);
+    int64_t w1 = edge_at(&ts->edge[1], ts, x0, y);
+    int64_t w2 = edge_at(&ts->edge[2], ts, x0, y);
+    int x;
+
+    for (x = x0; x <= x1; ++x) {
+        if ((w0 | w1 | w2) >= 0) {
+            ctx->shade_pixel(ctx, pool, q, ts, x, y);
         }
-        
-        if (x < max_x + 1) {
-            float offset = (float)(x - min_x);
-            w0 = row_w0 + offset * step_x_w0;
-            w1 = row_w1 + offset * step_x_w1;
-            w2 = row_w2 + offset * step_x_w2;
-        }
-
-        for (; x <= max_x; ++x) {
-            if (w0 >= 0 && w1 >= 0 && w2 >= 0) {
-                float alpha = w0 * one_over_area;
-                float beta = w1 * one_over_area;
-                float gamma = w2 * one_over_area;
-                
-                float inv_w0 = v0->position.w;
-                float inv_w1 = v1->position.w;
-                float inv_w2 = v2->position.w;
-                
-                float w_recip = alpha * inv_w0 + beta * inv_w1 + gamma * inv_w2;
-                float w_final = 1.0f / w_recip;
-                
-                float z = alpha * v0->position.z + beta * v1->position.z + gamma * v2->position.z;
-                
-                if (z >= -1.0f && z <= 1.0f) {
-                    spr_vertex_out_t interp;
-                    interp.position.x = (float)x + 0.5f;
-                    interp.position.y = (float)y + 0.5f;
-                    interp.position.z = z;
-                    interp.position.w = w_final;
-                    
-                    float wa = alpha * inv_w0 * w_final;
-                    float wb = beta * inv_w1 * w_final;
-                    float wg = gamma * inv_w2 * w_final;
-                    
-                    interp.color.x = v0->color.x * wa + v1->color.x * wb + v2->color.x * wg;
-                    interp.color.y = v0->color.y * wa + v1->color.y * wb + v2->color.y * wg;
-                    interp.color.z = v0->color.z * wa + v1->color.z * wb + v2->color.z * wg;
-                    interp.color.w = v0->color.w * wa + v1->color.w * wb + v2->color.w * wg;
-
-                    interp.uv.x = v0->uv.x * wa + v1->uv.x * wb + v2->uv.x * wg;
-                    interp.uv.y = v0->uv.y * wa + v1->uv.y * wb + v2->uv.y * wg;
-
-                    interp.normal.x = v0->normal.x * wa + v1->normal.x * wb + v2->normal.x * wg;
-                    interp.normal.y = v0->normal.y * wa + v1->normal.y * wb + v2->normal.y * wg;
-                    interp.normal.z = v0->normal.z * wa + v1->normal.z * wb + v2->normal.z * wg;
-
-                    interp.tangent.x = v0->tangent.x * wa + v1->tangent.x * wb + v2->tangent.x * wg;
-                    interp.tangent.y = v0->tangent.y * wa + v1->tangent.y * wb + v2->tangent.y * wg;
-                    interp.tangent.z = v0->tangent.z * wa + v1->tangent.z * wb + v2->tangent.z * wg;
-                    interp.tangent.w = v0->tangent.w;
-
-                    interp.barycentric.x = v0->barycentric.x * wa + v1->barycentric.x * wb + v2->barycentric.x * wg;
-                    interp.barycentric.y = v0->barycentric.y * wa + v1->barycentric.y * wb + v2->barycentric.y * wg;
-                    interp.barycentric.z = v0->barycentric.z * wa + v1->barycentric.z * wb + v2->barycentric.z * wg;
-
-                    spr_fs_output_t out = ctx->current_fs(ctx->current_uniforms, &interp);
-                    insert_fragment(ctx, y * width + x, z, out);
+        w0 += ts->edge[0].a;
+        w1 += ts->edge[1].a;
+        w2 += ts->edge[2].a;
+    }
+}
+
+/* The vector spans step 32-bit edge values across the row; a lane is
+   inside when the sign bit of w0 | w1 | w2 is clear. Triangles whose edge
+   values need more than 32 bits (huge, guard-band sized) use the scalar span. */
+
+#if defined(__SSE2__)
+static void raster_span_sse2(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int y, int x0, int x1) {
+    const spr_edge_t* e = ts->edge;
+    int x, i;
+
+    if (!ts->fits32) {
+        raster_span_cpu(ctx, pool, q, ts, y, x0, x1);
+        return;
+    }
+
+    /* SSE2 has no 32-bit multiply: build the lane offsets as scalars */
+    int32_t a0 = (int32_t)e[0].a, a1 = (int32_t)e[1].a, a2 = (int32_t)e[2].a;
+    __m128i w0 = _mm_add_epi32(_mm_set1_epi32((int32_t)edge_at(&e[0], ts, x0, y)), _mm_set_epi32(3 * a0, 2 * a0, a0, 0));
+    __m128i w1 = _mm_add_epi32(_mm_set1_epi32((int32_t)edge_at(&e[1], ts, x0, y)), _mm_set_epi32(3 * a1, 2 * a1, a1, 0));
+    __m128i w2 = _mm_add_epi32(_mm_set1_epi32((int32_t)edge_at(&e[2], ts, x0, y)), _mm_set_epi32(3 * a2, 2 * a2, a2, 0));
+    __m128i step0 = _mm_set1_epi32(4 * a0);
+    __m128i step1 = _mm_set1_epi32(4 * a1);
+    __m128i step2 = _mm_set1_epi32(4 * a2);
+
+    for (x = x0; x <= x1; x += 4) {
+        __m128i any = _mm_or_si128(_mm_or_si128(w0, w1), w2);
+        int m = ~_mm_movemask_ps(_mm_castsi128_ps(any)) & 0xF;
+        if (x1 - x < 3) m &= (1 << (x1 - x + 1)) - 1; /* Row tail */
+        /* We have to de-vectorize to insert nodes anyway, so keep it simple */
+        for (i = 0; m; ++i, m >>= 1) {
+            if (m & 1) ctx->shade_pixel(ctx, pool, q, ts, x + i, y);
+        }
+        w0 = _mm_add_epi32(w0, step0);
+        w1 = _mm_add_epi32(w1, step1);
+        w2 = _mm_add_epi32(w2, step2);
+    }
+}
+#endif
+
+#if defined(SPR_X86_DISPATCH)
+
+SPR_TARGET("avx2")
+static void raster_span_avx2(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int y, int x0, int x1) {
+    const spr_edge_t* e = ts->edge;
+    int x, i;
+
+    if (!ts->fits32) {
+        raster_span_cpu(ctx, pool, q, ts, y, x0, x1);
+        return;
+    }
+
+    __m256i lane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i w0 = _mm256_add_epi32(_mm256_set1_epi32((int32_t)edge_at(&e[0], ts, x0, y)), _mm256_mullo_epi32(lane, _mm256_set1_epi32((int32_t)e[0].a)));
+    __m256i w1 = _mm256_add_epi32(_mm256_set1_epi32((int32_t)edge_at(&e[1], ts, x0, y)), _mm256_mullo_epi32(lane, _mm256_set1_epi32((int32_t)e[1].a)));
+    __m256i w2 = _mm256_add_epi32(_mm256_set1_epi32((int32_t)edge_at(&e[2], ts, x0, y)), _mm256_mullo_epi32(lane, _mm256_set1_epi32((int32_t)e[2].a)));
+    __m256i step0 = _mm256_set1_epi32((int32_t)(8 * e[0].a));
+    __m256i step1 = _mm256_set1_epi32((int32_t)(8 * e[1].a));
+    __m256i step2 = _mm256_set1_epi32((int32_t)(8 * e[2].a));
+
+    for (x = x0; x <= x1; x += 8) {
+        __m256i any = _mm256_or_si256(_mm256_or_si256(w0, w1), w2);
+        int m = ~_mm256_movemask_ps(_mm256_castsi256_ps(any)) & 0xFF;
+        if (x1 - x < 7) m &= (1 << (x1 - x + 1)) - 1;
+        for (i = 0; m; ++i, m >>= 1) {
+            if (m & 1) ctx->shade_pixel(ctx, pool, q, ts, x + i, y);
+        }
+        w0 = _mm256_add_epi32(w0, step0);
+        w1 = _mm256_add_epi32(w1, step1);
+        w2 = _mm256_add_epi32(w2, step2);
+    }
+}
+
+SPR_TARGET("avx512f")
+static void raster_span_avx512(spr_context_t* ctx, spr_fragment_pool_t* pool, spr_fs_queue_t* q, const spr_triangle_setup_t* ts, int y, int x0, int x1) {
+    const spr_edge_t* e = ts->edge;
+    int x, i;
+
+    if (!ts->fits32) {
+        raster_span_cpu(ctx, pool, q, ts, y, x0, x1);
+        return;
+    }
+
+    __m512i lane = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    __m512i w0 = _mm512_add_epi32(_mm512_set1_epi32((int32_t)edge_at(&e[0], ts, x0, y)), _mm512_mullo_epi32(lane, _mm512_set1_epi32((int32_t)e[0].a)));
+    __m512i w1 = _mm512_add_epi32(_mm512_set1_epi32((int32_t)edge_at(&e[1], ts, x0, y)), _mm512_mullo_epi32(lane, _mm512_set1_epi32((int32_t)e[1].a)));
+    __m512i w2 = _mm512_add_epi32(_mm512_set1_epi32((int32_t)edge_at(&e[2], ts, x0, y)), _mm512_mullo_epi32(lane, _mm512_set1_epi32((int32_t)e[2].a)));
+    __m512i step0 = _mm512_set1_epi32((int32_t)(16 * e[0].a));
+    __m512i step1 = _mm512_set1_epi32((int32_t)(16 * e[1].a));
+    __m512i step2 = _mm512_set1_epi32((int32_t)(16 * e[2].a));
+
+    for (x = x0; x <= x1; x += 16) {
+        __m512i any = _mm512_or_si512(_mm512_or_si512(w0, w1), w2);
+        int m = (int)(~_mm512_cmplt_epi32_mask(any, _mm512_setzero_si512()) & 0xFFFF);
+        if (x1 - x < 15) m &= (1 << (x1 - x + 1)) - 1;
+        for (i = 0; m; ++i, m >>= 1) {
+            if (m & 1) ctx->shade_pixel(ctx, pool, q, ts, x + i, y);
+        }
+        w0 = _mm512_add_epi32(w0, step0);
+        w1 = _mm512_add_epi32(w1, step1);
+        w2 = _mm512_add_epi32(w2, step2);
+    }
+}
+
+#endif /* SPR_X86_DISPATCH */
+
+/* Classifies one edge over the block [x0,x1] x [y0,y1]: the edge function is
+   linear, so its extremes are at the corners. Returns -1 when the block is
+   outside, 1 when it is entirely inside, 0 when pixels must be tested. */
+static int classify_edge(const spr_edge_t* e, const spr_triangle_setup_t* ts, int x0, int y0, int x1, int y1) {
+    int64_t c00 = edge_at(e, ts, x0, y0);
+    int64_t dx = (int64_t)(x1 - x0) * e->a;
+    int64_t dy = (int64_t)(y1 - y0) * e->b;
+    int64_t lo = c00 + (dx < 0 ? dx : 0) + (dy < 0 ? dy : 0);
+    int64_t hi = c00 + (dx > 0 ? dx : 0) + (dy > 0 ? dy : 0);
+    if (hi < 0) return -1;
+    if (lo >= 0) return 1;
+    return 0;
+}
+
+/* Walks the triangle's bounding box in SPR_BLOCK_SIZE blocks aligned to the
+   screen (so they never straddle a tile). Empty blocks are skipped, fully
+   covered ones are shaded without edge tests, and only blocks crossed by an
+   edge go through the span kernel. Triangles smaller than a block in either
+   direction are scanned directly; the pre-pass would not pay for itself. */
+static void rasterize_blocks(spr_context_t* ctx, spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2, spr_raster_span_t span) {
+    spr_triangle_setup_t ts;
+    spr_fs_queue_t queue;
+    spr_fs_queue_t* q;
+    spr_fragment_pool_t* pool = rt->pool;
+    int x, y, bx, by;
+
+    if (!ctx || !triangle_setup(ctx, rt, v0, v1, v2, &ts)) return;
+    q = fs_queue_begin(ctx, &queue);
+
+    if (ts.max_x - ts.min_x + 1 < SPR_BLOCK_SIZE || ts.max_y - ts.min_y + 1 < SPR_BLOCK_SIZE) {
+        for (y = ts.min_y; y <= ts.max_y; ++y) span(ctx, pool, q, &ts, y, ts.min_x, ts.max_x);
+        fs_queue_flush(ctx, pool, q);
+        return;
+    }
+
+    for (by = ts.min_y & ~(SPR_BLOCK_SIZE - 1); by <= ts.max_y; by += SPR_BLOCK_SIZE) {
+        int y0 = by < ts.min_y ? ts.min_y : by;
+        int y1 = by + SPR_BLOCK_SIZE - 1 > ts.max_y ? ts.max_y : by + SPR_BLOCK_SIZE - 1;
+
+        for (bx = ts.min_x & ~(SPR_BLOCK_SIZE - 1); bx <= ts.max_x; bx += SPR_BLOCK_SIZE) {
+            int x0 = bx < ts.min_x ? ts.min_x : bx;
+            int x1 = bx + SPR_BLOCK_SIZE - 1 > ts.max_x ? ts.max_x : bx + SPR_BLOCK_SIZE - 1;
+            int e0 = classify_edge(&ts.edge[0], &ts, x0, y0, x1, y1);
+            int e1 = classify_edge(&ts.edge[1], &ts, x0, y0, x1, y1);
+            int e2 = classify_edge(&ts.edge[2], &ts, x0, y0, x1, y1);
+
+            if (e0 < 0 || e1 < 0 || e2 < 0) {
+                pool->rejected_blocks++;
+            } else if (e0 > 0 && e1 > 0 && e2 > 0) {
+                pool->accepted_blocks++;
+                for (y = y0; y <= y1; ++y) {
+                    for (x = x0; x <= x1; ++x) ctx->shade_pixel(ctx, pool, q, &ts, x, y);
                 }
+            } else {
+                for (y = y0; y <= y1; ++y) span(ctx, pool, q, &ts, y, x0, x1);
             }
-            w0 += step_x_w0; w1 += step_x_w1; w2 += step_x_w2;
         }
-        row_w0 += step_y_w0; row_w1 += step_y_w1; row_w2 += step_y_w2;
     }
+    fs_queue_flush(ctx, pool, q);
+}
+
+static void spr_rasterize_triangle_cpu(spr_context_t* ctx, spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
+    rasterize_blocks(ctx, rt, v0, v1, v2, raster_span_cpu);
+}
+
+static void spr_rasterize_triangle_simd(spr_context_t* ctx, spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
+#if defined(__SSE2__)
+    rasterize_blocks(ctx, rt, v0, v1, v2, raster_span_sse2);
+#else
+    rasterize_blocks(ctx, rt, v0, v1, v2, raster_span_cpu);
+#endif
+}
+
+#if defined(SPR_X86_DISPATCH)
+static void spr_rasterize_triangle_avx2(spr_context_t* ctx, spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
+    rasterize_blocks(ctx, rt, v0, v1, v2, raster_span_avx2);
+}
+
+static void spr_rasterize_triangle_avx512(spr_context_t* ctx, spr_raster_target_t* rt, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
+    rasterize_blocks(ctx, rt, v0, v1, v2, raster_span_avx512);
+}
+#endif
+
+/* Pixels per coverage test of a kernel; also orders the kernels by width */
+static int kernel_width(spr_rasterizer_mode_t kernel) {
+    switch (kernel) {
+        case SPR_RASTERIZER_SIMD: return 4;
+        case SPR_RASTERIZER_AVX2: return 8;
+        case SPR_RASTERIZER_AVX512: return 16;
+        default: return 1;
+    }
+}
+
+static spr_rasterize_t kernel_func(spr_rasterizer_mode_t kernel) {
+    switch (kernel) {
+        case SPR_RASTERIZER_SIMD: return spr_rasterize_triangle_simd;
+#if defined(SPR_X86_DISPATCH)
+        case SPR_RASTERIZER_AVX2: return spr_rasterize_triangle_avx2;
+        case SPR_RASTERIZER_AVX512: return spr_rasterize_triangle_avx512;
+#endif
+        default: return spr_rasterize_triangle_cpu;
+    }
+}
+
+/* Widest kernel this CPU can run (cpuid via the compiler's builtins) */
+static spr_rasterizer_mode_t detect_simd_kernel(void) {
+#if defined(SPR_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SPR_RASTERIZER_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SPR_RASTERIZER_AVX2;
+#endif
+#if defined(__SSE2__)
+    return SPR_RASTERIZER_SIMD;
 #else
-    spr_rasterize_triangle_cpu(ctx, v0, v1, v2);
+    return SPR_RASTERIZER_CPU;
 #endif
 }
 
@@ -650,24 +2206,82 @@ spr_context_t* spr_init(int width, int height) {
     ctx->fb.height = height;
     
     ctx->fb.color_buffer = (uint32_t*)malloc(width * height * sizeof(uint32_t));
-    ctx->fb.depth_buffer = NULL; 
+    ctx->fb.depth_buffer = NULL; /* Allocated by spr_enable_opaque_zbuffer() */
+
+    /* Per-pixel arrays cover whole tiles, so either layout fits */
+    ctx->tiles_x = (width + SPR_TILE_SIZE - 1) / SPR_TILE_SIZE;
+    ctx->tiles_y = (height + SPR_TILE_SIZE - 1) / SPR_TILE_SIZE;
+    ctx->pixel_slots = ctx->tiles_x * ctx->tiles_y * SPR_TILE_SIZE * SPR_TILE_SIZE;
+    ctx->tiled_layout = 0;
+    ctx->color = ctx->fb.color_buffer;
+    ctx->tile_color = NULL; /* Allocated by spr_set_framebuffer_layout() */
 
     /* A-Buffer Init */
-    ctx->fragment_heads = (spr_fragment_t**)calloc(width * height, sizeof(spr_fragment_t*));
+    ctx->fragment_heads = (spr_fragment_t**)calloc(ctx->pixel_slots, sizeof(spr_fragment_t*));
+    ctx->saturated_z = (float*)malloc(ctx->pixel_slots * sizeof(float));
+    ctx->storage = SPR_FRAGMENT_STORAGE_LIST;
+    ctx->kbuffer = NULL; /* Allocated by spr_set_fragment_storage() */
+    ctx->kcount = NULL;
+    ctx->sort_scratch.frags = NULL;
+    ctx->sort_scratch.capacity = 0;
+    ctx->counting = 0;
+    ctx->frag_offset = NULL; /* Allocated by spr_set_fragment_storage() */
+    ctx->frag_cursor = NULL;
+    ctx->frag_array = NULL;
+    ctx->frag_capacity = 0;
+    ctx->cfrag_heads = NULL; /* Allocated by spr_set_fragment_storage() */
+    ctx->cfrag_chunks = NULL;
+    ctx->cfrag_chunk_count = 0;
+    ctx->cfrag_high_water = 0;
+    if (ctx->saturated_z) {
+        int i;
+        for (i = 0; i < ctx->pixel_slots; ++i) ctx->saturated_z[i] = INFINITY;
+    }
     
     /* Dynamic Pool Init */
-    ctx->chunk_head = NULL;
-    ctx->free_list = NULL;
-    ctx->pool_cursor = SPR_CHUNK_SIZE; /* Force new chunk on first alloc */
+    memset(&ctx->arena, 0, sizeof(ctx->arena));
+    pool_init(&ctx->pool, &ctx->arena);
+    ctx->screen.min_x = 0;
+    ctx->screen.min_y = 0;
+    ctx->screen.max_x = width - 1;
+    ctx->screen.max_y = height - 1;
+    ctx->screen.pool = &ctx->pool;
     
-    ctx->stats.active_fragments = 0;
-    ctx->stats.peak_fragments = 0;
-    ctx->stats.total_chunks = 0;
-    ctx->stats.texture_samples = 0;
-
-    if (!ctx->fb.color_buffer || !ctx->fragment_heads) {
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+    /* Tiled rasterizer resources are created on first use */
+    ctx->thread_count = 0;
+    ctx->threads = NULL;
+    ctx->worker_pools = NULL;
+    ctx->worker_scratch = NULL;
+    ctx->parallel_resolve = 0;
+    ctx->parallel_geometry = 0;
+    ctx->geometry_jobs = NULL; /* Allocated by the first parallel geometry draw */
+    ctx->geometry_tris = NULL;
+    ctx->geometry_slice = 0;
+    ctx->tile_bins = NULL;
+    ctx->active_tiles = NULL;
+    ctx->tile_gen = (uint32_t*)calloc(ctx->tiles_x * ctx->tiles_y, sizeof(uint32_t));
+    ctx->clear_gen = 0; /* Every tile starts current: the buffers above are set up */
+    ctx->clear_color = 0;
+    ctx->color_pending = 0;
+    ctx->bin_tris = NULL;
+    ctx->bin_tri_count = 0;
+    ctx->bin_tri_capacity = 0;
+    ctx->vcache = NULL; /* Allocated by the first indexed draw */
+    ctx->vcache_tag = NULL;
+    ctx->vcache_pending = NULL;
+    ctx->vcache_capacity = 0;
+    ctx->vcache_draw = 0;
+    ctx->submitting = 0;
+    ctx->submit_refs = NULL; /* Allocated by the first spr_submit() */
+    ctx->submit_ref_capacity = 0;
+
+    if (!ctx->fb.color_buffer || !ctx->fragment_heads || !ctx->saturated_z || !ctx->tile_gen) {
         if (ctx->fb.color_buffer) free(ctx->fb.color_buffer);
         if (ctx->fragment_heads) free(ctx->fragment_heads);
+        if (ctx->saturated_z) free(ctx->saturated_z);
+        free(ctx->tile_gen);
         /* chunks are null, nothing to free */
         free(ctx);
         return NULL;
@@ -682,12 +2296,23 @@ spr_context_t* spr_init(int width, int height) {
     ctx->current_mode = SPR_MODELVIEW;
     
     ctx->current_vs = NULL;
+    ctx->current_vs_batch = NULL;
+    ctx->instance_id = 0;
     ctx->current_fs = NULL;
+    ctx->current_fs_batch = NULL;
     ctx->current_uniforms = NULL;
+    ctx->varyings = SPR_VARYING_ALL;
+    ctx->shade_pixel = select_shade_pixel(ctx);
 
     /* Default to CPU */
+    ctx->simd_kernel = detect_simd_kernel();
+    ctx->rasterizer_mode = SPR_RASTERIZER_CPU;
     ctx->rasterizer_func = spr_rasterize_triangle_cpu;
+    ctx->stats.rasterizer_kernel = SPR_RASTERIZER_CPU;
+    ctx->stats.simd_width = 1;
     ctx->cull_backface = 0;
+    ctx->opaque_zbuffer = 0;
+    ctx->clear_depth = 1.0f;
 
     return ctx;
 }
@@ -696,17 +2321,204 @@ void spr_enable_cull_face(spr_context_t* ctx, int enable) {
     if (ctx) ctx->cull_backface = enable;
 }
 
-void spr_set_rasterizer_mode(spr_context_t* ctx, spr_rasterizer_mode_t mode) {
+void spr_enable_opaque_zbuffer(spr_context_t* ctx, int enable) {
     if (!ctx) return;
-    if (mode == SPR_RASTERIZER_SIMD) {
-#if defined(__SSE2__)
-        ctx->rasterizer_func = spr_rasterize_triangle_simd;
-#else
-        printf("SPR: Warning: SIMD requested but not available. Falling back to CPU.\n");
-        ctx->rasterizer_func = spr_rasterize_triangle_cpu;
-#endif
-    } else {
-        ctx->rasterizer_func = spr_rasterize_triangle_cpu;
+    if (enable && !ctx->fb.depth_buffer) {
+        int i, count = ctx->pixel_slots;
+        ctx->fb.depth_buffer = (float*)malloc(count * sizeof(float));
+        if (!ctx->fb.depth_buffer) return; /* Stay in pure A-buffer mode */
+        for (i = 0; i < count; ++i) ctx->fb.depth_buffer[i] = ctx->clear_depth;
+    }
+    ctx->opaque_zbuffer = enable ? 1 : 0;
+}
+
+void spr_set_fragment_storage(spr_context_t* ctx, spr_fragment_storage_t storage) {
+    if (!ctx) return;
+    if (storage == SPR_FRAGMENT_STORAGE_KBUFFER && !ctx->kbuffer) {
+        size_t count = (size_t)ctx->pixel_slots;
+        ctx->kbuffer = (spr_kslot_t*)malloc(count * SPR_KBUFFER_K * sizeof(spr_kslot_t));
+        ctx->kcount = (uint8_t*)calloc(count, 1);
+        if (!ctx->kbuffer || !ctx->kcount) {
+            /* Stay in list mode */
+            free(ctx->kbuffer); ctx->kbuffer = NULL;
+            free(ctx->kcount); ctx->kcount = NULL;
+            return;
+        }
+    }
+    if (storage == SPR_FRAGMENT_STORAGE_COUNTED && !ctx->frag_offset) {
+        size_t count = (size_t)ctx->pixel_slots;
+        ctx->frag_offset = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+        ctx->frag_cursor = (uint32_t*)calloc(count, sizeof(uint32_t));
+        if (!ctx->frag_offset || !ctx->frag_cursor) {
+            /* Stay in the current mode */
+            free(ctx->frag_offset); ctx->frag_offset = NULL;
+            free(ctx->frag_cursor); ctx->frag_cursor = NULL;
+            return;
+        }
+    }
+    if (storage == SPR_FRAGMENT_STORAGE_COMPACT && !ctx->cfrag_heads) {
+        size_t count = (size_t)ctx->pixel_slots;
+        ctx->cfrag_heads = (uint32_t*)malloc(count * sizeof(uint32_t));
+        ctx->cfrag_chunks = (spr_cfrag_t**)calloc(SPR_COMPACT_MAX_CHUNKS, sizeof(spr_cfrag_t*));
+        if (!ctx->cfrag_heads || !ctx->cfrag_chunks) {
+            /* Stay in the current mode */
+            free(ctx->cfrag_heads); ctx->cfrag_heads = NULL;
+            free(ctx->cfrag_chunks); ctx->cfrag_chunks = NULL;
+            return;
+        }
+        memset(ctx->cfrag_heads, 0xFF, count * sizeof(uint32_t));
+    }
+    if (storage == SPR_FRAGMENT_STORAGE_COUNTED && ctx->storage != storage) {
+        /* Start counting right away; spr_clear() restarts it every frame */
+        memset(ctx->frag_cursor, 0, (size_t)ctx->pixel_slots * sizeof(uint32_t));
+    }
+    ctx->storage = storage;
+    ctx->counting = storage == SPR_FRAGMENT_STORAGE_COUNTED;
+    ctx->shade_pixel = select_shade_pixel(ctx);
+}
+
+void spr_end_count_pass(spr_context_t* ctx) {
+    size_t count, total = 0, i;
+    if (!ctx || !ctx->counting) return;
+    count = (size_t)ctx->pixel_slots;
+
+    /* Exclusive prefix sum: each pixel's slice starts where the last ended */
+    for (i = 0; i < count; ++i) {
+        ctx->frag_offset[i] = (uint32_t)total;
+        total += ctx->frag_cursor[i];
+    }
+    ctx->frag_offset[count] = (uint32_t)total;
+
+    if (total > ctx->frag_capacity) {
+        spr_kslot_t* array = (spr_kslot_t*)realloc(ctx->frag_array, total * sizeof(spr_kslot_t));
+        ctx->pool.heap_allocations++;
+        if (array) {
+            ctx->frag_array = array;
+            ctx->frag_capacity = total;
+        } else {
+            /* Out of memory: every slice is empty and the frame loses its fragments */
+            memset(ctx->frag_offset, 0, (count + 1) * sizeof(uint32_t));
+            total = 0;
+        }
+    }
+    memcpy(ctx->frag_cursor, ctx->frag_offset, count * sizeof(uint32_t));
+    if ((int)total > ctx->stats.peak_fragments) ctx->stats.peak_fragments = (int)total;
+
+    ctx->counting = 0;
+    ctx->shade_pixel = select_shade_pixel(ctx);
+}
+
+void spr_set_fragment_arena(spr_context_t* ctx, unsigned int flags) {
+    if (ctx) ctx->arena.flags = flags;
+}
+
+void spr_set_fragment_budget(spr_context_t* ctx, size_t bytes) {
+    if (ctx) ctx->arena.budget = bytes;
+}
+
+void spr_set_framebuffer_layout(spr_context_t* ctx, spr_framebuffer_layout_t layout) {
+    int tiled = layout == SPR_FRAMEBUFFER_TILED;
+    if (!ctx || tiled == ctx->tiled_layout) return;
+    if (tiled && !ctx->tile_color) {
+        ctx->tile_color = (uint32_t*)malloc((size_t)ctx->pixel_slots * sizeof(uint32_t));
+        if (!ctx->tile_color) return; /* Stay linear */
+    }
+    ctx->tiled_layout = tiled;
+    ctx->color = tiled ? ctx->tile_color : ctx->fb.color_buffer;
+
+    /* The per-pixel arrays are in the old order: every tile reads as
+       cleared again (with the last clear values) until it is drawn to */
+    invalidate_tiles(ctx);
+}
+
+spr_rasterizer_mode_t spr_set_rasterizer_mode(spr_context_t* ctx, spr_rasterizer_mode_t mode) {
+    spr_rasterizer_mode_t kernel = SPR_RASTERIZER_CPU;
+    if (!ctx) return kernel;
+    switch (mode) {
+        case SPR_RASTERIZER_SIMD:
+            kernel = ctx->simd_kernel;
+            mode = kernel;
+            break;
+        case SPR_RASTERIZER_AVX2:
+        case SPR_RASTERIZER_AVX512:
+            kernel = mode;
+            if (kernel_width(kernel) > kernel_width(ctx->simd_kernel)) kernel = ctx->simd_kernel;
+            mode = kernel;
+            break;
+        case SPR_RASTERIZER_TILED:
+            /* Every kernel matches SPR_RASTERIZER_CPU exactly, so tiles use the widest */
+            kernel = ctx->simd_kernel;
+            break;
+        default:
+            mode = SPR_RASTERIZER_CPU;
+            break;
+    }
+    ctx->rasterizer_mode = mode;
+    ctx->rasterizer_func = kernel_func(kernel);
+    ctx->stats.rasterizer_kernel = kernel;
+    ctx->stats.simd_width = kernel_width(kernel);
+    return kernel;
+}
+
+/* Creates the worker pool and its per-thread state, shared by the tiled
+   rasterizer and the parallel resolve */
+static int threads_prepare(spr_context_t* ctx) {
+    int i, n;
+    if (ctx->threads) return 1;
+    ctx->threads = spr_thread_pool_create(ctx->thread_count);
+    if (!ctx->threads) return 0;
+    n = spr_thread_pool_size(ctx->threads);
+    ctx->worker_pools = (spr_fragment_pool_t*)malloc(n * sizeof(spr_fragment_pool_t));
+    ctx->worker_scratch = (spr_sort_scratch_t*)calloc(n, sizeof(spr_sort_scratch_t));
+    if (!ctx->worker_pools || !ctx->worker_scratch) {
+        free(ctx->worker_pools); ctx->worker_pools = NULL;
+        free(ctx->worker_scratch); ctx->worker_scratch = NULL;
+        spr_thread_pool_destroy(ctx->threads);
+        ctx->threads = NULL;
+        return 0;
+    }
+    for (i = 0; i < n; ++i) pool_init(&ctx->worker_pools[i], &ctx->arena);
+    return 1;
+}
+
+/* Frees the state sized by the worker count, other than the fragment pools */
+static void free_worker_state(spr_context_t* ctx) {
+    int i;
+    free(ctx->geometry_jobs);
+    free(ctx->geometry_tris);
+    ctx->geometry_jobs = NULL;
+    ctx->geometry_tris = NULL;
+    if (!ctx->worker_scratch) return;
+    for (i = 0; i < spr_thread_pool_size(ctx->threads); ++i) free(ctx->worker_scratch[i].frags);
+    free(ctx->worker_scratch);
+    ctx->worker_scratch = NULL;
+}
+
+void spr_enable_parallel_resolve(spr_context_t* ctx, int enable) {
+    if (ctx) ctx->parallel_resolve = enable;
+}
+
+void spr_enable_parallel_geometry(spr_context_t* ctx, int enable) {
+    if (ctx) ctx->parallel_geometry = enable;
+}
+
+void spr_set_thread_count(spr_context_t* ctx, int count) {
+    if (!ctx) return;
+    if (count < 0) count = 0;
+    if (count == ctx->thread_count) return;
+    ctx->thread_count = count;
+
+    /* Drop the current workers; the next tiled draw recreates them */
+    if (ctx->threads) {
+        int i;
+        for (i = 0; i < spr_thread_pool_size(ctx->threads); ++i) {
+            pool_absorb(&ctx->pool, &ctx->worker_pools[i]);
+        }
+        free(ctx->worker_pools);
+        free_worker_state(ctx);
+        spr_thread_pool_destroy(ctx->threads);
+        ctx->threads = NULL;
+        ctx->worker_pools = NULL;
     }
 }
 
@@ -725,8 +2537,26 @@ void spr_matrix_mode(spr_context_t* ctx, spr_matrix_mode_enum mode) {
 void spr_set_program(spr_context_t* ctx, spr_vertex_shader_t vs, spr_fragment_shader_t fs, void* uniform_data) {
     if (!ctx) return;
     ctx->current_vs = vs;
+    ctx->current_vs_batch = NULL;
     ctx->current_fs = fs;
+    ctx->current_fs_batch = NULL;
     ctx->current_uniforms = uniform_data;
+    ctx->varyings = SPR_VARYING_ALL;
+    ctx->shade_pixel = select_shade_pixel(ctx);
+}
+
+void spr_set_varyings(spr_context_t* ctx, unsigned int varyings) {
+    if (!ctx) return;
+    ctx->varyings = varyings & SPR_VARYING_ALL;
+    ctx->shade_pixel = select_shade_pixel(ctx);
+}
+
+void spr_set_fragment_shader_batch(spr_context_t* ctx, spr_fragment_shader_batch_t fs_batch) {
+    if (ctx) ctx->current_fs_batch = fs_batch;
+}
+
+void spr_set_vertex_shader_batch(spr_context_t* ctx, spr_vertex_shader_batch_t vs_batch) {
+    if (ctx) ctx->current_vs_batch = vs_batch;
 }
 
 void spr_push_matrix(spr_context_t* ctx) {
@@ -859,15 +2689,49 @@ void spr_perspective(spr_context_t* ctx, float fov_deg, float aspect, float near
 void spr_shutdown(spr_context_t* ctx) {
     if (ctx) {
         if (ctx->fb.color_buffer) free(ctx->fb.color_buffer);
+        free(ctx->tile_color);
+        if (ctx->fb.depth_buffer) free(ctx->fb.depth_buffer);
         if (ctx->fragment_heads) free(ctx->fragment_heads);
+        if (ctx->saturated_z) free(ctx->saturated_z);
+        if (ctx->kbuffer) free(ctx->kbuffer);
+        if (ctx->kcount) free(ctx->kcount);
+        free(ctx->sort_scratch.frags);
+        free(ctx->frag_offset);
+        free(ctx->frag_cursor);
+        free(ctx->frag_array);
+        if (ctx->cfrag_chunks) {
+            int c;
+            for (c = 0; c < SPR_COMPACT_MAX_CHUNKS; ++c) free(ctx->cfrag_chunks[c]);
+            free(ctx->cfrag_chunks);
+        }
+        free(ctx->cfrag_heads);
         
         /* Free Chunks */
-        spr_fragment_chunk_t* chunk = ctx->chunk_head;
-        while (chunk) {
-            spr_fragment_chunk_t* next = chunk->next;
-            free(chunk);
-            chunk = next;
+        pool_release(&ctx->pool);
+
+        /* Tiled Rasterizer */
+        if (ctx->worker_pools) {
+            int i;
+            for (i = 0; i < spr_thread_pool_size(ctx->threads); ++i) {
+                pool_release(&ctx->worker_pools[i]);
+            }
+            free(ctx->worker_pools);
+        }
+        free_worker_state(ctx);
+        arena_release(&ctx->arena);
+        spr_thread_pool_destroy(ctx->threads);
+        if (ctx->tile_bins) {
+            int t;
+            for (t = 0; t < ctx->tiles_x * ctx->tiles_y; ++t) free(ctx->tile_bins[t].tris);
+            free(ctx->tile_bins);
         }
+        free(ctx->active_tiles);
+        free(ctx->bin_tris);
+        free(ctx->vcache);
+        free(ctx->vcache_tag);
+        free(ctx->vcache_pending);
+        free(ctx->submit_refs);
+        free(ctx->tile_gen);
         
         free(ctx);
     }
@@ -876,69 +2740,53 @@ void spr_shutdown(spr_context_t* ctx) {
 void spr_clear(spr_context_t* ctx, uint32_t color, float depth) {
     int pixel_count;
     int i;
-    (void)depth; /* Depth not used for clear in A-buffer */
     
     if (!ctx) return;
 
     pixel_count = ctx->fb.width * ctx->fb.height;
 
-    /* Fill background */
-    for (i = 0; i < pixel_count; ++i) {
-        ctx->fb.color_buffer[i] = color;
-    }
+    /* Deferred: background colour, depth (hybrid mode only; the A-buffer
+       itself needs none), fragment heads and saturation depths are filled
+       in per tile by materialize_tile() when a tile is first drawn to, and
+       tiles nothing reaches only get the colour at resolve. */
+    ctx->clear_color = color;
+    ctx->clear_depth = depth;
+    invalidate_tiles(ctx);
     
-    /* Reset A-Buffer Head Pointers */
-    /* We DO NOT free fragments here to keep them hot in the free list/pool */
-    /* We just clear the heads, effectively "freeing" the linked lists into the void? */
-    /* Wait, if we just clear heads, the fragments are leaked (lost reference). */
-    /* We MUST return them to the free list or reset the pool cursor. */
-    
-    /* Strategy: Reset Pool? */
-    /* If we use chunks + free list, "Reset" is complex because the list is scattered. */
-    /* Option 1: Walk every head and free_fragment() every node. (Slow but correct for free list) */
-    /* Option 2: Just reset pool_cursor = 0 and free_list = NULL and reuse chunks from scratch? */
-    /* If we do Option 2, we must ensure we don't leak "next" pointers in the chunks? No, if we treat chunks as raw memory, it's fine. */
-    /* However, Option 2 is much faster: O(1) vs O(Pixels * Fragments). */
-    /* Let's go with Option 2: "Reset World". */
-    /* We keep the chunks allocated, but treat them as empty. */
-    
-    memset(ctx->fragment_heads, 0, pixel_count * sizeof(spr_fragment_t*));
-    
-    /* Reset allocator */
-    ctx->free_list = NULL;
-    ctx->pool_cursor = 0;
-    /* Note: We reuse the *first* chunk. What about subsequent chunks? */
-    /* If we reset pool_cursor=0, we are only reusing the *first* chunk pointed to by chunk_head? */
-    /* No, chunk_head points to the *latest* chunk (LIFO). */
-    /* If we reset pool_cursor to 0, we start overwriting the *latest* chunk. */
-    /* The other chunks are still linked via chunk_head->next. */
-    /* This implies we only reuse the *latest* chunk and "leak" the capacity of older chunks until shutdown? */
-    /* Or do we want to free all chunks except one? */
-    
-    /* Better approach for clear: */
-    /* 1. Free all chunks except one (or keep them all but reset cursor logic?) */
-    /* Keeping them all but managing cursors for *each* chunk is complex. */
-    /* Simplest correct way: Free all chunks except head, reset head. */
+    /* The counted cursors are cleared eagerly: the prefix sum of
+       spr_end_count_pass() reads every pixel's count */
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_COUNTED) {
+        memset(ctx->frag_cursor, 0, (size_t)ctx->pixel_slots * sizeof(uint32_t));
+        ctx->counting = 1;
+        ctx->shade_pixel = select_shade_pixel(ctx);
+    }
     
-    /* Let's iterate and free 'next' chunks, keeping 'chunk_head' as the only one. */
-    if (ctx->chunk_head) {
-        spr_fragment_chunk_t* c = ctx->chunk_head->next;
-        while (c) {
-            spr_fragment_chunk_t* n = c->next;
-            free(c);
-            c = n;
-        }
-        ctx->chunk_head->next = NULL;
-        ctx->pool_cursor = 0;
-        ctx->stats.total_chunks = 1;
-    } else {
-        ctx->stats.total_chunks = 0;
+    /* Fragment memory is recycled, not freed: see arena_reset() and pool_reset() */
+    arena_reset(ctx);
+
+    /* Compact chunks stay allocated; reclaiming them is just a counter reset */
+    if (ctx->cfrag_chunks) {
+        compact_reserve(ctx, 1 + (ctx->worker_pools ? spr_thread_pool_size(ctx->threads) : 0));
+        ctx->cfrag_chunk_count = 0;
+    }
+
+    pool_reset(&ctx->pool);
+    if (ctx->worker_pools) {
+        for (i = 0; i < spr_thread_pool_size(ctx->threads); ++i) {
+            pool_reset(&ctx->worker_pools[i]);
+        }
     }
+
+    budget_reset(ctx, pixel_count);
     
     ctx->stats.active_fragments = 0;
     ctx->stats.peak_fragments = 0;
     ctx->stats.texture_samples = 0;
     ctx->stats.total_triangles = 0;
+    ctx->stats.shaded_vertices = 0;
+    ctx->stats.frustum_rejected_triangles = 0;
+    ctx->stats.clipped_triangles = 0;
+    update_fragment_stats(ctx);
 }
 
 spr_stats_t spr_get_stats(spr_context_t* ctx) {
@@ -952,8 +2800,20 @@ spr_stats_t* spr_get_stats_ptr(spr_context_t* ctx) {
     return NULL;
 }
 
+/* Writes the clear colour into tiles that are still stale, so the colour
+   buffer can be read directly */
+static void flush_clear_color(spr_context_t* ctx) {
+    int t;
+    if (!ctx->color_pending) return;
+    for (t = 0; t < ctx->tiles_x * ctx->tiles_y; ++t) {
+        if (tile_stale(ctx, t)) clear_tile_color(ctx, t);
+    }
+    ctx->color_pending = 0;
+}
+
 uint32_t* spr_get_color_buffer(spr_context_t* ctx) {
     if (!ctx) return NULL;
+    flush_clear_color(ctx);
     return ctx->fb.color_buffer;
 }
 
@@ -965,35 +2825,46 @@ int spr_get_height(spr_context_t* ctx) {
     return ctx ? ctx->fb.height : 0;
 }
 
-static void spr_vertex_interp(spr_vertex_out_t* out, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, float t) {
+static void spr_vertex_interp(spr_vertex_out_t* out, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, float t, unsigned int varyings) {
+    memset(out, 0, sizeof(*out));
     out->position.x = v0->position.x + (v1->position.x - v0->position.x) * t;
     out->position.y = v0->position.y + (v1->position.y - v0->position.y) * t;
     out->position.z = v0->position.z + (v1->position.z - v0->position.z) * t;
     out->position.w = v0->position.w + (v1->position.w - v0->position.w) * t;
     
-    out->normal.x = v0->normal.x + (v1->normal.x - v0->normal.x) * t;
-    out->normal.y = v0->normal.y + (v1->normal.y - v0->normal.y) * t;
-    out->normal.z = v0->normal.z + (v1->normal.z - v0->normal.z) * t;
+    if (varyings & SPR_VARYING_NORMAL) {
+        out->normal.x = v0->normal.x + (v1->normal.x - v0->normal.x) * t;
+        out->normal.y = v0->normal.y + (v1->normal.y - v0->normal.y) * t;
+        out->normal.z = v0->normal.z + (v1->normal.z - v0->normal.z) * t;
+    }
     
-    out->uv.x = v0->uv.x + (v1->uv.x - v0->uv.x) * t;
-    out->uv.y = v0->uv.y + (v1->uv.y - v0->uv.y) * t;
+    if (varyings & SPR_VARYING_UV) {
+        out->uv.x = v0->uv.x + (v1->uv.x - v0->uv.x) * t;
+        out->uv.y = v0->uv.y + (v1->uv.y - v0->uv.y) * t;
+    }
     
-    out->color.x = v0->color.x + (v1->color.x - v0->color.x) * t;
-    out->color.y = v0->color.y + (v1->color.y - v0->color.y) * t;
-    out->color.z = v0->color.z + (v1->color.z - v0->color.z) * t;
-    out->color.w = v0->color.w + (v1->color.w - v0->color.w) * t;
+    if (varyings & SPR_VARYING_COLOR) {
+        out->color.x = v0->color.x + (v1->color.x - v0->color.x) * t;
+        out->color.y = v0->color.y + (v1->color.y - v0->color.y) * t;
+        out->color.z = v0->color.z + (v1->color.z - v0->color.z) * t;
+        out->color.w = v0->color.w + (v1->color.w - v0->color.w) * t;
+    }
     
-    out->tangent.x = v0->tangent.x + (v1->tangent.x - v0->tangent.x) * t;
-    out->tangent.y = v0->tangent.y + (v1->tangent.y - v0->tangent.y) * t;
-    out->tangent.z = v0->tangent.z + (v1->tangent.z - v0->tangent.z) * t;
-    out->tangent.w = v0->tangent.w; /* Handedness usually constant */
+    if (varyings & SPR_VARYING_TANGENT) {
+        out->tangent.x = v0->tangent.x + (v1->tangent.x - v0->tangent.x) * t;
+        out->tangent.y = v0->tangent.y + (v1->tangent.y - v0->tangent.y) * t;
+        out->tangent.z = v0->tangent.z + (v1->tangent.z - v0->tangent.z) * t;
+        out->tangent.w = v0->tangent.w; /* Handedness usually constant */
+    }
 
-    out->barycentric.x = v0->barycentric.x + (v1->barycentric.x - v0->barycentric.x) * t;
-    out->barycentric.y = v0->barycentric.y + (v1->barycentric.y - v0->barycentric.y) * t;
-    out->barycentric.z = v0->barycentric.z + (v1->barycentric.z - v0->barycentric.z) * t;
+    if (varyings & SPR_VARYING_BARYCENTRIC) {
+        out->barycentric.x = v0->barycentric.x + (v1->barycentric.x - v0->barycentric.x) * t;
+        out->barycentric.y = v0->barycentric.y + (v1->barycentric.y - v0->barycentric.y) * t;
+        out->barycentric.z = v0->barycentric.z + (v1->barycentric.z - v0->barycentric.z) * t;
+    }
 }
 
-static void spr_viewport_transform(spr_context_t* ctx, spr_vertex_out_t* v) {
+static void spr_viewport_transform(const spr_context_t* ctx, spr_vertex_out_t* v) {
     float inv_w = 1.0f / v->position.w;
     v->position.x *= inv_w;
     v->position.y *= inv_w;
@@ -1007,132 +2878,1142 @@ static void spr_viewport_transform(spr_context_t* ctx, spr_vertex_out_t* v) {
     v->position.w = inv_w; /* Store 1/w for interpolation */
 }
 
-void spr_draw_triangles(spr_context_t* ctx, int count, const void* vertices, size_t stride) {
-    if (!ctx || !ctx->current_vs || !ctx->current_fs || !ctx->rasterizer_func) return; 
-    
-    ctx->stats.total_triangles += count;
-    
+/* --- Tiled Rasterizer --- */
+/* Post-clip triangles are binned into SPR_TILE_SIZE screen tiles and the
+   tiles are rasterized on the worker pool. A tile is only ever touched by one
+   worker, which owns that tile's range of fragment_heads and allocates from
+   its own pool, so insert_fragment needs no locks. Triangles stay in
+   submission order inside each bin, so every pixel sees its fragments in the
+   same order as the serial path and the result is identical. */
+
+#define SPR_TILED_BATCH 65536 /* Triangles binned before a forced flush */
+
+static int tiled_prepare(spr_context_t* ctx) {
+    int n;
+    if (!threads_prepare(ctx)) return 0;
+    if (!ctx->tile_bins) {
+        n = ctx->tiles_x * ctx->tiles_y;
+        ctx->tile_bins = (spr_tile_bin_t*)calloc(n, sizeof(spr_tile_bin_t));
+        ctx->active_tiles = (int*)malloc(n * sizeof(int));
+        if (!ctx->tile_bins || !ctx->active_tiles) {
+            free(ctx->tile_bins); ctx->tile_bins = NULL;
+            free(ctx->active_tiles); ctx->active_tiles = NULL;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void tile_target(spr_context_t* ctx, int tile, spr_fragment_pool_t* pool, spr_raster_target_t* rt) {
+    rt->min_x = (tile % ctx->tiles_x) * SPR_TILE_SIZE;
+    rt->min_y = (tile / ctx->tiles_x) * SPR_TILE_SIZE;
+    rt->max_x = rt->min_x + SPR_TILE_SIZE - 1;
+    rt->max_y = rt->min_y + SPR_TILE_SIZE - 1;
+    if (rt->max_x >= ctx->fb.width) rt->max_x = ctx->fb.width - 1;
+    if (rt->max_y >= ctx->fb.height) rt->max_y = ctx->fb.height - 1;
+    rt->pool = pool;
+}
+
+static void tiled_job(void* user_data, int job_index, int worker_index) {
+    spr_context_t* ctx = (spr_context_t*)user_data;
+    int tile = ctx->active_tiles[job_index];
+    spr_tile_bin_t* bin = &ctx->tile_bins[tile];
+    spr_raster_target_t rt;
     int i;
-    const uint8_t* v_ptr = (const uint8_t*)vertices;
-    
-    for (i = 0; i < count; ++i) {
-        spr_vertex_out_t tri[3];
-        
-        ctx->current_vs(ctx->current_uniforms, v_ptr, &tri[0]); v_ptr += stride;
-        ctx->current_vs(ctx->current_uniforms, v_ptr, &tri[1]); v_ptr += stride;
-        ctx->current_vs(ctx->current_uniforms, v_ptr, &tri[2]); v_ptr += stride;
-        
-        tri[0].barycentric.x = 1.0f; tri[0].barycentric.y = 0.0f; tri[0].barycentric.z = 0.0f;
-        tri[1].barycentric.x = 0.0f; tri[1].barycentric.y = 1.0f; tri[1].barycentric.z = 0.0f;
-        tri[2].barycentric.x = 0.0f; tri[2].barycentric.y = 0.0f; tri[2].barycentric.z = 1.0f;
-        
-        /* Sutherland-Hodgman clipping against near plane (w >= epsilon) */
-        spr_vertex_out_t clipped[4];
-        int clipped_count = 0;
-        const float epsilon = 0.001f;
-        
-        for (int j = 0; j < 3; ++j) {
-            spr_vertex_out_t* v1 = &tri[j];
-            spr_vertex_out_t* v2 = &tri[(j + 1) % 3];
+
+    tile_target(ctx, tile, &ctx->worker_pools[worker_index], &rt);
+    for (i = 0; i < bin->count; ++i) {
+        const spr_bin_triangle_t* tri = &ctx->bin_tris[bin->tris[i]];
+        ctx->rasterizer_func(ctx, &rt, &tri->v[0], &tri->v[1], &tri->v[2]);
+    }
+    bin->count = 0;
+    spr_texture_flush_samples();
+}
+
+static void tiled_flush(spr_context_t* ctx) {
+    int t, active = 0;
+    if (ctx->bin_tri_count == 0) return;
+
+    for (t = 0; t < ctx->tiles_x * ctx->tiles_y; ++t) {
+        if (ctx->tile_bins[t].count > 0) ctx->active_tiles[active++] = t;
+    }
+    spr_thread_pool_run(ctx->threads, tiled_job, ctx, active);
+    ctx->bin_tri_count = 0;
+}
+
+static int bin_push(spr_context_t* ctx, spr_tile_bin_t* bin, int tri) {
+    if (bin->count == bin->capacity) {
+        int cap = bin->capacity ? bin->capacity * 2 : 64;
+        int* tris = (int*)realloc(bin->tris, cap * sizeof(int));
+        ctx->pool.heap_allocations++;
+        if (!tris) return 0;
+        bin->tris = tris;
+        bin->capacity = cap;
+    }
+    bin->tris[bin->count++] = tri;
+    return 1;
+}
+
+static void tiled_bin_triangle(spr_context_t* ctx, const spr_vertex_out_t* v0, const spr_vertex_out_t* v1, const spr_vertex_out_t* v2) {
+    int64_t x0 = snap_subpixel(v0->position.x), y0 = snap_subpixel(v0->position.y);
+    int64_t x1 = snap_subpixel(v1->position.x), y1 = snap_subpixel(v1->position.y);
+    int64_t x2 = snap_subpixel(v2->position.x), y2 = snap_subpixel(v2->position.y);
+    int min_x, min_y, max_x, max_y;
+    int tx, ty, idx;
+
+    /* Same rejection tests and bounds as the kernel, on the same snapped
+       vertices, so the tiles see exactly the triangles it would draw */
+    if (triangle_rejected(ctx, v0, v1, v2)) return;
+
+    min_x = (int)subpixel_floor(x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2));
+    min_y = (int)subpixel_floor(y0 < y1 ? (y0 < y2 ? y0 : y2) : (y1 < y2 ? y1 : y2));
+    max_x = (int)subpixel_floor(x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2));
+    max_y = (int)subpixel_floor(y0 > y1 ? (y0 > y2 ? y0 : y2) : (y1 > y2 ? y1 : y2));
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x >= ctx->fb.width) max_x = ctx->fb.width - 1;
+    if (max_y >= ctx->fb.height) max_y = ctx->fb.height - 1;
+
+    if (ctx->bin_tri_count == ctx->bin_tri_capacity) {
+        int cap = ctx->bin_tri_capacity ? ctx->bin_tri_capacity * 2 : 1024;
+        spr_bin_triangle_t* tris = (spr_bin_triangle_t*)realloc(ctx->bin_tris, cap * sizeof(spr_bin_triangle_t));
+        ctx->pool.heap_allocations++;
+        if (!tris) {
+            /* Out of memory: drain what we have and draw this one directly */
+            tiled_flush(ctx);
+            ctx->rasterizer_func(ctx, &ctx->screen, v0, v1, v2);
+            return;
+        }
+        ctx->bin_tris = tris;
+        ctx->bin_tri_capacity = cap;
+    }
+
+    idx = ctx->bin_tri_count++;
+    ctx->bin_tris[idx].v[0] = *v0;
+    ctx->bin_tris[idx].v[1] = *v1;
+    ctx->bin_tris[idx].v[2] = *v2;
+
+    for (ty = min_y / SPR_TILE_SIZE; ty <= max_y / SPR_TILE_SIZE; ++ty) {
+        for (tx = min_x / SPR_TILE_SIZE; tx <= max_x / SPR_TILE_SIZE; ++tx) {
+            int tile = ty * ctx->tiles_x + tx;
+            if (ctx->bin_tri_count == 0) {
+                /* A failed push flushed the bins: finish this triangle serially */
+                spr_raster_target_t rt;
+                tile_target(ctx, tile, &ctx->pool, &rt);
+                ctx->rasterizer_func(ctx, &rt, v0, v1, v2);
+            } else if (!bin_push(ctx, &ctx->tile_bins[tile], idx)) {
+                /* Out of memory: drain the bins (this triangle's tiles so
+                   far included), then draw this tile directly */
+                spr_raster_target_t rt;
+                tiled_flush(ctx);
+                tile_target(ctx, tile, &ctx->pool, &rt);
+                ctx->rasterizer_func(ctx, &rt, v0, v1, v2);
+            }
+        }
+    }
+
+    if (ctx->bin_tri_count >= SPR_TILED_BATCH) tiled_flush(ctx);
+}
+
+/* --- Clipping --- */
+
+/* Clip-space planes, as signed distances (inside >= 0). Near (w >= epsilon)
+   keeps 1/w finite, z bounds the depth range, and x/y are clipped at a guard
+   band SPR_GUARD_BAND times the viewport: triangles that only cross the
+   screen edges are left to the rasterizer's bounding box clamp, which is
+   much cheaper, while the band keeps screen coordinates small enough for
+   the edge functions and the (int) bounding box conversion. */
+#define SPR_CLIP_W_EPSILON 0.001f
+#define SPR_GUARD_BAND 8.0f
+#define SPR_CLIP_PLANES 7
+#define SPR_CLIP_MAX_VERTICES (3 + SPR_CLIP_PLANES)
+
+static float clip_distance(const spr_vertex_out_t* v, int plane) {
+    const vec4_t* p = &v->position;
+    switch (plane) {
+        case 0: return p->w - SPR_CLIP_W_EPSILON;
+        case 1: return p->z + p->w;              /* Near */
+        case 2: return p->w - p->z;              /* Far */
+        case 3: return SPR_GUARD_BAND * p->w + p->x;
+        case 4: return SPR_GUARD_BAND * p->w - p->x;
+        case 5: return SPR_GUARD_BAND * p->w + p->y;
+        default: return SPR_GUARD_BAND * p->w - p->y;
+    }
+}
+
+/* Bit per plane the vertex is outside of, plus (above the clip planes) one
+   per view frustum side, used only for trivial rejection */
+static unsigned int clip_outcode(const spr_vertex_out_t* v) {
+    const vec4_t* p = &v->position;
+    unsigned int code = 0;
+    int plane;
+    for (plane = 0; plane < SPR_CLIP_PLANES; ++plane) {
+        if (clip_distance(v, plane) < 0) code |= 1u << plane;
+    }
+    if (p->x < -p->w) code |= 1u << (SPR_CLIP_PLANES + 0);
+    if (p->x >  p->w) code |= 1u << (SPR_CLIP_PLANES + 1);
+    if (p->y < -p->w) code |= 1u << (SPR_CLIP_PLANES + 2);
+    if (p->y >  p->w) code |= 1u << (SPR_CLIP_PLANES + 3);
+    return code;
+}
+
+/* Sutherland-Hodgman against the planes the triangle crosses. Writes the
+   clipped convex polygon to 'out' and returns its vertex count, or 0 when
+   the triangle is entirely outside the view frustum. Counts into 'stats'. */
+static int clip_triangle(const spr_context_t* ctx, spr_stats_t* stats, const spr_vertex_out_t tri[3], spr_vertex_out_t* out) {
+    spr_vertex_out_t buffer[SPR_CLIP_MAX_VERTICES];
+    unsigned int c0 = clip_outcode(&tri[0]);
+    unsigned int c1 = clip_outcode(&tri[1]);
+    unsigned int c2 = clip_outcode(&tri[2]);
+    unsigned int crossed = (c0 | c1 | c2) & ((1u << SPR_CLIP_PLANES) - 1);
+    spr_vertex_out_t* src = buffer;
+    spr_vertex_out_t* dst = out;
+    int count = 3;
+    int plane, j;
+
+    if (c0 & c1 & c2) {
+        stats->frustum_rejected_triangles++;
+        return 0;
+    }
+    out[0] = tri[0]; out[1] = tri[1]; out[2] = tri[2];
+    if (!crossed) return 3;
+
+    stats->clipped_triangles++;
+    for (plane = 0; plane < SPR_CLIP_PLANES; ++plane) {
+        spr_vertex_out_t* tmp;
+        int n = 0;
+        if (!(crossed & (1u << plane))) continue;
+
+        /* Ping-pong between 'out' and the scratch buffer */
+        tmp = src; src = dst; dst = tmp;
+        for (j = 0; j < count; ++j) {
+            const spr_vertex_out_t* v1 = &src[j];
+            const spr_vertex_out_t* v2 = &src[(j + 1) % count];
+            float d1 = clip_distance(v1, plane);
+            float d2 = clip_distance(v2, plane);
+
+            if ((d1 >= 0) != (d2 >= 0)) {
+                spr_vertex_interp(&dst[n++], v1, v2, d1 / (d1 - d2), ctx->varyings);
+            }
+            if (d2 >= 0) dst[n++] = *v2;
+        }
+        count = n;
+        if (count < 3) return 0;
+    }
+    if (dst != out) memcpy(out, dst, count * sizeof(spr_vertex_out_t));
+    return count;
+}
+
+/* Clips one shaded triangle and viewport-transforms the pieces. Returns the
+   vertex count of the convex polygon left in 'out', or 0. */
+static int setup_triangle(const spr_context_t* ctx, spr_stats_t* stats, spr_vertex_out_t* tri, spr_vertex_out_t* out) {
+    int clipped_count, j;
+
+    tri[0].barycentric.x = 1.0f; tri[0].barycentric.y = 0.0f; tri[0].barycentric.z = 0.0f;
+    tri[1].barycentric.x = 0.0f; tri[1].barycentric.y = 1.0f; tri[1].barycentric.z = 0.0f;
+    tri[2].barycentric.x = 0.0f; tri[2].barycentric.y = 0.0f; tri[2].barycentric.z = 1.0f;
+
+    clipped_count = clip_triangle(ctx, stats, tri, out);
+    if (clipped_count < 3) return 0;
+
+    for (j = 0; j < clipped_count; ++j) {
+        spr_viewport_transform(ctx, &out[j]);
+    }
+    return clipped_count;
+}
+
+/* Clips one shaded triangle, then rasterizes or bins the pieces */
+static void draw_shaded_triangle(spr_context_t* ctx, spr_vertex_out_t* tri, int tiled) {
+    spr_vertex_out_t clipped[SPR_CLIP_MAX_VERTICES];
+    int clipped_count = setup_triangle(ctx, &ctx->stats, tri, clipped);
+    int j;
+
+    /* Fan-triangulate the clipped polygon */
+    for (j = 1; j + 1 < clipped_count; ++j) {
+        if (tiled) {
+            tiled_bin_triangle(ctx, &clipped[0], &clipped[j], &clipped[j + 1]);
+        } else {
+            ctx->rasterizer_func(ctx, &ctx->screen, &clipped[0], &clipped[j], &clipped[j + 1]);
+        }
+    }
+}
+
+/* Every vertex shader call goes through these two, so shaders can read the
+   instance they shade from out->instance_id */
+static void shade_vertex(const spr_context_t* ctx, const void* in, spr_vertex_out_t* out) {
+    out->instance_id = ctx->instance_id;
+    ctx->current_vs(ctx->current_uniforms, in, out);
+}
+
+/* A batch call never mixes instances */
+static void shade_vertex_batch(const spr_context_t* ctx, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    int k;
+    for (k = 0; k < count; ++k) out[k].instance_id = ctx->instance_id;
+    ctx->current_vs_batch(ctx->current_uniforms, vertices, stride, indices, count, out);
+}
+
+/* --- Parallel Geometry --- */
+/* Vertex shading, clipping, viewport transform and culling run on the worker
+   pool, SPR_GEOMETRY_BATCH triangles per round split into one contiguous
+   range per job. Each job writes its surviving screen-space triangles to its
+   own slice; the slices are then drained in job order into the rasterizer or
+   the tile bins, so triangles arrive in submission order and the image is
+   identical to the serial front end. Slices hold the worst case (every
+   triangle clipped into a full fan), so workers never allocate. */
+
+#define SPR_GEOMETRY_BATCH 1024 /* Triangles per parallel geometry round */
+
+/* Returns 1 if draws should use the parallel front end */
+static int geometry_prepare(spr_context_t* ctx) {
+    int jobs;
+    if (!ctx->parallel_geometry || !threads_prepare(ctx)) return 0;
+    jobs = spr_thread_pool_size(ctx->threads);
+    if (jobs < 2) return 0;
+    if (!ctx->geometry_tris) {
+        int slice = (SPR_GEOMETRY_BATCH + jobs - 1) / jobs * (SPR_CLIP_MAX_VERTICES - 2);
+        ctx->geometry_jobs = (spr_geometry_job_t*)calloc(jobs, sizeof(spr_geometry_job_t));
+        ctx->geometry_tris = (spr_vertex_out_t*)malloc((size_t)jobs * slice * 3 * sizeof(spr_vertex_out_t));
+        if (!ctx->geometry_jobs || !ctx->geometry_tris) {
+            free(ctx->geometry_jobs); ctx->geometry_jobs = NULL;
+            free(ctx->geometry_tris); ctx->geometry_tris = NULL;
+            return 0;
+        }
+        ctx->geometry_slice = slice;
+    }
+    return 1;
+}
+
+static void geometry_job(void* user_data, int job_index, int worker_index) {
+    spr_context_t* ctx = (spr_context_t*)user_data;
+    spr_geometry_job_t* job = &ctx->geometry_jobs[job_index];
+    spr_vertex_out_t* out = ctx->geometry_tris + (size_t)job_index * ctx->geometry_slice * 3;
+    spr_vertex_out_t shaded[SPR_VS_BATCH];
+    const uint8_t* base = ctx->geometry_vertices;
+    size_t stride = ctx->geometry_stride;
+    int i, k, n;
+    (void)worker_index;
+
+    for (i = job->first; i < job->end; i += n) {
+        n = job->end - i < SPR_VS_BATCH / 3 ? job->end - i : SPR_VS_BATCH / 3;
+
+        /* Shaded corners of triangles [i, i + n) */
+        if (ctx->geometry_idx16 || ctx->geometry_idx32) {
+            for (k = 0; k < n * 3; ++k) {
+                size_t at = (size_t)i * 3 + k;
+                uint32_t v = ctx->geometry_idx16 ? ctx->geometry_idx16[at] : ctx->geometry_idx32[at];
+                shaded[k] = ctx->vcache[v - ctx->geometry_lo];
+            }
+        } else if (ctx->current_vs_batch) {
+            shade_vertex_batch(ctx, base + (size_t)i * 3 * stride, stride, NULL, n * 3, shaded);
+        } else {
+            for (k = 0; k < n * 3; ++k) {
+                shade_vertex(ctx, base + ((size_t)i * 3 + k) * stride, &shaded[k]);
+            }
+        }
+
+        for (k = 0; k < n; ++k) {
+            spr_vertex_out_t clipped[SPR_CLIP_MAX_VERTICES];
+            int clipped_count = setup_triangle(ctx, &job->stats, &shaded[k * 3], clipped);
+            int j;
+            for (j = 1; j + 1 < clipped_count; ++j) {
+                spr_vertex_out_t* tri;
+                if (triangle_rejected(ctx, &clipped[0], &clipped[j], &clipped[j + 1])) continue;
+                tri = out + (size_t)job->count++ * 3;
+                tri[0] = clipped[0];
+                tri[1] = clipped[j];
+                tri[2] = clipped[j + 1];
+            }
+        }
+    }
+    spr_texture_flush_samples();
+}
+
+/* Runs the front end for 'count' triangles of the draw set up in ctx->geometry_* */
+static void geometry_run(spr_context_t* ctx, int count, int tiled) {
+    int jobs = spr_thread_pool_size(ctx->threads);
+    int first, j, t;
+
+    for (first = 0; first < count; first += SPR_GEOMETRY_BATCH) {
+        int n = count - first < SPR_GEOMETRY_BATCH ? count - first : SPR_GEOMETRY_BATCH;
+        int per = (n + jobs - 1) / jobs;
+        for (j = 0; j < jobs; ++j) {
+            spr_geometry_job_t* job = &ctx->geometry_jobs[j];
+            job->first = first + (j * per < n ? j * per : n);
+            job->end = first + ((j + 1) * per < n ? (j + 1) * per : n);
+            job->count = 0;
+            job->stats.frustum_rejected_triangles = 0;
+            job->stats.clipped_triangles = 0;
+        }
+        spr_thread_pool_run(ctx->threads, geometry_job, ctx, jobs);
+
+        for (j = 0; j < jobs; ++j) {
+            const spr_geometry_job_t* job = &ctx->geometry_jobs[j];
+            const spr_vertex_out_t* tris = ctx->geometry_tris + (size_t)j * ctx->geometry_slice * 3;
+            ctx->stats.frustum_rejected_triangles += job->stats.frustum_rejected_triangles;
+            ctx->stats.clipped_triangles += job->stats.clipped_triangles;
+            for (t = 0; t < job->count; ++t) {
+                const spr_vertex_out_t* tri = tris + (size_t)t * 3;
+                if (tiled) {
+                    tiled_bin_triangle(ctx, &tri[0], &tri[1], &tri[2]);
+                } else {
+                    ctx->rasterizer_func(ctx, &ctx->screen, &tri[0], &tri[1], &tri[2]);
+                }
+            }
+        }
+    }
+}
+
+/* One instance of a soup draw */
+static void draw_soup(spr_context_t* ctx, int count, const uint8_t* v_ptr, size_t stride, int tiled, int parallel) {
+    int i;
+    if (parallel) {
+        ctx->geometry_vertices = v_ptr;
+        ctx->geometry_stride = stride;
+        ctx->geometry_idx16 = NULL;
+        ctx->geometry_idx32 = NULL;
+        geometry_run(ctx, count, tiled);
+    } else if (ctx->current_vs_batch) {
+        /* Shade whole triangles a batch at a time, then assemble from the batch */
+        spr_vertex_out_t shaded[SPR_VS_BATCH];
+        for (i = 0; i < count; i += SPR_VS_BATCH / 3) {
+            int n = count - i < SPR_VS_BATCH / 3 ? count - i : SPR_VS_BATCH / 3;
+            int t;
+            shade_vertex_batch(ctx, v_ptr, stride, NULL, n * 3, shaded);
+            v_ptr += (size_t)n * 3 * stride;
+            for (t = 0; t < n; ++t) {
+                spr_vertex_out_t tri[3];
+                tri[0] = shaded[t * 3 + 0];
+                tri[1] = shaded[t * 3 + 1];
+                tri[2] = shaded[t * 3 + 2];
+                draw_shaded_triangle(ctx, tri, tiled);
+            }
+        }
+    } else {
+        for (i = 0; i < count; ++i) {
+            spr_vertex_out_t tri[3];
             
-            int v1_inside = v1->position.w >= epsilon;
-            int v2_inside = v2->position.w >= epsilon;
+            shade_vertex(ctx, v_ptr, &tri[0]); v_ptr += stride;
+            shade_vertex(ctx, v_ptr, &tri[1]); v_ptr += stride;
+            shade_vertex(ctx, v_ptr, &tri[2]); v_ptr += stride;
             
-            if (v1_inside) {
-                if (v2_inside) {
-                    clipped[clipped_count++] = *v2;
-                } else {
-                    float t = (epsilon - v1->position.w) / (v2->position.w - v1->position.w);
-                    spr_vertex_interp(&clipped[clipped_count++], v1, v2, t);
+            draw_shaded_triangle(ctx, tri, tiled);
+        }
+    }
+}
+
+void spr_draw_triangles_instanced(spr_context_t* ctx, int count, const void* vertices, size_t stride, int instance_count) {
+    int tiled, parallel;
+    if (!ctx || !ctx->current_vs || !ctx->rasterizer_func) return;
+    if (!ctx->current_fs && !ctx->current_fs_batch) return;
+    if (count <= 0 || instance_count <= 0) return;
+    
+    ctx->stats.total_triangles += (uint64_t)count * instance_count;
+    ctx->stats.shaded_vertices += (uint64_t)count * 3 * instance_count;
+    
+    tiled = (ctx->rasterizer_mode == SPR_RASTERIZER_TILED) && tiled_prepare(ctx);
+    parallel = geometry_prepare(ctx);
+    for (ctx->instance_id = 0; ctx->instance_id < instance_count; ++ctx->instance_id) {
+        draw_soup(ctx, count, (const uint8_t*)vertices, stride, tiled, parallel);
+    }
+    ctx->instance_id = 0;
+
+    /* Uniforms may change after we return, so binned work is finished per draw */
+    if (tiled && !ctx->submitting) tiled_flush(ctx);
+    update_fragment_stats(ctx);
+}
+
+void spr_draw_triangles(spr_context_t* ctx, int count, const void* vertices, size_t stride) {
+    spr_draw_triangles_instanced(ctx, count, vertices, stride, 1);
+}
+
+/* Grows the vertex cache to 'range' slots. Returns 0 if it cannot. */
+static int vcache_reserve(spr_context_t* ctx, int range) {
+    spr_vertex_out_t* slots;
+    uint32_t* tags;
+    uint32_t* pending;
+    if (range <= ctx->vcache_capacity) return 1;
+    slots = (spr_vertex_out_t*)realloc(ctx->vcache, (size_t)range * sizeof(spr_vertex_out_t));
+    if (!slots) return 0;
+    ctx->vcache = slots;
+    tags = (uint32_t*)realloc(ctx->vcache_tag, (size_t)range * sizeof(uint32_t));
+    if (!tags) return 0;
+    /* New slots must not match any draw tag */
+    memset(tags + ctx->vcache_capacity, 0, (size_t)(range - ctx->vcache_capacity) * sizeof(uint32_t));
+    ctx->vcache_tag = tags;
+    pending = (uint32_t*)realloc(ctx->vcache_pending, (size_t)range * sizeof(uint32_t));
+    if (!pending) return 0;
+    ctx->vcache_pending = pending;
+    ctx->vcache_capacity = range;
+    return 1;
+}
+
+/* Shades the cache misses pending[0..n) into their slots, SPR_VS_BATCH at a
+   time when a batch shader is set. Only those slots are written, so
+   parallel jobs can split the list. */
+static void vcache_shade(spr_context_t* ctx, const uint8_t* base, size_t stride, uint32_t lo, const uint32_t* pending, int n) {
+    spr_vertex_out_t shaded[SPR_VS_BATCH];
+    int i, k;
+    if (!ctx->current_vs_batch) {
+        for (k = 0; k < n; ++k) {
+            shade_vertex(ctx, base + (size_t)pending[k] * stride, &ctx->vcache[pending[k] - lo]);
+        }
+        return;
+    }
+    for (i = 0; i < n; i += SPR_VS_BATCH) {
+        int m = n - i < SPR_VS_BATCH ? n - i : SPR_VS_BATCH;
+        shade_vertex_batch(ctx, base, stride, pending + i, m, shaded);
+        for (k = 0; k < m; ++k) ctx->vcache[pending[i + k] - lo] = shaded[k];
+    }
+}
+
+static void vcache_job(void* user_data, int job_index, int worker_index) {
+    spr_context_t* ctx = (spr_context_t*)user_data;
+    const spr_geometry_job_t* job = &ctx->geometry_jobs[job_index];
+    (void)worker_index;
+    vcache_shade(ctx, ctx->geometry_vertices, ctx->geometry_stride, ctx->geometry_lo, ctx->vcache_pending + job->first, job->end - job->first);
+    spr_texture_flush_samples();
+}
+
+/* Shades the n vertices gathered in ctx->vcache_pending, on the worker pool
+   when 'parallel' */
+static void vcache_shade_pending(spr_context_t* ctx, int n, int parallel) {
+    int jobs, per, j;
+    if (!parallel) {
+        vcache_shade(ctx, ctx->geometry_vertices, ctx->geometry_stride, ctx->geometry_lo, ctx->vcache_pending, n);
+        return;
+    }
+    jobs = spr_thread_pool_size(ctx->threads);
+    per = (n + jobs - 1) / jobs;
+    for (j = 0; j < jobs; ++j) {
+        ctx->geometry_jobs[j].first = j * per < n ? j * per : n;
+        ctx->geometry_jobs[j].end = (j + 1) * per < n ? (j + 1) * per : n;
+    }
+    spr_thread_pool_run(ctx->threads, vcache_job, ctx, jobs);
+}
+
+/* Shared by the 16- and 32-bit entry points; exactly one of idx16/idx32 is
+   set. Triangles are drawn in index order, so the image matches
+   spr_draw_triangles() on the de-indexed vertices. The index scan and the
+   cache setup are done once for all instances. */
+static void draw_indexed(spr_context_t* ctx, int index_count, const uint16_t* idx16, const uint32_t* idx32, const void* vertices, size_t stride, int instance_count) {
+    const uint8_t* base = (const uint8_t*)vertices;
+    uint32_t lo = UINT32_MAX, hi = 0;
+    int count = index_count / 3;
+    int i, c, n = 0, cached, tiled, parallel, upfront;
+
+    if (!ctx || !ctx->current_vs || !ctx->rasterizer_func) return;
+    if (!ctx->current_fs && !ctx->current_fs_batch) return;
+    if (count <= 0 || instance_count <= 0) return;
+
+    /* The cache covers the index range this draw uses */
+    for (i = 0; i < count * 3; ++i) {
+        uint32_t v = idx16 ? idx16[i] : idx32[i];
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+    }
+    cached = hi - lo < (uint32_t)INT32_MAX && vcache_reserve(ctx, (int)(hi - lo + 1));
+    if (cached && ++ctx->vcache_draw == 0) {
+        /* Wrapped: make sure no slot's tag matches by accident */
+        memset(ctx->vcache_tag, 0, (size_t)ctx->vcache_capacity * sizeof(uint32_t));
+        ctx->vcache_draw = 1;
+    }
+
+    ctx->stats.total_triangles += (uint64_t)count * instance_count;
+    tiled = (ctx->rasterizer_mode == SPR_RASTERIZER_TILED) && tiled_prepare(ctx);
+
+    parallel = cached && geometry_prepare(ctx);
+    ctx->geometry_vertices = base;
+    ctx->geometry_stride = stride;
+    ctx->geometry_idx16 = idx16;
+    ctx->geometry_idx32 = idx32;
+    ctx->geometry_lo = lo;
+
+    /* Gather the distinct vertices in first-use order, to shade them up
+       front (once per instance) so triangle assembly only ever hits the
+       cache */
+    upfront = cached && (ctx->current_vs_batch || parallel || instance_count > 1);
+    if (upfront) {
+        for (i = 0; i < count * 3; ++i) {
+            uint32_t v = idx16 ? idx16[i] : idx32[i];
+            if (ctx->vcache_tag[v - lo] == ctx->vcache_draw) continue;
+            ctx->vcache_tag[v - lo] = ctx->vcache_draw;
+            ctx->vcache_pending[n++] = v;
+        }
+    }
+
+    for (ctx->instance_id = 0; ctx->instance_id < instance_count; ++ctx->instance_id) {
+        if (upfront) {
+            vcache_shade_pending(ctx, n, parallel);
+            ctx->stats.shaded_vertices += (uint64_t)n;
+        }
+        if (parallel) {
+            geometry_run(ctx, count, tiled);
+        } else {
+            for (i = 0; i < count; ++i) {
+                spr_vertex_out_t tri[3];
+                for (c = 0; c < 3; ++c) {
+                    uint32_t v = idx16 ? idx16[i * 3 + c] : idx32[i * 3 + c];
+                    if (!cached) {
+                        /* No room for the cache: shade every reference */
+                        shade_vertex(ctx, base + (size_t)v * stride, &tri[c]);
+                        ctx->stats.shaded_vertices++;
+                        continue;
+                    }
+                    if (ctx->vcache_tag[v - lo] != ctx->vcache_draw) {
+                        shade_vertex(ctx, base + (size_t)v * stride, &ctx->vcache[v - lo]);
+                        ctx->vcache_tag[v - lo] = ctx->vcache_draw;
+                        ctx->stats.shaded_vertices++;
+                    }
+                    tri[c] = ctx->vcache[v - lo];
                 }
-            } else if (v2_inside) {
-                float t = (epsilon - v1->position.w) / (v2->position.w - v1->position.w);
-                spr_vertex_interp(&clipped[clipped_count++], v1, v2, t);
-                clipped[clipped_count++] = *v2;
+                draw_shaded_triangle(ctx, tri, tiled);
             }
         }
-        
-        if (clipped_count < 3) continue;
-        
-        /* Transform and Draw */
-        for (int j = 0; j < clipped_count; ++j) {
-            spr_viewport_transform(ctx, &clipped[j]);
+    }
+    ctx->instance_id = 0;
+
+    if (tiled && !ctx->submitting) tiled_flush(ctx);
+    update_fragment_stats(ctx);
+}
+
+void spr_draw_indexed_triangles(spr_context_t* ctx, int index_count, const uint32_t* indices, const void* vertices, size_t stride) {
+    if (indices) draw_indexed(ctx, index_count, NULL, indices, vertices, stride, 1);
+}
+
+void spr_draw_indexed_triangles_instanced(spr_context_t* ctx, int index_count, const uint32_t* indices, const void* vertices, size_t stride, int instance_count) {
+    if (indices) draw_indexed(ctx, index_count, NULL, indices, vertices, stride, instance_count);
+}
+
+void spr_draw_indexed_triangles16(spr_context_t* ctx, int index_count, const uint16_t* indices, const void* vertices, size_t stride) {
+    if (indices) draw_indexed(ctx, index_count, indices, NULL, vertices, stride, 1);
+}
+
+/* --- Command Buffers --- */
+
+/* A pipeline as recorded: copied uniforms live in the buffer's uniform
+   bytes at uniform_offset, since that array may move while recording */
+typedef struct {
+    spr_pipeline_t state;
+    size_t uniform_offset;
+} spr_recorded_pipeline_t;
+
+typedef struct {
+    int pipeline;              /* Index into the buffer's pipelines */
+    int count;                 /* Triangles, or indices when indexed */
+    const void* vertices;
+    size_t stride;
+    const uint32_t* indices;   /* NULL: triangle soup */
+    int instance_count;
+} spr_command_t;
+
+struct spr_command_buffer_t {
+    spr_recorded_pipeline_t* pipelines;
+    int pipeline_count;
+    int pipeline_capacity;
+    spr_command_t* commands;
+    int command_count;
+    int command_capacity;
+    uint8_t* uniforms;         /* Copied uniform blocks, 16-byte aligned */
+    size_t uniform_bytes;
+    size_t uniform_capacity;
+};
+
+spr_command_buffer_t* spr_command_buffer_create(void) {
+    return (spr_command_buffer_t*)calloc(1, sizeof(spr_command_buffer_t));
+}
+
+void spr_command_buffer_destroy(spr_command_buffer_t* cb) {
+    if (!cb) return;
+    free(cb->pipelines);
+    free(cb->commands);
+    free(cb->uniforms);
+    free(cb);
+}
+
+void spr_command_buffer_reset(spr_command_buffer_t* cb) {
+    if (!cb) return;
+    cb->pipeline_count = 0;
+    cb->command_count = 0;
+    cb->uniform_bytes = 0;
+}
+
+/* Uniforms the recorded pipeline p runs with */
+static void* recorded_uniforms(const spr_command_buffer_t* cb, const spr_recorded_pipeline_t* p) {
+    return p->state.uniform_size ? (void*)(cb->uniforms + p->uniform_offset) : p->state.uniform_data;
+}
+
+/* Same state as the last recorded pipeline, uniform contents included */
+static int pipeline_matches_last(const spr_command_buffer_t* cb, const spr_pipeline_t* p) {
+    const spr_recorded_pipeline_t* last;
+    if (cb->pipeline_count == 0) return 0;
+    last = &cb->pipelines[cb->pipeline_count - 1];
+    if (last->state.vs != p->vs || last->state.vs_batch != p->vs_batch) return 0;
+    if (last->state.fs != p->fs || last->state.fs_batch != p->fs_batch) return 0;
+    if (last->state.varyings != p->varyings || last->state.cull_backface != p->cull_backface) return 0;
+    if (last->state.sort_key != p->sort_key || last->state.uniform_size != p->uniform_size) return 0;
+    if (!p->uniform_size) return last->state.uniform_data == p->uniform_data;
+    return memcmp(cb->uniforms + last->uniform_offset, p->uniform_data, p->uniform_size) == 0;
+}
+
+/* Index of the recorded copy of p, adding one unless it matches the last
+   pipeline. Returns -1 if memory runs out. */
+static int record_pipeline(spr_command_buffer_t* cb, const spr_pipeline_t* p) {
+    spr_recorded_pipeline_t* rec;
+    size_t offset = (cb->uniform_bytes + 15) & ~(size_t)15;
+
+    if (pipeline_matches_last(cb, p)) return cb->pipeline_count - 1;
+    if (cb->pipeline_count == cb->pipeline_capacity) {
+        int cap = cb->pipeline_capacity ? cb->pipeline_capacity * 2 : 16;
+        spr_recorded_pipeline_t* pipelines = (spr_recorded_pipeline_t*)realloc(cb->pipelines, cap * sizeof(spr_recorded_pipeline_t));
+        if (!pipelines) return -1;
+        cb->pipelines = pipelines;
+        cb->pipeline_capacity = cap;
+    }
+    if (p->uniform_size && offset + p->uniform_size > cb->uniform_capacity) {
+        size_t cap = cb->uniform_capacity ? cb->uniform_capacity * 2 : 4096;
+        uint8_t* bytes;
+        while (cap < offset + p->uniform_size) cap *= 2;
+        bytes = (uint8_t*)realloc(cb->uniforms, cap);
+        if (!bytes) return -1;
+        cb->uniforms = bytes;
+        cb->uniform_capacity = cap;
+    }
+
+    rec = &cb->pipelines[cb->pipeline_count];
+    rec->state = *p;
+    rec->uniform_offset = 0;
+    if (p->uniform_size) {
+        memcpy(cb->uniforms + offset, p->uniform_data, p->uniform_size);
+        rec->state.uniform_data = NULL;
+        rec->uniform_offset = offset;
+        cb->uniform_bytes = offset + p->uniform_size;
+    }
+    return cb->pipeline_count++;
+}
+
+static int record_draw(spr_command_buffer_t* cb, const spr_pipeline_t* pipeline, int count, const uint32_t* indices, const void* vertices, size_t stride, int instance_count) {
+    spr_command_t* cmd;
+    int p;
+
+    if (!cb || !pipeline || !vertices || count <= 0 || instance_count <= 0) return 0;
+    if (!pipeline->vs || (!pipeline->fs && !pipeline->fs_batch)) return 0;
+    if (pipeline->uniform_size && !pipeline->uniform_data) return 0;
+
+    if (cb->command_count == cb->command_capacity) {
+        int cap = cb->command_capacity ? cb->command_capacity * 2 : 64;
+        spr_command_t* commands = (spr_command_t*)realloc(cb->commands, cap * sizeof(spr_command_t));
+        if (!commands) return 0;
+        cb->commands = commands;
+        cb->command_capacity = cap;
+    }
+    p = record_pipeline(cb, pipeline);
+    if (p < 0) return 0;
+
+    cmd = &cb->commands[cb->command_count++];
+    cmd->pipeline = p;
+    cmd->count = count;
+    cmd->vertices = vertices;
+    cmd->stride = stride;
+    cmd->indices = indices;
+    cmd->instance_count = instance_count;
+    return 1;
+}
+
+int spr_cmd_draw_triangles(spr_command_buffer_t* cb, const spr_pipeline_t* pipeline, int count, const void* vertices, size_t stride, int instance_count) {
+    return record_draw(cb, pipeline, count, NULL, vertices, stride, instance_count);
+}
+
+int spr_cmd_draw_indexed_triangles(spr_command_buffer_t* cb, const spr_pipeline_t* pipeline, int index_count, const uint32_t* indices, const void* vertices, size_t stride, int instance_count) {
+    if (!indices) return 0;
+    return record_draw(cb, pipeline, index_count, indices, vertices, stride, instance_count);
+}
+
+/* Sort key first, then submission order, so equal keys keep their order */
+static int compare_submit_refs(const void* a, const void* b) {
+    const spr_submit_ref_t* ra = (const spr_submit_ref_t*)a;
+    const spr_submit_ref_t* rb = (const spr_submit_ref_t*)b;
+    if (ra->key != rb->key) return ra->key < rb->key ? -1 : 1;
+    if (ra->buffer != rb->buffer) return ra->buffer < rb->buffer ? -1 : 1;
+    return ra->command < rb->command ? -1 : ra->command > rb->command;
+}
+
+/* Makes a recorded pipeline the context's current draw state */
+static void bind_pipeline(spr_context_t* ctx, const spr_command_buffer_t* cb, const spr_recorded_pipeline_t* p) {
+    ctx->current_vs = p->state.vs;
+    ctx->current_vs_batch = p->state.vs_batch;
+    ctx->current_fs = p->state.fs;
+    ctx->current_fs_batch = p->state.fs_batch;
+    ctx->current_uniforms = recorded_uniforms(cb, p);
+    ctx->varyings = p->state.varyings ? (p->state.varyings & SPR_VARYING_ALL) : SPR_VARYING_ALL;
+    ctx->shade_pixel = select_shade_pixel(ctx);
+    ctx->cull_backface = p->state.cull_backface;
+}
+
+void spr_submit(spr_context_t* ctx, spr_command_buffer_t* const* buffers, int count, unsigned int flags) {
+    spr_vertex_shader_t vs;
+    spr_vertex_shader_batch_t vs_batch;
+    spr_fragment_shader_t fs;
+    spr_fragment_shader_batch_t fs_batch;
+    void* uniforms;
+    unsigned int varyings;
+    int cull_backface;
+    const spr_recorded_pipeline_t* bound = NULL;
+    int total = 0, n = 0, b, i;
+
+    if (!ctx || !buffers || count <= 0) return;
+    for (b = 0; b < count; ++b) if (buffers[b]) total += buffers[b]->command_count;
+    if (total == 0) return;
+
+    if (total > ctx->submit_ref_capacity) {
+        spr_submit_ref_t* refs = (spr_submit_ref_t*)realloc(ctx->submit_refs, total * sizeof(spr_submit_ref_t));
+        if (!refs) return;
+        ctx->submit_refs = refs;
+        ctx->submit_ref_capacity = total;
+    }
+    for (b = 0; b < count; ++b) {
+        const spr_command_buffer_t* cb = buffers[b];
+        if (!cb) continue;
+        for (i = 0; i < cb->command_count; ++i) {
+            spr_submit_ref_t* ref = &ctx->submit_refs[n++];
+            ref->key = (flags & SPR_SUBMIT_SORTED) ? cb->pipelines[cb->commands[i].pipeline].state.sort_key : 0;
+            ref->buffer = b;
+            ref->command = i;
         }
-        
-        ctx->rasterizer_func(ctx, &clipped[0], &clipped[1], &clipped[2]);
-        if (clipped_count == 4) {
-            ctx->rasterizer_func(ctx, &clipped[0], &clipped[2], &clipped[3]);
+    }
+    if (flags & SPR_SUBMIT_SORTED) qsort(ctx->submit_refs, n, sizeof(spr_submit_ref_t), compare_submit_refs);
+
+    /* Immediate-mode state, restored at the end */
+    vs = ctx->current_vs;
+    vs_batch = ctx->current_vs_batch;
+    fs = ctx->current_fs;
+    fs_batch = ctx->current_fs_batch;
+    uniforms = ctx->current_uniforms;
+    varyings = ctx->varyings;
+    cull_backface = ctx->cull_backface;
+
+    /* Binned triangles are shaded with the state current at the flush, so
+       the bins are drained whenever the pipeline changes */
+    ctx->submitting = 1;
+    for (i = 0; i < n; ++i) {
+        const spr_command_buffer_t* cb = buffers[ctx->submit_refs[i].buffer];
+        const spr_command_t* cmd = &cb->commands[ctx->submit_refs[i].command];
+        const spr_recorded_pipeline_t* p = &cb->pipelines[cmd->pipeline];
+        if (p != bound) {
+            tiled_flush(ctx);
+            bind_pipeline(ctx, cb, p);
+            bound = p;
+        }
+        if (cmd->indices) {
+            draw_indexed(ctx, cmd->count, NULL, cmd->indices, cmd->vertices, cmd->stride, cmd->instance_count);
+        } else {
+            spr_draw_triangles_instanced(ctx, cmd->count, cmd->vertices, cmd->stride, cmd->instance_count);
         }
     }
+    tiled_flush(ctx);
+    ctx->submitting = 0;
+
+    ctx->current_vs = vs;
+    ctx->current_vs_batch = vs_batch;
+    ctx->current_fs = fs;
+    ctx->current_fs_batch = fs_batch;
+    ctx->current_uniforms = uniforms;
+    ctx->varyings = varyings;
+    ctx->shade_pixel = select_shade_pixel(ctx);
+    ctx->cull_backface = cull_backface;
+    update_fragment_stats(ctx);
 }
 
 /* --- Resolve --- */
 
-void spr_resolve(spr_context_t* ctx) {
-    if (!ctx) return;
-    int count = ctx->fb.width * ctx->fb.height;
-    int i;
+/* Front-to-Back: C_dst = C_dst + (1 - A_dst) * C_src
+                 A_dst = A_dst + (1 - A_dst) * A_src
+   Returns 1 once the pixel is fully opaque. */
+static int composite_layer(vec3_t* acc_color, vec3_t* acc_opacity, vec3_t color, vec3_t opacity) {
+    float inv_op_r = 1.0f - acc_opacity->x;
+    float inv_op_g = 1.0f - acc_opacity->y;
+    float inv_op_b = 1.0f - acc_opacity->z;
     
-    for (i = 0; i < count; ++i) {
-        spr_fragment_t* head = ctx->fragment_heads[i];
-        if (!head) continue; /* Keep background */
-        
-        /* List is already sorted Near-to-Far (Ascending Z) by insert_fragment */
-        
-        /* Extract Background from buffer */
-        uint32_t bg_packed = ctx->fb.color_buffer[i];
-        float bg_r = (bg_packed & 0xFF) / 255.0f;
-        float bg_g = ((bg_packed >> 8) & 0xFF) / 255.0f;
-        float bg_b = ((bg_packed >> 16) & 0xFF) / 255.0f;
-        
-        /* Front-to-Back Accumulation */
-        /* acc_color: Accumulated color of the layers */
-        /* acc_opacity: Accumulated opacity of the layers */
-        vec3_t acc_color = {0.0f, 0.0f, 0.0f};
-        vec3_t acc_opacity = {0.0f, 0.0f, 0.0f};
-        
-        spr_fragment_t* curr = head;
-        while (curr) {
-            /* Front-to-Back: */
-            /* C_dst = C_dst + (1 - A_dst) * C_src */
-            /* A_dst = A_dst + (1 - A_dst) * A_src */
-            
-            float inv_op_r = 1.0f - acc_opacity.x;
-            float inv_op_g = 1.0f - acc_opacity.y;
-            float inv_op_b = 1.0f - acc_opacity.z;
-            
-            acc_color.x += inv_op_r * curr->color.x;
-            acc_color.y += inv_op_g * curr->color.y;
-            acc_color.z += inv_op_b * curr->color.z;
-            
-            acc_opacity.x += inv_op_r * curr->opacity.x;
-            acc_opacity.y += inv_op_g * curr->opacity.y;
-            acc_opacity.z += inv_op_b * curr->opacity.z;
-            
-            /* Early Exit if fully opaque */
-            if (spr_min3(acc_opacity.x, acc_opacity.y, acc_opacity.z) > SPR_OPACITY_THRESHOLD) {
-                break;
+    acc_color->x += inv_op_r * color.x;
+    acc_color->y += inv_op_g * color.y;
+    acc_color->z += inv_op_b * color.z;
+    
+    acc_opacity->x += inv_op_r * opacity.x;
+    acc_opacity->y += inv_op_g * opacity.y;
+    acc_opacity->z += inv_op_b * opacity.z;
+    
+    return spr_min3(acc_opacity->x, acc_opacity->y, acc_opacity->z) > SPR_OPACITY_THRESHOLD;
+}
+
+/* Append storage: gathers the pixel's unsorted list into the scratch array
+   and sorts it Near-to-Far. Insertion sort is stable, so z ties keep the
+   list's newest-first order, exactly as list_insert() would have placed them.
+   Growth is counted in 'pool'. Returns the fragment count, or -1 if the
+   scratch array cannot grow. */
+static int gather_sorted(spr_sort_scratch_t* scratch, spr_fragment_pool_t* pool, spr_fragment_t* head) {
+    spr_fragment_t** frags = scratch->frags;
+    int n = 0, i, j;
+
+    for (; head; head = head->next) {
+        if (n == scratch->capacity) {
+            int cap = scratch->capacity ? scratch->capacity * 2 : 64;
+            frags = (spr_fragment_t**)realloc(scratch->frags, cap * sizeof(spr_fragment_t*));
+            pool->heap_allocations++;
+            if (!frags) return -1;
+            scratch->frags = frags;
+            scratch->capacity = cap;
+        }
+        frags[n++] = head;
+    }
+
+    for (i = 1; i < n; ++i) {
+        spr_fragment_t* f = frags[i];
+        for (j = i; j > 0 && frags[j - 1]->z > f->z; --j) frags[j] = frags[j - 1];
+        frags[j] = f;
+    }
+    return n;
+}
+
+/* Pixels resolved per batch: one row of an 8x8 block, which is contiguous
+   in either layout */
+#define SPR_RESOLVE_BATCH 8
+
+/* Layers accumulated for a batch of pixels, kept as structure-of-arrays for
+   the final blend with the background */
+typedef struct {
+    float color[3][SPR_RESOLVE_BATCH];
+    float opacity[3][SPR_RESOLVE_BATCH];
+    int32_t keep[SPR_RESOLVE_BATCH]; /* -1: no fragments, keep the background */
+} spr_resolve_batch_t;
+
+/* 1 if none of n consecutive pixels has a fragment. No branches per pixel,
+   so the loops compile to a few wide ORs. */
+static int pixels_empty(const spr_context_t* ctx, int i, int n) {
+    uintptr_t any = 0;
+    int k;
+    for (k = 0; k < n; ++k) any |= (uintptr_t)ctx->fragment_heads[i + k];
+    switch (ctx->storage) {
+        case SPR_FRAGMENT_STORAGE_KBUFFER:
+            for (k = 0; k < n; ++k) any |= ctx->kcount[i + k];
+            break;
+        case SPR_FRAGMENT_STORAGE_COUNTED:
+            for (k = 0; k < n; ++k) any |= ctx->frag_cursor[i + k] ^ ctx->frag_offset[i + k];
+            break;
+        case SPR_FRAGMENT_STORAGE_COMPACT:
+            for (k = 0; k < n; ++k) any |= ~ctx->cfrag_heads[i + k];
+            break;
+        default:
+            break;
+    }
+    return !any;
+}
+
+static void set_batch_pixel(spr_resolve_batch_t* b, int k, vec3_t color, vec3_t opacity) {
+    b->color[0][k] = color.x;
+    b->color[1][k] = color.y;
+    b->color[2][k] = color.z;
+    b->opacity[0][k] = opacity.x;
+    b->opacity[1][k] = opacity.y;
+    b->opacity[2][k] = opacity.z;
+    b->keep[k] = 0;
+}
+
+/* A fully opaque nearest layer is the whole result: compositing it over
+   nothing gives its own colour and opacity */
+static int opaque_first_layer(float z, vec3_t opacity, float opaque_z) {
+    return z <= opaque_z && spr_min3(opacity.x, opacity.y, opacity.z) > SPR_OPACITY_THRESHOLD;
+}
+
+/* Composites the layers of pixel i front to back into slot k of the batch */
+static void resolve_pixel(spr_context_t* ctx, spr_sort_scratch_t* scratch, spr_fragment_pool_t* pool, int i, spr_resolve_batch_t* batch, int k_out) {
+    int kbuffer = ctx->storage == SPR_FRAGMENT_STORAGE_KBUFFER;
+    int append = ctx->storage == SPR_FRAGMENT_STORAGE_APPEND;
+    int counted = ctx->storage == SPR_FRAGMENT_STORAGE_COUNTED;
+    int compact = ctx->storage == SPR_FRAGMENT_STORAGE_COMPACT;
+    spr_fragment_t* head = ctx->fragment_heads[i];
+    int slots = kbuffer ? ctx->kcount[i] : 0;
+    spr_kslot_t* slice = counted && ctx->frag_array ? &ctx->frag_array[ctx->frag_offset[i]] : NULL;
+    uint32_t chead = compact ? ctx->cfrag_heads[i] : SPR_CFRAG_NIL;
+    if (counted) slots = (int)(ctx->frag_cursor[i] - ctx->frag_offset[i]);
+    if (!head && !slots && chead == SPR_CFRAG_NIL) {
+        batch->keep[k_out] = -1;
+        return;
+    }
+
+    /* Layers are already sorted Near-to-Far (Ascending Z) by insert_fragment,
+       except in append and counted mode, where they are sorted below */
+
+    /* Front-to-Back Accumulation */
+    /* acc_color: Accumulated color of the layers */
+    /* acc_opacity: Accumulated opacity of the layers */
+    vec3_t acc_color = {0.0f, 0.0f, 0.0f};
+    vec3_t acc_opacity = {0.0f, 0.0f, 0.0f};
+    int done = 0;
+    int k;
+
+    /* Hybrid mode: fragments behind the opaque surface are hidden by it */
+    float opaque_z = ctx->opaque_zbuffer ? ctx->fb.depth_buffer[i] : INFINITY;
+
+    /* Fast path: a sorted list or k-buffer whose nearest layer is opaque */
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_LIST && head && opaque_first_layer(head->z, head->opacity, opaque_z)) {
+        set_batch_pixel(batch, k_out, head->color, head->opacity);
+        return;
+    }
+    const spr_kslot_t* slot = kbuffer ? &ctx->kbuffer[(size_t)i * SPR_KBUFFER_K] : slice;
+    if (kbuffer && slots && opaque_first_layer(slot[0].z, slot[0].opacity, opaque_z)) {
+        set_batch_pixel(batch, k_out, slot[0].color, slot[0].opacity);
+        return;
+    }
+
+    /* Counted mode: the slice is in submission order. Sort it in place,
+       later fragments first on z ties like list_insert(); it then
+       composites like k-buffer slots (there is no list). */
+    if (counted) {
+        int j;
+        for (k = 1; k < slots; ++k) {
+            spr_kslot_t f = slice[k];
+            for (j = k; j > 0 && slice[j - 1].z >= f.z; --j) slice[j] = slice[j - 1];
+            slice[j] = f;
+        }
+    }
+
+    /* K-buffer slots first: a linear scan of one contiguous array */
+    for (k = 0; k < slots; ++k) {
+        if (slot[k].z > opaque_z || composite_layer(&acc_color, &acc_opacity, slot[k].color, slot[k].opacity)) {
+            done = 1;
+            break;
+        }
+    }
+
+    /* Compact mode: decode the packed nodes. Depth is compared encoded. */
+    if (compact) {
+        uint32_t opaque_depth = encode_depth(opaque_z);
+        uint32_t node;
+        for (node = chead; node != SPR_CFRAG_NIL; node = cfrag(ctx, node)->next) {
+            const spr_cfrag_t* f = cfrag(ctx, node);
+            if ((f->depth_opacity >> 8) > opaque_depth) break;
+            if (composite_layer(&acc_color, &acc_opacity, decode_color(f), decode_opacity(f))) break;
+        }
+    }
+
+    /* Append mode: sort the gathered list, then composite front to back.
+       Nothing was culled on insert; occlusion ends the loop here instead. */
+    if (append) {
+        int n = gather_sorted(scratch, pool, head);
+        for (k = 0; k < n && scratch->frags[k]->z <= opaque_z; ++k) {
+            if (composite_layer(&acc_color, &acc_opacity, scratch->frags[k]->color, scratch->frags[k]->opacity)) break;
+        }
+        done = 1;
+    }
+
+    /* Then the list (all of it in list mode, the overflow otherwise) */
+    spr_fragment_t* curr = done ? NULL : head;
+    while (curr && curr->z <= opaque_z) {
+        /* Early Exit if fully opaque */
+        if (composite_layer(&acc_color, &acc_opacity, curr->color, curr->opacity)) break;
+        curr = curr->next;
+    }
+
+    set_batch_pixel(batch, k_out, acc_color, acc_opacity);
+}
+
+/* Final = AccColor + Background * (1 - AccOpacity), packed into the linear
+   colour buffer; pixels without fragments keep their background. The SSE2
+   path unpacks with a true divide and packs with truncation, so it rounds
+   exactly like the scalar tail (and pack_color). */
+static void resolve_batch(spr_context_t* ctx, int i, int out, int n, const spr_resolve_batch_t* b) {
+    const uint32_t* bg = &ctx->color[i];
+    uint32_t* dst = &ctx->fb.color_buffer[out];
+    int k = 0;
+
+#if defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128i byte = _mm_set1_epi32(0xFF);
+    for (; k + 4 <= n; k += 4) {
+        __m128i packed_bg = _mm_loadu_si128((const __m128i*)&bg[k]);
+        __m128i keep = _mm_loadu_si128((const __m128i*)&b->keep[k]);
+        __m128i rgb = _mm_set1_epi32((int)0xFF000000u);
+        int c;
+        for (c = 0; c < 3; ++c) {
+            __m128 bg_c = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed_bg, 8 * c), byte)), scale);
+            __m128 transmit = _mm_sub_ps(one, _mm_loadu_ps(&b->opacity[c][k]));
+            __m128 final_c = _mm_add_ps(_mm_loadu_ps(&b->color[c][k]), _mm_mul_ps(bg_c, transmit));
+            __m128i v = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(final_c, one), scale));
+            rgb = _mm_or_si128(rgb, _mm_slli_epi32(_mm_and_si128(v, byte), 8 * c));
+        }
+        _mm_storeu_si128((__m128i*)&dst[k], _mm_or_si128(_mm_and_si128(keep, packed_bg), _mm_andnot_si128(keep, rgb)));
+    }
+#endif
+
+    for (; k < n; ++k) {
+        float bg_r, bg_g, bg_b;
+        if (b->keep[k]) {
+            dst[k] = bg[k];
+            continue;
+        }
+        bg_r = (bg[k] & 0xFF) / 255.0f;
+        bg_g = ((bg[k] >> 8) & 0xFF) / 255.0f;
+        bg_b = ((bg[k] >> 16) & 0xFF) / 255.0f;
+        dst[k] = pack_color(b->color[0][k] + bg_r * (1.0f - b->opacity[0][k]),
+                            b->color[1][k] + bg_g * (1.0f - b->opacity[1][k]),
+                            b->color[2][k] + bg_b * (1.0f - b->opacity[2][k]));
+    }
+}
+
+/* Composites the fragments of one tile over its colour, into the linear
+   colour buffer, a batch of pixels at a time. Tiles share no state but the
+   scratch array and pool passed in, so any number can run at once. */
+static void resolve_tile(spr_context_t* ctx, spr_sort_scratch_t* scratch, spr_fragment_pool_t* pool, int tile) {
+    spr_resolve_batch_t batch;
+    int x0, y0, x1, y1, x, y, k;
+
+    tile_bounds(ctx, tile, &x0, &y0, &x1, &y1);
+    for (y = y0; y < y1; ++y) {
+        for (x = x0; x < x1; x += SPR_RESOLVE_BATCH) {
+            int n = x1 - x < SPR_RESOLVE_BATCH ? x1 - x : SPR_RESOLVE_BATCH;
+            int i = pixel_index(ctx, x, y);
+            int out = y * ctx->fb.width + x;
+
+            /* Fast path: background or hybrid opaque colour only */
+            if (pixels_empty(ctx, i, n)) {
+                if (ctx->tiled_layout) memcpy(&ctx->fb.color_buffer[out], &ctx->color[i], n * sizeof(uint32_t));
+                continue;
             }
-            
-            curr = curr->next;
+            for (k = 0; k < n; ++k) resolve_pixel(ctx, scratch, pool, i + k, &batch, k);
+            resolve_batch(ctx, i, out, n, &batch);
         }
-        
-        /* Composite with Background */
-        /* Final = AccColor + Background * (1 - AccOpacity) */
-        float final_r = acc_color.x + bg_r * (1.0f - acc_opacity.x);
-        float final_g = acc_color.y + bg_g * (1.0f - acc_opacity.y);
-        float final_b = acc_color.z + bg_b * (1.0f - acc_opacity.z);
-        
-        /* Clamp */
-        if (final_r > 1.0f) final_r = 1.0f;
-        if (final_g > 1.0f) final_g = 1.0f;
-        if (final_b > 1.0f) final_b = 1.0f;
-        
-        ctx->fb.color_buffer[i] = spr_make_color(
-            (uint8_t)(final_r * 255.0f),
-            (uint8_t)(final_g * 255.0f),
-            (uint8_t)(final_b * 255.0f),
-            255
-        );
     }
 }
+
+/* Tiles nothing was drawn to since the clear just get the clear colour */
+static void resolve_or_clear_tile(spr_context_t* ctx, spr_sort_scratch_t* scratch, spr_fragment_pool_t* pool, int tile) {
+    if (!tile_stale(ctx, tile)) {
+        resolve_tile(ctx, scratch, pool, tile);
+    } else if (ctx->color_pending) {
+        clear_tile_color(ctx, tile);
+    }
+}
+
+/* One job per tile. Every pixel is resolved by exactly the same code as in
+   the serial loop, so the image does not depend on the thread count. */
+static void resolve_job(void* user_data, int job_index, int worker_index) {
+    spr_context_t* ctx = (spr_context_t*)user_data;
+    resolve_or_clear_tile(ctx, &ctx->worker_scratch[worker_index], &ctx->worker_pools[worker_index], job_index);
+}
+
+void spr_resolve(spr_context_t* ctx) {
+    int t, tiles;
+    if (!ctx) return;
+
+    /* Still counting: nothing has been written yet */
+    if (ctx->storage == SPR_FRAGMENT_STORAGE_COUNTED && ctx->counting) return;
+
+    tiles = ctx->tiles_x * ctx->tiles_y;
+    if (ctx->parallel_resolve && threads_prepare(ctx) && spr_thread_pool_size(ctx->threads) > 1) {
+        spr_thread_pool_run(ctx->threads, resolve_job, ctx, tiles);
+    } else {
+        for (t = 0; t < tiles; ++t) resolve_or_clear_tile(ctx, &ctx->sort_scratch, &ctx->pool, t);
+    }
+    ctx->color_pending = 0;
+    update_fragment_stats(ctx); /* Sort scratch growth */
+}
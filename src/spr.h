@@ -33,6 +33,7 @@ typedef struct {
     vec4_t tangent; /* Tangent vector (xyz) + handedness (w) */
     vec3_t barycentric; /* Barycentric coordinates (alpha, beta, gamma) */
     float depth; 
+    int instance_id; /* Set before the vertex shader runs: the instance being drawn (0 outside instanced draws) */
 } spr_vertex_out_t;
 
 /* Standard Textured Vertex Input (for OBJ/etc) */
@@ -52,11 +53,42 @@ typedef struct {
 typedef void (*spr_vertex_shader_t)(void* uniform_data, const void* vertex_in, spr_vertex_out_t* out);
 typedef spr_fs_output_t (*spr_fragment_shader_t)(void* uniform_data, const spr_vertex_out_t* interpolated);
 
+/* Batched fragment shading */
+#define SPR_FS_BATCH 8 /* Fragments per batch call (a multiple of 4) */
+
+/* Interpolated fragments in structure-of-arrays form, one lane per pixel.
+   Lane i is live when bit i of 'mask' is set; dead lanes hold stale but
+   finite values, may be computed on, and their outputs are ignored. */
+typedef struct {
+    unsigned int mask;
+    float position_x[SPR_FS_BATCH], position_y[SPR_FS_BATCH], position_z[SPR_FS_BATCH], position_w[SPR_FS_BATCH];
+    float color_r[SPR_FS_BATCH], color_g[SPR_FS_BATCH], color_b[SPR_FS_BATCH], color_a[SPR_FS_BATCH];
+    float uv_x[SPR_FS_BATCH], uv_y[SPR_FS_BATCH];
+    float normal_x[SPR_FS_BATCH], normal_y[SPR_FS_BATCH], normal_z[SPR_FS_BATCH];
+    float tangent_x[SPR_FS_BATCH], tangent_y[SPR_FS_BATCH], tangent_z[SPR_FS_BATCH], tangent_w[SPR_FS_BATCH];
+    float barycentric_x[SPR_FS_BATCH], barycentric_y[SPR_FS_BATCH], barycentric_z[SPR_FS_BATCH];
+} spr_fs_batch_t;
+
+typedef struct {
+    float color_r[SPR_FS_BATCH], color_g[SPR_FS_BATCH], color_b[SPR_FS_BATCH];       /* Premultiplied */
+    float opacity_r[SPR_FS_BATCH], opacity_g[SPR_FS_BATCH], opacity_b[SPR_FS_BATCH];
+} spr_fs_batch_output_t;
+
+typedef void (*spr_fragment_shader_batch_t)(void* uniform_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out);
+
+/* Batched vertex shading */
+#define SPR_VS_BATCH 96 /* Vertices shaded per batch call (a multiple of 3) */
+
+/* Shades 'count' vertices in one call. Input k is read from
+   vertices + indices[k] * stride, or vertices + k * stride when 'indices' is
+   NULL; its result goes to out[k]. */
+typedef void (*spr_vertex_shader_batch_t)(void* uniform_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+
 typedef struct {
     int width;
     int height;
     uint32_t* color_buffer; /* RGBA packed: 0xAABBGGRR (little endian) or R, G, B, A bytes */
-    float* depth_buffer;
+    float* depth_buffer;    /* NDC z, only allocated in hybrid z-buffer mode */
 } spr_framebuffer_t;
 
 typedef struct spr_context_t spr_context_t; /* Opaque context handle */
@@ -69,6 +101,9 @@ void spr_shutdown(spr_context_t* ctx);
 
 /* Framebuffer Management */
 /* Color is 0xAABBGGRR */
+/* The clear is lazy: each 64x64 tile is stamped with a generation and only
+   cleared when a triangle first reaches it; tiles nothing draws to just get
+   the colour, in spr_resolve() or spr_get_color_buffer(). */
 void spr_clear(spr_context_t* ctx, uint32_t color, float depth);
 uint32_t* spr_get_color_buffer(spr_context_t* ctx);
 int spr_get_width(spr_context_t* ctx);
@@ -95,22 +130,222 @@ mat4_t spr_get_projection_matrix(spr_context_t* ctx);
 /* Shaders */
 void spr_set_program(spr_context_t* ctx, spr_vertex_shader_t vs, spr_fragment_shader_t fs, void* uniform_data);
 
+/* Optional batch version of the current fragment shader. While set, every
+   rasterizer collects covered pixels into spans of SPR_FS_BATCH and shades
+   them with one call. spr_set_program() clears it, so set it afterwards. */
+void spr_set_fragment_shader_batch(spr_context_t* ctx, spr_fragment_shader_batch_t fs_batch);
+
+/* Optional batch version of the current vertex shader. While set, draws
+   shade their vertices SPR_VS_BATCH at a time into a buffer that triangle
+   assembly reads; indexed draws batch the vertices missing from the cache.
+   spr_set_program() clears it, so set it afterwards. */
+void spr_set_vertex_shader_batch(spr_context_t* ctx, spr_vertex_shader_batch_t vs_batch);
+
+/* Varyings: the interpolated attributes the fragment shader reads */
+typedef enum {
+    SPR_VARYING_COLOR       = 1 << 0,
+    SPR_VARYING_UV          = 1 << 1,
+    SPR_VARYING_NORMAL      = 1 << 2,
+    SPR_VARYING_TANGENT     = 1 << 3,
+    SPR_VARYING_BARYCENTRIC = 1 << 4,
+    SPR_VARYING_ALL         = 0x1F
+} spr_varying_t;
+
+/* Declares which varyings the current program uses (OR of SPR_VARYING_*).
+   Only those are interpolated per pixel and across clipped edges; the others
+   reach the fragment shader as zero. Position is always interpolated.
+   spr_set_program() resets the set to SPR_VARYING_ALL, so declare afterwards. */
+void spr_set_varyings(spr_context_t* ctx, unsigned int varyings);
+
 typedef enum {
     SPR_RASTERIZER_CPU,
-    SPR_RASTERIZER_SIMD
+    SPR_RASTERIZER_SIMD,   /* Widest kernel the CPU supports (SSE2, AVX2 or AVX-512) */
+    SPR_RASTERIZER_TILED,  /* Screen tiles rasterized on a worker pool; output matches CPU */
+    SPR_RASTERIZER_AVX2,   /* 8-wide kernel */
+    SPR_RASTERIZER_AVX512  /* 16-wide kernel */
 } spr_rasterizer_mode_t;
 
-void spr_set_rasterizer_mode(spr_context_t* ctx, spr_rasterizer_mode_t mode);
+/* The AVX kernels are chosen at runtime (cpuid, checked in spr_init), so a
+   single x86 build uses AVX-512 or AVX2 where present. Requesting a kernel
+   the CPU lacks falls back to the widest available one. Every kernel
+   produces the same image; spr_stats_t reports which one is active. */
+
+/* Returns the kernel now in use (SPR_RASTERIZER_CPU when SIMD is requested
+   on a CPU without it), so callers can report a fallback */
+spr_rasterizer_mode_t spr_set_rasterizer_mode(spr_context_t* ctx, spr_rasterizer_mode_t mode);
+
+/* Worker threads used by SPR_RASTERIZER_TILED (0 = one per CPU, the default).
+   Needs a build with -DSPR_ENABLE_THREADS, otherwise tiles run on the caller. */
+void spr_set_thread_count(spr_context_t* ctx, int count);
+
+/* Runs spr_resolve() on the same worker pool, one screen tile per job, with
+   any rasterizer mode. Pixels are independent, so the image is identical to
+   the serial resolve. Off by default. */
+void spr_enable_parallel_resolve(spr_context_t* ctx, int enable);
+
+/* Runs each draw's geometry front end (vertex shading, clipping, viewport
+   transform and culling) on the same worker pool, over contiguous triangle
+   ranges, with any rasterizer mode. Triangles still reach the raster stage
+   in submission order, so the image is identical to the serial front end.
+   Vertex shaders then run concurrently and must only read their inputs and
+   uniforms. Every 1024 triangles cost a fork-join round and binning stays
+   on the caller, so this only wins when vertex shading dominates; with the
+   built-in shaders it is slower. Off by default. */
+void spr_enable_parallel_geometry(spr_context_t* ctx, int enable);
 
 /* Drawing */
 void spr_draw_triangles(spr_context_t* ctx, int count, const void* vertices, size_t stride);
 
+/* Indexed drawing: index_count / 3 triangles whose corners are
+   vertices[indices[k]]. Each distinct vertex is shaded once per call and
+   the transformed result reused (a post-transform cache sized to the
+   call's index range, kept by the context). The image is the one
+   spr_draw_triangles() gives for the same triangles. */
+void spr_draw_indexed_triangles(spr_context_t* ctx, int index_count, const uint32_t* indices, const void* vertices, size_t stride);
+void spr_draw_indexed_triangles16(spr_context_t* ctx, int index_count, const uint16_t* indices, const void* vertices, size_t stride);
+
+/* Instanced drawing: the same triangles instance_count times, in instance
+   order, with the per-draw work (state checks, binning setup, the index
+   scan) done once. Vertex shaders see the copy they shade in
+   out->instance_id and read its data from their uniforms; the built-in
+   shaders take an array of spr_shader_instance_t. The image matches
+   instance_count separate draws. */
+void spr_draw_triangles_instanced(spr_context_t* ctx, int count, const void* vertices, size_t stride, int instance_count);
+void spr_draw_indexed_triangles_instanced(spr_context_t* ctx, int index_count, const uint32_t* indices, const void* vertices, size_t stride, int instance_count);
+
+/* Command Buffers */
+/* The draw state a recorded command runs with, captured when it is
+   recorded. With uniform_size > 0 the uniform block is copied (shallowly:
+   textures, instance arrays and the like must stay valid until the buffer
+   is submitted); with 0 the uniform_data pointer itself is kept. */
+typedef struct {
+    spr_vertex_shader_t vs;
+    spr_vertex_shader_batch_t vs_batch;   /* Optional, see spr_set_vertex_shader_batch() */
+    spr_fragment_shader_t fs;
+    spr_fragment_shader_batch_t fs_batch; /* Optional, see spr_set_fragment_shader_batch() */
+    void* uniform_data;
+    size_t uniform_size;
+    unsigned int varyings;                /* SPR_VARYING_*, 0 = SPR_VARYING_ALL */
+    int cull_backface;
+    uint32_t sort_key;                    /* Lowest first under SPR_SUBMIT_SORTED */
+} spr_pipeline_t;
+
+/* A list of draws recorded against pipelines, replayed by spr_submit().
+   Recording touches no context, so each thread can fill its own buffer
+   concurrently. Vertex and index arrays are referenced, not copied, and
+   must stay valid until submission. A buffer can be submitted any number
+   of times; reset keeps its memory for the next frame. */
+typedef struct spr_command_buffer_t spr_command_buffer_t;
+
+spr_command_buffer_t* spr_command_buffer_create(void);
+void spr_command_buffer_destroy(spr_command_buffer_t* cb);
+void spr_command_buffer_reset(spr_command_buffer_t* cb);
+
+/* Record the equivalent of spr_draw_triangles_instanced() and
+   spr_draw_indexed_triangles_instanced(). Return 0 if the arguments are
+   invalid or memory runs out, in which case nothing is recorded. */
+int spr_cmd_draw_triangles(spr_command_buffer_t* cb, const spr_pipeline_t* pipeline, int count, const void* vertices, size_t stride, int instance_count);
+int spr_cmd_draw_indexed_triangles(spr_command_buffer_t* cb, const spr_pipeline_t* pipeline, int index_count, const uint32_t* indices, const void* vertices, size_t stride, int instance_count);
+
+/* Order commands by pipeline sort_key (then buffer and record order)
+   instead of buffer and record order */
+#define SPR_SUBMIT_SORTED 1
+
+/* Executes the buffers' commands on ctx. Consecutive commands sharing a
+   pipeline are drawn as one batch: the tiled rasterizer keeps binning
+   across them and only flushes when the pipeline changes. The context's
+   own program, uniforms, varyings and culling are restored afterwards. */
+void spr_submit(spr_context_t* ctx, spr_command_buffer_t* const* buffers, int count, unsigned int flags);
+
 /* Framebuffer Resolve (A-Buffer) */
 void spr_resolve(spr_context_t* ctx);
 
 /* Culling */
 void spr_enable_cull_face(spr_context_t* ctx, int enable);
 
+/* Hybrid Z-Buffer + A-Buffer */
+/* Fully opaque fragments are depth-tested and written directly to a z-buffer
+   and the colour buffer; only translucent fragments in front of them are
+   stored in the A-buffer. spr_clear()'s depth argument initialises the
+   z-buffer (NDC z, usually 1.0). Opaque colours are clamped and quantised
+   to 8 bits before translucent layers are composited over them. */
+void spr_enable_opaque_zbuffer(spr_context_t* ctx, int enable);
+
+/* A-Buffer Storage */
+typedef enum {
+    SPR_FRAGMENT_STORAGE_LIST,    /* Per-pixel linked lists (default) */
+    SPR_FRAGMENT_STORAGE_KBUFFER, /* Nearest SPR_KBUFFER_K (4) fragments inline per pixel, the rest in a list */
+    SPR_FRAGMENT_STORAGE_APPEND,  /* Unsorted lists, sorted per pixel by spr_resolve() */
+    SPR_FRAGMENT_STORAGE_COUNTED, /* Two passes: count, then write into one contiguous array */
+    SPR_FRAGMENT_STORAGE_COMPACT  /* Sorted lists of packed 16-byte fragments */
+} spr_fragment_storage_t;
+
+/* Selects how A-buffer fragments are stored. The k-buffer keeps each pixel's
+   nearest fragments contiguous, so inserts shift a small array and resolve
+   scans it linearly; deeper pixels overflow into the linked list. Append
+   mode makes every insert a constant-time push (an atomic head exchange in
+   threaded builds) and defers sorting and occlusion culling to spr_resolve();
+   it keeps every fragment, so saturated pixels are no longer skipped early
+   and peak_fragments grows. Counted mode draws each frame twice, a count
+   pass closed by spr_end_count_pass() and a write pass with the same draws
+   (see below). Compact mode stores list fragments in 16 bytes instead of 40
+   (24-bit depth, 10-bit premultiplied RGB clamped to 1.0, 8-bit opacity per
+   channel, 32-bit index links); it is lossy, and colours may differ by about
+   one 8-bit step. All other modes produce the same image. In k-buffer mode
+   the fragment counters in spr_stats_t count only overflow nodes. Change it
+   between frames. */
+void spr_set_fragment_storage(spr_context_t* ctx, spr_fragment_storage_t storage);
+
+/* Counted storage draws every frame twice:
+
+       spr_clear(); draw...; spr_end_count_pass(); draw the same...; spr_resolve();
+
+   The count pass only counts covered pixels (no fragment shading). Ending it
+   turns the counts into a prefix sum and sizes one fragment array, in which
+   each pixel owns a contiguous slice; the write pass fills the slices and
+   spr_resolve() sorts and reads them sequentially. Fragments beyond what the
+   count pass saw are dropped. peak_fragments reports the array size. */
+void spr_end_count_pass(spr_context_t* ctx);
+
+/* Fragment Arena */
+/* Fragment chunks persist across frames and spr_clear() only rewinds the
+   allocator. It also tops the arena up to the busiest frame's chunks plus
+   one per worker pool, so once a frame has been drawn, frames like it make
+   no heap allocations (see spr_stats_t.heap_allocations). */
+typedef enum {
+    SPR_ARENA_PRESIZE    = 1 << 0, /* spr_clear() keeps 1.25x the busiest frame's chunks, grown in one block */
+    SPR_ARENA_HUGE_PAGES = 1 << 1  /* Back the arena with 2 MB transparent huge pages where available (Linux) */
+} spr_arena_flags_t;
+
+void spr_set_fragment_arena(spr_context_t* ctx, unsigned int flags);
+
+/* Caps the memory of chunk based fragment storage (list, k-buffer overflow,
+   append and compact) at 'bytes'; 0 (the default) means unlimited. Memory
+   already held is kept. Layers are added freely until what is left of the
+   budget only covers one node for each pixel still expected to need its
+   first layer (as many as the busiest frame had, or every pixel in the
+   first frame). From then on, or once an allocation hits the cap, a pixel
+   that already has a layer merges its two farthest layers, composited in
+   order into the nearer one, instead of taking a node. The image degrades
+   gracefully rather than losing layers or pixels. Counted storage sizes its
+   array exactly and ignores the budget. */
+void spr_set_fragment_budget(spr_context_t* ctx, size_t bytes);
+
+/* Framebuffer Layout */
+typedef enum {
+    SPR_FRAMEBUFFER_LINEAR, /* Row-major per-pixel state (default) */
+    SPR_FRAMEBUFFER_TILED   /* Each 64x64 tile contiguous, as 8x8 blocks */
+} spr_framebuffer_layout_t;
+
+/* Selects the memory order of the internal per-pixel state (fragment heads,
+   colour, depth, saturation depths, k-buffer and counted arrays). With the
+   tiled layout the pixels a triangle covers share cache lines and pages,
+   which helps insertion and resolve on large framebuffers; spr_resolve()
+   converts to the linear colour buffer, which spr_get_color_buffer() always
+   returns. Its contents are only current after spr_resolve() then. Call
+   between frames: the frame in progress is discarded. */
+void spr_set_framebuffer_layout(spr_context_t* ctx, spr_framebuffer_layout_t layout);
+
 /* Statistics */
 typedef struct {
     int active_fragments; /* Currently allocated (not freed) */
@@ -118,6 +353,19 @@ typedef struct {
     int total_chunks;     /* Number of memory chunks currently allocated */
     uint64_t texture_samples; /* Number of texture lookups per frame */
     uint64_t total_triangles; /* Number of triangles processed per frame */
+    uint64_t shaded_vertices; /* Vertex shader invocations per frame */
+    uint64_t frustum_rejected_triangles; /* Entirely outside the view frustum, dropped before setup */
+    uint64_t clipped_triangles;          /* Crossed the near/far planes or the guard band and were clipped */
+    uint64_t skipped_fragments; /* Covered pixels not shaded because they were already hidden */
+    uint64_t accepted_blocks;   /* Fully covered pixel blocks shaded without per-pixel edge tests */
+    uint64_t rejected_blocks;   /* Empty blocks inside triangle bounding boxes that were skipped */
+    uint64_t kbuffer_overflow_fragments; /* Fragments spilled past SPR_KBUFFER_K into the overflow list */
+    uint64_t merged_fragments;  /* Layers merged because the fragment budget was reached */
+    uint64_t fragment_bytes;    /* Fragment memory in use: list/compact chunks, or the counted array */
+    int fragment_size;          /* Bytes per stored fragment in the current storage mode */
+    uint64_t heap_allocations;  /* Heap allocations by fragment storage and tile bins since the last clear */
+    spr_rasterizer_mode_t rasterizer_kernel; /* Edge-function kernel in use (CPU, SIMD = SSE2, AVX2, AVX512) */
+    int simd_width;             /* Pixels per coverage test of that kernel */
 } spr_stats_t;
 
 spr_stats_t spr_get_stats(spr_context_t* ctx);
@@ -207,6 +207,9 @@ spr_mesh_t* spr_load_gltf(const char* filename) {
          for (cgltf_size i = 0; i < data->scenes[0].nodes_count; ++i) process_node_extract(data->scenes[0].nodes[i], root_transform, mesh, &current_vertex, &current_group, data);
     }
 
+    /* The primitives' own index buffers were expanded above; weld back */
+    spr_mesh_build_indices(mesh);
+
     printf("Loaded glTF: %d triangles (%d vertices), %d groups, %d materials\n", mesh->vertex_count / 3, mesh->vertex_count, mesh->group_count, mesh->material_count);
     cgltf_free(data);
     return mesh;
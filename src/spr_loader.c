@@ -8,6 +8,7 @@
 #include <strings.h>
 #include <ctype.h>
 #include <math.h>
+#include <stddef.h>
 
 #define MAX_LINE 1024
 
@@ -73,6 +74,97 @@ static void* da_get(dyn_array_t* da, int idx) {
     return (char*)da->data + (idx * da->element_size);
 }
 
+/* --- Vertex Welding --- */
+
+/* For each of count vertices, finds the first one whose leading key_size
+   bytes are identical (itself if none), using an open-addressing hash of
+   the key bytes. Returns a malloc'ed array, or NULL if out of memory. */
+static uint32_t* weld_vertices(const void* vertices, int count, size_t stride, size_t key_size) {
+    const unsigned char* base = (const unsigned char*)vertices;
+    uint32_t* first = (uint32_t*)malloc((size_t)count * sizeof(uint32_t));
+    int32_t* table;
+    size_t mask = 1, k;
+    int i;
+
+    while (mask < (size_t)count * 2) mask <<= 1;
+    table = (int32_t*)malloc(mask * sizeof(int32_t));
+    if (!first || !table) {
+        free(first);
+        free(table);
+        return NULL;
+    }
+    memset(table, 0xFF, mask * sizeof(int32_t)); /* -1: empty */
+    mask--;
+
+    for (i = 0; i < count; ++i) {
+        const unsigned char* key = base + (size_t)i * stride;
+        uint32_t h = 2166136261u; /* FNV-1a */
+        for (k = 0; k < key_size; ++k) h = (h ^ key[k]) * 16777619u;
+        for (k = h & mask; ; k = (k + 1) & mask) {
+            if (table[k] < 0) {
+                table[k] = i;
+                first[i] = (uint32_t)i;
+                break;
+            }
+            if (memcmp(base + (size_t)table[k] * stride, key, key_size) == 0) {
+                first[i] = (uint32_t)table[k];
+                break;
+            }
+        }
+    }
+    free(table);
+    return first;
+}
+
+/* OBJ tangents come from each face. Vertices that share position, normal
+   and uv get the average of their faces' tangents, so that they become
+   identical and can be shared by the index buffer. */
+static void smooth_tangents(spr_vertex_t* vertices, int count) {
+    uint32_t* first = weld_vertices(vertices, count, sizeof(spr_vertex_t), offsetof(spr_vertex_t, tangent));
+    int i;
+    if (!first) return;
+
+    /* Sum into the first copy, then normalize it against its normal */
+    for (i = 0; i < count; ++i) {
+        spr_vertex_t* v = &vertices[first[i]];
+        if (first[i] == (uint32_t)i) continue;
+        v->tangent.x += vertices[i].tangent.x;
+        v->tangent.y += vertices[i].tangent.y;
+        v->tangent.z += vertices[i].tangent.z;
+    }
+    for (i = 0; i < count; ++i) {
+        spr_vertex_t* v = &vertices[i];
+        vec3_t n = v->normal;
+        float dot, len;
+        if (first[i] != (uint32_t)i) continue;
+        dot = n.x*v->tangent.x + n.y*v->tangent.y + n.z*v->tangent.z;
+        v->tangent.x -= n.x * dot;
+        v->tangent.y -= n.y * dot;
+        v->tangent.z -= n.z * dot;
+        len = sqrtf(v->tangent.x*v->tangent.x + v->tangent.y*v->tangent.y + v->tangent.z*v->tangent.z);
+        if (len > 0) { v->tangent.x/=len; v->tangent.y/=len; v->tangent.z/=len; }
+        else { v->tangent.x=1; v->tangent.y=0; v->tangent.z=0; } /* Opposing faces cancelled out */
+    }
+    for (i = 0; i < count; ++i) vertices[i].tangent = vertices[first[i]].tangent;
+    free(first);
+}
+
+int spr_mesh_build_indices(spr_mesh_t* mesh) {
+    size_t stride, key_size;
+    if (!mesh) return 0;
+    if (mesh->type == SPR_MESH_STL) {
+        /* Stop before the struct padding, which the STL reader leaves unset */
+        stride = sizeof(stl_vertex_t);
+        key_size = offsetof(stl_vertex_t, attr) + sizeof(uint16_t);
+    } else {
+        stride = sizeof(spr_vertex_t);
+        key_size = sizeof(spr_vertex_t);
+    }
+    free(mesh->indices);
+    mesh->indices = weld_vertices(mesh->vertices, mesh->vertex_count, stride, key_size);
+    return mesh->indices != NULL;
+}
+
 /* --- MTL Loader --- */
 
 static void parse_mtl(const char* mtl_path, dyn_array_t* materials) {
@@ -366,15 +458,19 @@ static spr_mesh_t* load_obj(const char* filename) {
     da_free(&uv_list);
     da_free(&norm_list);
     
+    smooth_tangents((spr_vertex_t*)vertices.data, vertices.count);
+
     spr_mesh_t* mesh = (spr_mesh_t*)malloc(sizeof(spr_mesh_t));
     mesh->type = SPR_MESH_OBJ;
     mesh->vertex_count = vertices.count;
     mesh->vertices = vertices.data;
+    mesh->indices = NULL;
     mesh->group_count = groups.count;
     mesh->groups = groups.data;
     mesh->material_count = materials.count;
     mesh->materials = materials.data;
     mesh->texture = NULL;
+    spr_mesh_build_indices(mesh);
     
     printf("Loaded OBJ: %d vertices, %d groups, %d materials\n", 
            mesh->vertex_count, mesh->group_count, mesh->material_count);
@@ -400,6 +496,7 @@ spr_mesh_t* spr_load_mesh(const char* filename) {
         mesh->type = SPR_MESH_STL;
         mesh->vertex_count = stl->vertex_count;
         mesh->vertices = stl->vertices; 
+        mesh->indices = NULL;
         
         /* Create 1 default group for STL */
         mesh->group_count = 1;
@@ -411,6 +508,7 @@ spr_mesh_t* spr_load_mesh(const char* filename) {
         mesh->material_count = 0;
         mesh->materials = NULL;
         mesh->texture = NULL;
+        spr_mesh_build_indices(mesh);
         free(stl);
         return mesh;
     }
@@ -420,6 +518,7 @@ spr_mesh_t* spr_load_mesh(const char* filename) {
 void spr_free_mesh(spr_mesh_t* mesh) {
     if (mesh) {
         if (mesh->vertices) free(mesh->vertices);
+        free(mesh->indices);
         if (mesh->groups) free(mesh->groups);
         
         if (mesh->materials) {
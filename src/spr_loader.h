@@ -41,6 +41,9 @@ typedef struct {
     /* Vertex Data */
     int vertex_count;
     void* vertices;         /* Pointer to array (stl_vertex_t* or spr_vertex_t*) */
+    uint32_t* indices;      /* [vertex_count] first identical copy of each vertex, or NULL:
+                               draw a group with spr_draw_indexed_triangles(ctx,
+                               vertex_count, indices + start_vertex, vertices, stride) */
     
     /* OBJ: Groups and Materials */
     int group_count;
@@ -56,4 +59,8 @@ typedef struct {
 spr_mesh_t* spr_load_mesh(const char* filename);
 void spr_free_mesh(spr_mesh_t* mesh);
 
+/* (Re)builds mesh->indices by welding byte-identical vertices; the loaders
+   call it. Returns 0 if out of memory (indices is then NULL). */
+int spr_mesh_build_indices(spr_mesh_t* mesh);
+
 #endif /* SPR_LOADER_H */
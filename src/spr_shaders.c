@@ -54,6 +54,18 @@ static void decode_stl_color(uint16_t attr, vec4_t* out_color) {
     out_color->w = 1.0f;
 }
 
+/* The instance being shaded when the uniforms carry per-instance data */
+static const spr_shader_instance_t* shader_instance(const spr_shader_uniforms_t* u, const spr_vertex_out_t* out) {
+    return u->instances ? &u->instances[out->instance_id] : NULL;
+}
+
+static void tint_instance(const spr_shader_instance_t* inst, vec4_t* color) {
+    color->x *= inst->color.x;
+    color->y *= inst->color.y;
+    color->z *= inst->color.z;
+    color->w *= inst->color.w;
+}
+
 /* --- Math Helpers --- */
 static float sh_dot(vec3_t a, vec3_t b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
 
@@ -110,10 +122,13 @@ static void apply_wireframe(spr_shader_uniforms_t* u, const spr_vertex_out_t* in
 void spr_shader_constant_vs(void* user_data, const void* input_vertex, spr_vertex_out_t* out) {
     spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
     const stl_vertex_t* v = (const stl_vertex_t*)input_vertex;
+    const spr_shader_instance_t* inst = shader_instance(u, out);
     
     vec4_t pos = {v->x, v->y, v->z, 1.0f};
+    if (inst) pos = spr_mat4_mul_vec4(inst->transform, pos);
     out->position = spr_mat4_mul_vec4(u->mvp, pos);
     decode_stl_color(v->attr, &out->color);
+    if (inst) tint_instance(inst, &out->color);
 }
 
 spr_fs_output_t spr_shader_constant_fs(void* user_data, const spr_vertex_out_t* interpolated) {
@@ -139,15 +154,19 @@ spr_fs_output_t spr_shader_constant_fs(void* user_data, const spr_vertex_out_t*
 void spr_shader_matte_vs(void* user_data, const void* input_vertex, spr_vertex_out_t* out) {
     spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
     const stl_vertex_t* v = (const stl_vertex_t*)input_vertex;
+    const spr_shader_instance_t* inst = shader_instance(u, out);
     
     vec4_t pos = {v->x, v->y, v->z, 1.0f};
+    if (inst) pos = spr_mat4_mul_vec4(inst->transform, pos);
     out->position = spr_mat4_mul_vec4(u->mvp, pos);
     
     vec4_t n4 = {v->nx, v->ny, v->nz, 0.0f};
+    if (inst) n4 = spr_mat4_mul_vec4(inst->transform, n4);
     n4 = spr_mat4_mul_vec4(u->model, n4);
     out->normal.x = n4.x; out->normal.y = n4.y; out->normal.z = n4.z;
     
     decode_stl_color(v->attr, &out->color);
+    if (inst) tint_instance(inst, &out->color);
 }
 
 spr_fs_output_t spr_shader_matte_fs(void* user_data, const spr_vertex_out_t* interpolated) {
@@ -235,7 +254,7 @@ spr_fs_output_t spr_shader_paintedplastic_fs(void* user_data, const spr_vertex_o
     spr_fs_output_t out;
     
     /* Sample Texture */
-    vec4_t tex_col = spr_texture_sample((const spr_texture_t*)u->texture_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+    vec4_t tex_col = spr_texture_sample((spr_texture_t*)u->texture_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
     
     /* Reuse Plastic Lighting Logic */
     vec3_t N = sh_normalize(interpolated->normal);
@@ -254,7 +273,7 @@ spr_fs_output_t spr_shader_paintedplastic_fs(void* user_data, const spr_vertex_o
     
     /* Specular Map Modulation */
     if (u->specular_map_ptr) {
-        vec4_t spec_map = spr_texture_sample((const spr_texture_t*)u->specular_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+        vec4_t spec_map = spr_texture_sample((spr_texture_t*)u->specular_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
         spec *= spec_map.x; /* Use Red channel for intensity */
     }
     
@@ -280,18 +299,22 @@ spr_fs_output_t spr_shader_paintedplastic_fs(void* user_data, const spr_vertex_o
 void spr_shader_textured_vs(void* user_data, const void* input_vertex, spr_vertex_out_t* out) {
     spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
     const spr_vertex_t* v = (const spr_vertex_t*)input_vertex;
+    const spr_shader_instance_t* inst = shader_instance(u, out);
     
     /* Position */
     vec4_t pos = {v->position.x, v->position.y, v->position.z, 1.0f};
+    if (inst) pos = spr_mat4_mul_vec4(inst->transform, pos);
     out->position = spr_mat4_mul_vec4(u->mvp, pos);
     
     /* Normal */
     vec4_t n4 = {v->normal.x, v->normal.y, v->normal.z, 0.0f};
+    if (inst) n4 = spr_mat4_mul_vec4(inst->transform, n4);
     n4 = spr_mat4_mul_vec4(u->model, n4);
     out->normal.x = n4.x; out->normal.y = n4.y; out->normal.z = n4.z;
     
     /* Tangent */
     vec4_t t4 = {v->tangent.x, v->tangent.y, v->tangent.z, 0.0f};
+    if (inst) t4 = spr_mat4_mul_vec4(inst->transform, t4);
     t4 = spr_mat4_mul_vec4(u->model, t4);
     out->tangent.x = t4.x; out->tangent.y = t4.y; out->tangent.z = t4.z;
     out->tangent.w = v->tangent.w;
@@ -301,6 +324,7 @@ void spr_shader_textured_vs(void* user_data, const void* input_vertex, spr_verte
     
     /* Color (Default White) */
     out->color.x = 1.0f; out->color.y = 1.0f; out->color.z = 1.0f; out->color.w = 1.0f;
+    if (inst) tint_instance(inst, &out->color);
 }
 
 /* --- Metal Shader --- */
@@ -354,7 +378,7 @@ spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* inter
     /* 1. Base Opacity */
     float alpha = u->opacity.y; /* Use Green channel as master opacity */
     if (u->opacity_map_ptr) {
-        vec4_t map_d = spr_texture_sample((const spr_texture_t*)u->opacity_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+        vec4_t map_d = spr_texture_sample((spr_texture_t*)u->opacity_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
         alpha *= map_d.x; /* Use Red channel */
     }
     
@@ -373,7 +397,7 @@ spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* inter
         /* Handedness flip if needed, assuming T.w stores it. OBJ usually doesn't store w, so assume 1.0 */
         
         /* Sample Normal Map (RGB -> [-1, 1]) */
-        vec4_t nm = spr_texture_sample((const spr_texture_t*)u->normal_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+        vec4_t nm = spr_texture_sample((spr_texture_t*)u->normal_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
         vec3_t map_N;
         map_N.x = nm.x * 2.0f - 1.0f;
         map_N.y = nm.y * 2.0f - 1.0f;
@@ -392,7 +416,7 @@ spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* inter
     /* 3. Diffuse Component */
     vec3_t Kd = {u->color.x, u->color.y, u->color.z};
     if (u->texture_ptr) {
-        vec4_t map_Kd = spr_texture_sample((const spr_texture_t*)u->texture_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+        vec4_t map_Kd = spr_texture_sample((spr_texture_t*)u->texture_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
         Kd.x *= map_Kd.x; Kd.y *= map_Kd.y; Kd.z *= map_Kd.z;
     }
     
@@ -410,7 +434,7 @@ spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* inter
         
         float roughness = u->roughness;
         if (u->roughness_map_ptr) {
-            vec4_t map_Ns = spr_texture_sample((const spr_texture_t*)u->roughness_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+            vec4_t map_Ns = spr_texture_sample((spr_texture_t*)u->roughness_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
             roughness *= map_Ns.x; /* Modulate roughness */
         }
         
@@ -418,14 +442,14 @@ spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* inter
     }
     
     if (u->specular_map_ptr) {
-        vec4_t map_Ks = spr_texture_sample((const spr_texture_t*)u->specular_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+        vec4_t map_Ks = spr_texture_sample((spr_texture_t*)u->specular_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
         Ks.x *= map_Ks.x; Ks.y *= map_Ks.y; Ks.z *= map_Ks.z;
     }
     
     /* 5. Emissive Component */
     vec3_t Ke = u->Ke;
     if (u->emissive_map_ptr) {
-        vec4_t map_Ke = spr_texture_sample((const spr_texture_t*)u->emissive_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
+        vec4_t map_Ke = spr_texture_sample((spr_texture_t*)u->emissive_map_ptr, interpolated->uv.x, interpolated->uv.y, u->stats);
         Ke.x *= map_Ke.x; Ke.y *= map_Ke.y; Ke.z *= map_Ke.z;
     }
     
@@ -443,3 +467,505 @@ spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* inter
     apply_wireframe(u, interpolated, &out);
     return out;
 }
+
+/* --- Batch Shaders --- */
+/* SoA versions of the lighting models above, four lanes per operation. With
+   SSE2 the arithmetic maps to packed instructions; elsewhere it falls back
+   to plain per-lane code. normalize, dot and the Lambert terms use the same
+   operations in the same order as the scalar shaders and give identical
+   results. The specular pow() is a polynomial exp/log (relative error around
+   1e-5), so highlights can differ from the scalar shaders by one 8-bit step. */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128 sh4_t;
+
+#define sh4_load(p) _mm_loadu_ps(p)
+#define sh4_store(p, a) _mm_storeu_ps(p, a)
+#define sh4_set1(f) _mm_set1_ps(f)
+#define sh4_set4(a, b, c, d) _mm_setr_ps(a, b, c, d)
+#define sh4_add(a, b) _mm_add_ps(a, b)
+#define sh4_sub(a, b) _mm_sub_ps(a, b)
+#define sh4_mul(a, b) _mm_mul_ps(a, b)
+#define sh4_div(a, b) _mm_div_ps(a, b)
+#define sh4_max(a, b) _mm_max_ps(a, b) /* (a > b) ? a : b, like sh_max */
+#define sh4_sqrt(a) _mm_sqrt_ps(a)
+#define sh4_gt(a, b) _mm_cmpgt_ps(a, b)
+#define sh4_and(a, b) _mm_and_ps(a, b)
+
+/* m ? a : b, m from sh4_gt/sh4_and */
+static sh4_t sh4_select(sh4_t m, sh4_t a, sh4_t b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+/* x^y for x > 0 as exp(y * ln(x)) */
+static sh4_t sh4_pow(sh4_t x, sh4_t y) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128i xi = _mm_castps_si128(x);
+    __m128i e = _mm_sub_epi32(_mm_srli_epi32(xi, 23), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+    __m128 big, t, t2, ln, z, r, p;
+    __m128i n;
+
+    /* ln(x) = e * ln2 + ln(m), with m folded into [sqrt(0.5), sqrt(2)) */
+    big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+    m = sh4_select(big, _mm_mul_ps(m, _mm_set1_ps(0.5f)), m);
+    e = _mm_sub_epi32(e, _mm_castps_si128(big)); /* mask is -1 */
+    t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    t2 = _mm_mul_ps(t, t);
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 7.0f), _mm_mul_ps(t2, _mm_set1_ps(1.0f / 9.0f)));
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 5.0f), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 3.0f), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(one, _mm_mul_ps(t2, p));
+    ln = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(0.693147181f)), _mm_mul_ps(_mm_add_ps(t, t), p));
+
+    /* exp(z) = 2^n * exp(r), |r| <= ln2 / 2 */
+    z = _mm_mul_ps(y, ln);
+    z = _mm_min_ps(_mm_max_ps(z, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+    n = _mm_cvtps_epi32(_mm_mul_ps(z, _mm_set1_ps(1.44269504f)));
+    r = _mm_sub_ps(z, _mm_mul_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(0.693359375f)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(2.12194440e-4f)));
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 720.0f), _mm_mul_ps(r, _mm_set1_ps(1.0f / 5040.0f)));
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 120.0f), _mm_mul_ps(r, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 24.0f), _mm_mul_ps(r, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f / 6.0f), _mm_mul_ps(r, p));
+    p = _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(r, p));
+    p = _mm_add_ps(one, _mm_mul_ps(r, p));
+    p = _mm_add_ps(one, _mm_mul_ps(r, p));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)));
+}
+
+#else /* !__SSE2__ */
+
+typedef struct { float f[4]; } sh4_t;
+
+#define SH4_OP(name, expr) \
+    static sh4_t name(sh4_t a, sh4_t b) { sh4_t r; int i; for (i = 0; i < 4; ++i) r.f[i] = (expr); return r; }
+
+SH4_OP(sh4_add, a.f[i] + b.f[i])
+SH4_OP(sh4_sub, a.f[i] - b.f[i])
+SH4_OP(sh4_mul, a.f[i] * b.f[i])
+SH4_OP(sh4_div, a.f[i] / b.f[i])
+SH4_OP(sh4_max, (a.f[i] > b.f[i]) ? a.f[i] : b.f[i])
+SH4_OP(sh4_gt, (a.f[i] > b.f[i]) ? 1.0f : 0.0f)
+SH4_OP(sh4_and, (a.f[i] != 0.0f && b.f[i] != 0.0f) ? 1.0f : 0.0f)
+SH4_OP(sh4_pow, powf(a.f[i], b.f[i]))
+
+static sh4_t sh4_load(const float* p) { sh4_t r; int i; for (i = 0; i < 4; ++i) r.f[i] = p[i]; return r; }
+static void sh4_store(float* p, sh4_t a) { int i; for (i = 0; i < 4; ++i) p[i] = a.f[i]; }
+static sh4_t sh4_set1(float f) { sh4_t r; int i; for (i = 0; i < 4; ++i) r.f[i] = f; return r; }
+static sh4_t sh4_set4(float a, float b, float c, float d) { sh4_t r; r.f[0] = a; r.f[1] = b; r.f[2] = c; r.f[3] = d; return r; }
+static sh4_t sh4_sqrt(sh4_t a) { sh4_t r; int i; for (i = 0; i < 4; ++i) r.f[i] = sqrtf(a.f[i]); return r; }
+static sh4_t sh4_select(sh4_t m, sh4_t a, sh4_t b) { sh4_t r; int i; for (i = 0; i < 4; ++i) r.f[i] = (m.f[i] != 0.0f) ? a.f[i] : b.f[i]; return r; }
+
+#endif /* __SSE2__ */
+
+typedef struct { sh4_t x, y, z; } sh4_vec3_t;
+
+static sh4_vec3_t sh4_load3(const float* x, const float* y, const float* z) {
+    sh4_vec3_t v;
+    v.x = sh4_load(x); v.y = sh4_load(y); v.z = sh4_load(z);
+    return v;
+}
+
+static sh4_t sh4_dot(sh4_vec3_t a, sh4_vec3_t b) {
+    return sh4_add(sh4_add(sh4_mul(a.x, b.x), sh4_mul(a.y, b.y)), sh4_mul(a.z, b.z));
+}
+
+static sh4_vec3_t sh4_normalize(sh4_vec3_t v) {
+    sh4_t len = sh4_sqrt(sh4_dot(v, v));
+    sh4_t ok = sh4_gt(len, sh4_set1(0.0f));
+    v.x = sh4_select(ok, sh4_div(v.x, len), v.x);
+    v.y = sh4_select(ok, sh4_div(v.y, len), v.y);
+    v.z = sh4_select(ok, sh4_div(v.z, len), v.z);
+    return v;
+}
+
+static sh4_vec3_t sh4_splat3(vec3_t v) {
+    sh4_vec3_t r;
+    r.x = sh4_set1(v.x); r.y = sh4_set1(v.y); r.z = sh4_set1(v.z);
+    return r;
+}
+
+/* max(dot(reflect(-L, N), V), 0) for the fixed viewer V = (0, 0, 1) */
+static sh4_t sh4_spec_base(vec3_t L, sh4_vec3_t N) {
+    sh4_vec3_t I = sh4_splat3((vec3_t){-L.x, -L.y, -L.z});
+    sh4_t d = sh4_dot(I, N);
+    sh4_t rz = sh4_sub(I.z, sh4_mul(sh4_mul(sh4_set1(2.0f), d), N.z));
+    return sh4_max(rz, sh4_set1(0.0f));
+}
+
+/* Phong specular term: pow(s, e) where the scalar shaders compute it
+   (diff > 0 and s > 0), else 0 */
+static sh4_t sh4_spec(sh4_t diff, sh4_t s, sh4_t e) {
+    sh4_t zero = sh4_set1(0.0f);
+    sh4_t lit = sh4_and(sh4_gt(diff, zero), sh4_gt(s, zero));
+    return sh4_select(lit, sh4_pow(sh4_select(lit, s, sh4_set1(1.0f)), e), zero);
+}
+
+static void store_opacity_batch(spr_shader_uniforms_t* u, spr_fs_batch_output_t* out) {
+    int i;
+    for (i = 0; i < SPR_FS_BATCH; ++i) {
+        out->opacity_r[i] = u->opacity.x;
+        out->opacity_g[i] = u->opacity.y;
+        out->opacity_b[i] = u->opacity.z;
+    }
+}
+
+static void apply_wireframe_batch(spr_shader_uniforms_t* u, const spr_fs_batch_t* in, spr_fs_batch_output_t* out) {
+    int i;
+    if (u->wireframe <= 0) return;
+    for (i = 0; i < SPR_FS_BATCH; ++i) {
+        spr_vertex_out_t v;
+        spr_fs_output_t o;
+        if (!(in->mask & (1u << i))) continue;
+        v.barycentric.x = in->barycentric_x[i];
+        v.barycentric.y = in->barycentric_y[i];
+        v.barycentric.z = in->barycentric_z[i];
+        o.color.x = out->color_r[i]; o.color.y = out->color_g[i]; o.color.z = out->color_b[i];
+        o.opacity.x = out->opacity_r[i]; o.opacity.y = out->opacity_g[i]; o.opacity.z = out->opacity_b[i];
+        apply_wireframe(u, &v, &o);
+        out->color_r[i] = o.color.x; out->color_g[i] = o.color.y; out->color_b[i] = o.color.z;
+        out->opacity_r[i] = o.opacity.x; out->opacity_g[i] = o.opacity.y; out->opacity_b[i] = o.opacity.z;
+    }
+}
+
+void spr_shader_matte_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out) {
+    spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
+    sh4_vec3_t L = sh4_splat3(sh_normalize(u->light_dir));
+    int i;
+
+    for (i = 0; i < SPR_FS_BATCH; i += 4) {
+        sh4_vec3_t N = sh4_normalize(sh4_load3(in->normal_x + i, in->normal_y + i, in->normal_z + i));
+        sh4_t diff = sh4_max(sh4_dot(N, L), sh4_set1(0.0f));
+        sh4_t intensity = sh4_add(diff, sh4_set1(0.1f));
+
+        sh4_t br = sh4_mul(sh4_set1(u->color.x), sh4_load(in->color_r + i));
+        sh4_t bg = sh4_mul(sh4_set1(u->color.y), sh4_load(in->color_g + i));
+        sh4_t bb = sh4_mul(sh4_set1(u->color.z), sh4_load(in->color_b + i));
+
+        sh4_store(out->color_r + i, sh4_mul(sh4_mul(br, intensity), sh4_set1(u->opacity.x)));
+        sh4_store(out->color_g + i, sh4_mul(sh4_mul(bg, intensity), sh4_set1(u->opacity.y)));
+        sh4_store(out->color_b + i, sh4_mul(sh4_mul(bb, intensity), sh4_set1(u->opacity.z)));
+    }
+    store_opacity_batch(u, out);
+    apply_wireframe_batch(u, in, out);
+}
+
+void spr_shader_plastic_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out) {
+    spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
+    vec3_t light = sh_normalize(u->light_dir);
+    sh4_vec3_t L = sh4_splat3(light);
+    int i;
+
+    for (i = 0; i < SPR_FS_BATCH; i += 4) {
+        sh4_vec3_t N = sh4_normalize(sh4_load3(in->normal_x + i, in->normal_y + i, in->normal_z + i));
+        sh4_t diff = sh4_max(sh4_dot(N, L), sh4_set1(0.0f));
+        sh4_t lit = sh4_add(diff, sh4_set1(0.2f));
+        sh4_t spec = sh4_mul(sh4_spec(diff, sh4_spec_base(light, N), sh4_set1(u->roughness)), sh4_set1(0.4f));
+
+        sh4_t br = sh4_mul(sh4_set1(u->color.x), sh4_load(in->color_r + i));
+        sh4_t bg = sh4_mul(sh4_set1(u->color.y), sh4_load(in->color_g + i));
+        sh4_t bb = sh4_mul(sh4_set1(u->color.z), sh4_load(in->color_b + i));
+
+        sh4_store(out->color_r + i, sh4_mul(sh4_add(sh4_mul(br, lit), spec), sh4_set1(u->opacity.x)));
+        sh4_store(out->color_g + i, sh4_mul(sh4_add(sh4_mul(bg, lit), spec), sh4_set1(u->opacity.y)));
+        sh4_store(out->color_b + i, sh4_mul(sh4_add(sh4_mul(bb, lit), spec), sh4_set1(u->opacity.z)));
+    }
+    store_opacity_batch(u, out);
+    apply_wireframe_batch(u, in, out);
+}
+
+void spr_shader_metal_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out) {
+    spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
+    vec3_t light = sh_normalize(u->light_dir);
+    sh4_vec3_t L = sh4_splat3(light);
+    sh4_t amb = sh4_set1(0.1f);
+    sh4_t diffuse_factor = sh4_set1(0.3f);
+    sh4_t specular_factor = sh4_set1(1.2f);
+    int i;
+
+    for (i = 0; i < SPR_FS_BATCH; i += 4) {
+        sh4_vec3_t N = sh4_normalize(sh4_load3(in->normal_x + i, in->normal_y + i, in->normal_z + i));
+        sh4_t diff = sh4_max(sh4_dot(N, L), sh4_set1(0.0f));
+        sh4_t spec = sh4_spec(diff, sh4_spec_base(light, N), sh4_set1(u->roughness * 1.5f));
+
+        sh4_t br = sh4_mul(sh4_set1(u->color.x), sh4_load(in->color_r + i));
+        sh4_t bg = sh4_mul(sh4_set1(u->color.y), sh4_load(in->color_g + i));
+        sh4_t bb = sh4_mul(sh4_set1(u->color.z), sh4_load(in->color_b + i));
+
+        /* (base * diff * diffuse) + (amb * base) + (spec * base * specular) */
+        sh4_t r = sh4_add(sh4_add(sh4_mul(sh4_mul(br, diff), diffuse_factor), sh4_mul(amb, br)), sh4_mul(sh4_mul(spec, br), specular_factor));
+        sh4_t g = sh4_add(sh4_add(sh4_mul(sh4_mul(bg, diff), diffuse_factor), sh4_mul(amb, bg)), sh4_mul(sh4_mul(spec, bg), specular_factor));
+        sh4_t b = sh4_add(sh4_add(sh4_mul(sh4_mul(bb, diff), diffuse_factor), sh4_mul(amb, bb)), sh4_mul(sh4_mul(spec, bb), specular_factor));
+
+        sh4_store(out->color_r + i, sh4_mul(r, sh4_set1(u->opacity.x)));
+        sh4_store(out->color_g + i, sh4_mul(g, sh4_set1(u->opacity.y)));
+        sh4_store(out->color_b + i, sh4_mul(b, sh4_set1(u->opacity.z)));
+    }
+    store_opacity_batch(u, out);
+    apply_wireframe_batch(u, in, out);
+}
+
+/* Samples 'tex' for every live lane; dead lanes (and all lanes without a
+   texture) get 'fallback' so the sample counters match the scalar shader */
+static void sample_batch(void* tex, const spr_fs_batch_t* in, unsigned int lanes, spr_stats_t* stats, vec4_t fallback, vec4_t* texel) {
+    int i;
+    for (i = 0; i < SPR_FS_BATCH; ++i) {
+        if (tex && (lanes & (1u << i))) {
+            texel[i] = spr_texture_sample((spr_texture_t*)tex, in->uv_x[i], in->uv_y[i], stats);
+        } else {
+            texel[i] = fallback;
+        }
+    }
+}
+
+void spr_shader_mtl_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out) {
+    spr_shader_uniforms_t* u = (spr_shader_uniforms_t*)user_data;
+    const vec4_t white = {1.0f, 1.0f, 1.0f, 1.0f};
+    vec3_t light = sh_normalize(u->light_dir);
+    sh4_vec3_t L = sh4_splat3(light);
+    float diff[SPR_FS_BATCH], s[SPR_FS_BATCH], roughness[SPR_FS_BATCH], alpha[SPR_FS_BATCH];
+    vec4_t map[SPR_FS_BATCH], map_Kd[SPR_FS_BATCH], map_Ks[SPR_FS_BATCH], map_Ke[SPR_FS_BATCH];
+    unsigned int lit_lanes = 0;
+    int i;
+
+    /* 1. Base Opacity */
+    sample_batch(u->opacity_map_ptr, in, in->mask, u->stats, white, map);
+    for (i = 0; i < SPR_FS_BATCH; ++i) {
+        alpha[i] = u->opacity.y;
+        if (u->opacity_map_ptr) alpha[i] *= map[i].x;
+    }
+
+    /* 2. Normal Mapping */
+    if (u->normal_map_ptr) sample_batch(u->normal_map_ptr, in, in->mask, u->stats, white, map);
+    for (i = 0; i < SPR_FS_BATCH; i += 4) {
+        sh4_vec3_t N = sh4_normalize(sh4_load3(in->normal_x + i, in->normal_y + i, in->normal_z + i));
+
+        if (u->normal_map_ptr) {
+            sh4_vec3_t T = sh4_normalize(sh4_load3(in->tangent_x + i, in->tangent_y + i, in->tangent_z + i));
+            sh4_vec3_t B, map_N, final_N;
+            sh4_t two = sh4_set1(2.0f), one = sh4_set1(1.0f);
+            float mx[4], my[4], mz[4];
+            int j;
+
+            /* Gram-Schmidt re-orthogonalize T to N */
+            sh4_t d = sh4_dot(N, T);
+            T.x = sh4_sub(T.x, sh4_mul(N.x, d));
+            T.y = sh4_sub(T.y, sh4_mul(N.y, d));
+            T.z = sh4_sub(T.z, sh4_mul(N.z, d));
+            T = sh4_normalize(T);
+
+            /* Bitangent = cross(N, T) */
+            B.x = sh4_sub(sh4_mul(N.y, T.z), sh4_mul(N.z, T.y));
+            B.y = sh4_sub(sh4_mul(N.z, T.x), sh4_mul(N.x, T.z));
+            B.z = sh4_sub(sh4_mul(N.x, T.y), sh4_mul(N.y, T.x));
+
+            for (j = 0; j < 4; ++j) { mx[j] = map[i + j].x; my[j] = map[i + j].y; mz[j] = map[i + j].z; }
+            map_N.x = sh4_sub(sh4_mul(sh4_load(mx), two), one);
+            map_N.y = sh4_sub(sh4_mul(sh4_load(my), two), one);
+            map_N.z = sh4_sub(sh4_mul(sh4_load(mz), two), one);
+
+            final_N.x = sh4_add(sh4_add(sh4_mul(T.x, map_N.x), sh4_mul(B.x, map_N.y)), sh4_mul(N.x, map_N.z));
+            final_N.y = sh4_add(sh4_add(sh4_mul(T.y, map_N.x), sh4_mul(B.y, map_N.y)), sh4_mul(N.y, map_N.z));
+            final_N.z = sh4_add(sh4_add(sh4_mul(T.z, map_N.x), sh4_mul(B.z, map_N.y)), sh4_mul(N.z, map_N.z));
+            N = sh4_normalize(final_N);
+        }
+
+        /* 3. Diffuse term and the specular base, before the per-lane samples */
+        sh4_store(diff + i, sh4_max(sh4_dot(N, L), sh4_set1(0.0f)));
+        sh4_store(s + i, sh4_spec_base(light, N));
+    }
+
+    sample_batch(u->texture_ptr, in, in->mask, u->stats, white, map_Kd);
+
+    /* 4. Specular: the scalar shader only reads map_Ns for lit pixels */
+    for (i = 0; i < SPR_FS_BATCH; ++i) {
+        if (diff[i] > 0.0f) lit_lanes |= 1u << i;
+    }
+    sample_batch(u->roughness_map_ptr, in, in->mask & lit_lanes, u->stats, white, map);
+    for (i = 0; i < SPR_FS_BATCH; ++i) {
+        roughness[i] = u->roughness;
+        if (u->roughness_map_ptr && (lit_lanes & (1u << i))) roughness[i] *= map[i].x;
+    }
+    sample_batch(u->specular_map_ptr, in, in->mask, u->stats, white, map_Ks);
+
+    /* 5. Emissive */
+    sample_batch(u->emissive_map_ptr, in, in->mask, u->stats, white, map_Ke);
+
+    /* Combine */
+    for (i = 0; i < SPR_FS_BATCH; i += 4) {
+        float kd[3][4], ks[3][4], ke[3][4];
+        sh4_t spec = sh4_spec(sh4_load(diff + i), sh4_load(s + i), sh4_load(roughness + i));
+        sh4_t lit = sh4_add(sh4_load(diff + i), sh4_set1(0.1f));
+        sh4_t a = sh4_load(alpha + i);
+        int j;
+
+        for (j = 0; j < 4; ++j) {
+            const vec4_t* td = &map_Kd[i + j];
+            const vec4_t* ts = &map_Ks[i + j];
+            const vec4_t* te = &map_Ke[i + j];
+            kd[0][j] = u->color.x; kd[1][j] = u->color.y; kd[2][j] = u->color.z;
+            ks[0][j] = u->Ks.x; ks[1][j] = u->Ks.y; ks[2][j] = u->Ks.z;
+            ke[0][j] = u->Ke.x; ke[1][j] = u->Ke.y; ke[2][j] = u->Ke.z;
+            if (u->texture_ptr) { kd[0][j] *= td->x; kd[1][j] *= td->y; kd[2][j] *= td->z; }
+            if (u->specular_map_ptr) { ks[0][j] *= ts->x; ks[1][j] *= ts->y; ks[2][j] *= ts->z; }
+            if (u->emissive_map_ptr) { ke[0][j] *= te->x; ke[1][j] *= te->y; ke[2][j] *= te->z; }
+        }
+
+        sh4_store(out->color_r + i, sh4_mul(sh4_add(sh4_add(sh4_mul(sh4_load(kd[0]), lit), sh4_mul(sh4_load(ks[0]), spec)), sh4_load(ke[0])), a));
+        sh4_store(out->color_g + i, sh4_mul(sh4_add(sh4_add(sh4_mul(sh4_load(kd[1]), lit), sh4_mul(sh4_load(ks[1]), spec)), sh4_load(ke[1])), a));
+        sh4_store(out->color_b + i, sh4_mul(sh4_add(sh4_add(sh4_mul(sh4_load(kd[2]), lit), sh4_mul(sh4_load(ks[2]), spec)), sh4_load(ke[2])), a));
+        sh4_store(out->opacity_r + i, a);
+        sh4_store(out->opacity_g + i, a);
+        sh4_store(out->opacity_b + i, a);
+    }
+    apply_wireframe_batch(u, in, out);
+}
+
+/* --- Batch Vertex Shaders --- */
+/* Four vertices per step: gathered into SoA lanes, multiplied with the same
+   operations in the same order as spr_mat4_mul_vec4() (so the results match
+   the scalar vertex shaders bit for bit) and scattered to the output. The
+   matrices are splatted once per row instead of copied per vertex. */
+
+/* Address of input k */
+static const void* vs_batch_input(const void* vertices, size_t stride, const uint32_t* indices, int k) {
+    return (const uint8_t*)vertices + (size_t)(indices ? indices[k] : (uint32_t)k) * stride;
+}
+
+/* out[r][lane] = row r of m * (v, w), for the first 'rows' rows */
+static void sh4_transform(const mat4_t* m, int rows, sh4_vec3_t v, sh4_t w4, float out[4][4]) {
+    int r;
+    for (r = 0; r < rows; ++r) {
+        sh4_t acc = sh4_add(sh4_mul(sh4_set1(m->m[r][0]), v.x), sh4_mul(sh4_set1(m->m[r][1]), v.y));
+        acc = sh4_add(acc, sh4_mul(sh4_set1(m->m[r][2]), v.z));
+        sh4_store(out[r], sh4_add(acc, sh4_mul(sh4_set1(m->m[r][3]), w4)));
+    }
+}
+
+/* (v, w) = instance transform * (v, w), before the shader's own matrices */
+static void sh4_instance(const spr_shader_instance_t* inst, sh4_vec3_t* v, sh4_t* w) {
+    float r[4][4];
+    sh4_transform(&inst->transform, 4, *v, *w, r);
+    *v = sh4_load3(r[0], r[1], r[2]);
+    *w = sh4_load(r[3]);
+}
+
+/* Transforms a position (w = 1) or direction (w = 0) the way the scalar
+   shaders do: by the instance first, when there is one */
+static void sh4_transform_instanced(const spr_shader_instance_t* inst, const mat4_t* m, int rows, sh4_vec3_t v, float w, float out[4][4]) {
+    sh4_t w4 = sh4_set1(w);
+    if (inst) sh4_instance(inst, &v, &w4);
+    sh4_transform(m, rows, v, w4, out);
+}
+
+#define SH4_GATHER(v, field) sh4_set4((v)[0]->field, (v)[1]->field, (v)[2]->field, (v)[3]->field)
+
+/* STL vertices: position by the MVP and colour, plus the normal by the model
+   matrix when 'normals' is set (spr_shader_constant_vs / spr_shader_matte_vs) */
+static void stl_vs_batch(const spr_shader_uniforms_t* u, const void* vertices, size_t stride, const uint32_t* indices, int count, int normals, spr_vertex_out_t* out) {
+    const spr_shader_instance_t* inst = count > 0 ? shader_instance(u, &out[0]) : NULL; /* One per call */
+    int i, k;
+    for (i = 0; i < count; i += 4) {
+        const stl_vertex_t* v[4];
+        float pos[4][4], nrm[4][4];
+        sh4_vec3_t p;
+        int lanes = count - i < 4 ? count - i : 4;
+
+        /* Lanes past the end repeat the step's first vertex */
+        for (k = 0; k < 4; ++k) v[k] = (const stl_vertex_t*)vs_batch_input(vertices, stride, indices, i + (k < lanes ? k : 0));
+        p.x = SH4_GATHER(v, x); p.y = SH4_GATHER(v, y); p.z = SH4_GATHER(v, z);
+        sh4_transform_instanced(inst, &u->mvp, 4, p, 1.0f, pos);
+        if (normals) {
+            sh4_vec3_t n;
+            n.x = SH4_GATHER(v, nx); n.y = SH4_GATHER(v, ny); n.z = SH4_GATHER(v, nz);
+            sh4_transform_instanced(inst, &u->model, 3, n, 0.0f, nrm);
+        }
+
+        for (k = 0; k < lanes; ++k) {
+            spr_vertex_out_t* o = &out[i + k];
+            o->position.x = pos[0][k]; o->position.y = pos[1][k]; o->position.z = pos[2][k]; o->position.w = pos[3][k];
+            if (normals) {
+                o->normal.x = nrm[0][k]; o->normal.y = nrm[1][k]; o->normal.z = nrm[2][k];
+            }
+            decode_stl_color(v[k]->attr, &o->color);
+            if (inst) tint_instance(inst, &o->color);
+        }
+    }
+}
+
+void spr_shader_constant_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    stl_vs_batch((const spr_shader_uniforms_t*)user_data, vertices, stride, indices, count, 0, out);
+}
+
+void spr_shader_matte_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    stl_vs_batch((const spr_shader_uniforms_t*)user_data, vertices, stride, indices, count, 1, out);
+}
+
+void spr_shader_plastic_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    spr_shader_matte_vs_batch(user_data, vertices, stride, indices, count, out);
+}
+
+void spr_shader_metal_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    spr_shader_matte_vs_batch(user_data, vertices, stride, indices, count, out);
+}
+
+void spr_shader_paintedplastic_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    int k;
+    spr_shader_matte_vs_batch(user_data, vertices, stride, indices, count, out);
+    for (k = 0; k < count; ++k) {
+        const stl_vertex_t* v = (const stl_vertex_t*)vs_batch_input(vertices, stride, indices, k);
+        out[k].uv.x = v->x * 0.05f;
+        out[k].uv.y = v->y * 0.05f;
+    }
+}
+
+void spr_shader_textured_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out) {
+    const spr_shader_uniforms_t* u = (const spr_shader_uniforms_t*)user_data;
+    const spr_shader_instance_t* inst = count > 0 ? shader_instance(u, &out[0]) : NULL; /* One per call */
+    int i, k;
+    for (i = 0; i < count; i += 4) {
+        const spr_vertex_t* v[4];
+        float pos[4][4], nrm[4][4], tan[4][4];
+        sh4_vec3_t a;
+        int lanes = count - i < 4 ? count - i : 4;
+
+        for (k = 0; k < 4; ++k) v[k] = (const spr_vertex_t*)vs_batch_input(vertices, stride, indices, i + (k < lanes ? k : 0));
+        a.x = SH4_GATHER(v, position.x); a.y = SH4_GATHER(v, position.y); a.z = SH4_GATHER(v, position.z);
+        sh4_transform_instanced(inst, &u->mvp, 4, a, 1.0f, pos);
+        a.x = SH4_GATHER(v, normal.x); a.y = SH4_GATHER(v, normal.y); a.z = SH4_GATHER(v, normal.z);
+        sh4_transform_instanced(inst, &u->model, 3, a, 0.0f, nrm);
+        a.x = SH4_GATHER(v, tangent.x); a.y = SH4_GATHER(v, tangent.y); a.z = SH4_GATHER(v, tangent.z);
+        sh4_transform_instanced(inst, &u->model, 3, a, 0.0f, tan);
+
+        for (k = 0; k < lanes; ++k) {
+            spr_vertex_out_t* o = &out[i + k];
+            o->position.x = pos[0][k]; o->position.y = pos[1][k]; o->position.z = pos[2][k]; o->position.w = pos[3][k];
+            o->normal.x = nrm[0][k]; o->normal.y = nrm[1][k]; o->normal.z = nrm[2][k];
+            o->tangent.x = tan[0][k]; o->tangent.y = tan[1][k]; o->tangent.z = tan[2][k];
+            o->tangent.w = v[k]->tangent.w;
+            o->uv = v[k]->uv;
+            o->color.x = 1.0f; o->color.y = 1.0f; o->color.z = 1.0f; o->color.w = 1.0f;
+            if (inst) tint_instance(inst, &o->color);
+        }
+    }
+}
+
+#undef SH4_GATHER
+
+/* --- Varyings --- */
+
+unsigned int spr_shader_varyings(spr_fragment_shader_t fs, const spr_shader_uniforms_t* u) {
+    unsigned int varyings;
+    if (fs == spr_shader_constant_fs) varyings = SPR_SHADER_CONSTANT_VARYINGS;
+    else if (fs == spr_shader_matte_fs) varyings = SPR_SHADER_MATTE_VARYINGS;
+    else if (fs == spr_shader_plastic_fs) varyings = SPR_SHADER_PLASTIC_VARYINGS;
+    else if (fs == spr_shader_metal_fs) varyings = SPR_SHADER_METAL_VARYINGS;
+    else if (fs == spr_shader_paintedplastic_fs) varyings = SPR_SHADER_PAINTEDPLASTIC_VARYINGS;
+    else if (fs == spr_shader_mtl_fs) varyings = SPR_SHADER_MTL_VARYINGS;
+    else return SPR_VARYING_ALL;
+    if (u && u->wireframe > 0) varyings |= SPR_VARYING_BARYCENTRIC;
+    return varyings;
+}
@@ -3,10 +3,17 @@
 
 #include "spr.h"
 
+/* One copy in an instanced draw */
+typedef struct {
+    mat4_t transform;   /* Instance to model space, applied before mvp/model */
+    vec4_t color;       /* Multiplies the vertex colour */
+} spr_shader_instance_t;
+
 /* Standard Uniforms for common shaders */
 typedef struct {
     mat4_t mvp;         /* Model-View-Projection */
     mat4_t model;       /* Model (World) Matrix for normals */
+    const spr_shader_instance_t* instances; /* Indexed by instance id in instanced draws, NULL = none */
     vec3_t light_dir;   /* Direction TO light */
     vec3_t eye_pos;     /* Camera position in World space */
     vec4_t color;       /* Base Color (RGBA) - Alpha often ignored if Opacity used */
@@ -56,6 +63,38 @@ spr_fs_output_t spr_shader_metal_fs(void* user_data, const spr_vertex_out_t* int
 /* --- Full Wavefront MTL Shader --- */
 spr_fs_output_t spr_shader_mtl_fs(void* user_data, const spr_vertex_out_t* interpolated);
 
+/* --- Batch (SoA) Fragment Shaders --- */
+/* Same lighting as the scalar versions, SPR_FS_BATCH fragments per call.
+   Bind with spr_set_fragment_shader_batch() after spr_set_program(). */
+void spr_shader_matte_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out);
+void spr_shader_plastic_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out);
+void spr_shader_metal_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out);
+void spr_shader_mtl_fs_batch(void* user_data, const spr_fs_batch_t* in, spr_fs_batch_output_t* out);
+
+/* --- Batch Vertex Shaders --- */
+/* Same outputs as the scalar versions, bit for bit, four vertices per SIMD
+   step. Bind with spr_set_vertex_shader_batch() after spr_set_program(). */
+void spr_shader_constant_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+void spr_shader_matte_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+void spr_shader_plastic_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+void spr_shader_metal_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+void spr_shader_paintedplastic_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+void spr_shader_textured_vs_batch(void* user_data, const void* vertices, size_t stride, const uint32_t* indices, int count, spr_vertex_out_t* out);
+
+/* --- Varyings --- */
+/* What each built-in fragment shader reads, for spr_set_varyings().
+   Wireframe overlays also need SPR_VARYING_BARYCENTRIC. */
+#define SPR_SHADER_CONSTANT_VARYINGS       (SPR_VARYING_COLOR)
+#define SPR_SHADER_MATTE_VARYINGS          (SPR_VARYING_COLOR | SPR_VARYING_NORMAL)
+#define SPR_SHADER_PLASTIC_VARYINGS        (SPR_VARYING_COLOR | SPR_VARYING_NORMAL)
+#define SPR_SHADER_METAL_VARYINGS          (SPR_VARYING_COLOR | SPR_VARYING_NORMAL)
+#define SPR_SHADER_PAINTEDPLASTIC_VARYINGS (SPR_VARYING_COLOR | SPR_VARYING_NORMAL | SPR_VARYING_UV)
+#define SPR_SHADER_MTL_VARYINGS            (SPR_VARYING_NORMAL | SPR_VARYING_UV | SPR_VARYING_TANGENT)
+
+/* Varyings needed by a built-in fragment shader with the given uniforms
+   (adds barycentrics when wireframe is on). Unknown shaders get SPR_VARYING_ALL. */
+unsigned int spr_shader_varyings(spr_fragment_shader_t fs, const spr_shader_uniforms_t* u);
+
 /* --- Helpers --- */
 void spr_uniforms_set_color(spr_shader_uniforms_t* u, float r, float g, float b, float a);
 void spr_uniforms_set_opacity(spr_shader_uniforms_t* u, float r, float g, float b);
@@ -61,17 +61,82 @@ spr_texture_t* spr_texture_load_from_memory(const uint8_t* data, int size) {
     return tex;
 }
 
+/* Per-thread sample tallies. Workers shading the same texture would race on
+   (and bounce the cache line of) the shared counters, so each thread counts
+   into its own slots and publishes them once per job. */
+#define SPR_SAMPLE_TALLY_SLOTS 8
+
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+#define SPR_TALLY_LOCAL __thread
+#else
+#define SPR_TALLY_LOCAL
+#endif
+
+typedef struct {
+    spr_texture_t* tex;
+    uint64_t count;
+} spr_sample_tally_t;
+
+static SPR_TALLY_LOCAL spr_sample_tally_t tally[SPR_SAMPLE_TALLY_SLOTS];
+static SPR_TALLY_LOCAL int tally_used;
+static SPR_TALLY_LOCAL spr_stats_t* tally_stats;
+static SPR_TALLY_LOCAL uint64_t tally_stats_count;
+
+static void counter_add(uint64_t* counter, uint64_t n) {
+#if defined(SPR_ENABLE_THREADS) && defined(__GNUC__)
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+#else
+    *counter += n;
+#endif
+}
+
+static void flush_texture_tallies(void) {
+    int i;
+    for (i = 0; i < tally_used; ++i) counter_add(&tally[i].tex->sample_count, tally[i].count);
+    tally_used = 0;
+}
+
+void spr_texture_flush_samples(void) {
+    flush_texture_tallies();
+    if (tally_stats) counter_add(&tally_stats->texture_samples, tally_stats_count);
+    tally_stats = NULL;
+    tally_stats_count = 0;
+}
+
+static void tally_sample(spr_texture_t* tex, spr_stats_t* stats) {
+    int i;
+    if (stats) {
+        if (stats != tally_stats) {
+            if (tally_stats) counter_add(&tally_stats->texture_samples, tally_stats_count);
+            tally_stats = stats;
+            tally_stats_count = 0;
+        }
+        tally_stats_count++;
+    }
+    if (!tex) return;
+    for (i = 0; i < tally_used; ++i) {
+        if (tally[i].tex == tex) {
+            tally[i].count++;
+            return;
+        }
+    }
+    if (tally_used == SPR_SAMPLE_TALLY_SLOTS) flush_texture_tallies();
+    tally[tally_used].tex = tex;
+    tally[tally_used].count = 1;
+    tally_used++;
+}
+
 void spr_texture_free(spr_texture_t* tex) {
     if (tex) {
+        spr_texture_flush_samples(); /* Drop this thread's pointer to tex */
         if (tex->pixels) stbi_image_free(tex->pixels);
         free(tex);
     }
 }
 
-vec4_t spr_texture_sample(const spr_texture_t* tex, float u, float v, spr_stats_t* stats) {
+vec4_t spr_texture_sample(spr_texture_t* tex, float u, float v, spr_stats_t* stats) {
     vec4_t c = {1.0f, 1.0f, 1.0f, 1.0f};
-    if (stats) stats->texture_samples++;
-    if (tex) ((spr_texture_t*)tex)->sample_count++;
+    tally_sample(tex, stats);
     
     if (!tex || !tex->pixels) return c;
     
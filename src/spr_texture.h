@@ -23,7 +23,13 @@ void spr_texture_free(spr_texture_t* tex);
 /* Point sampling: maps u,v (0..1) to pixel coordinates. Handles wrapping. */
 /* Returns normalized RGBA (0.0 - 1.0) */
 /* stats is optional (can be NULL) */
-vec4_t spr_texture_sample(const spr_texture_t* tex, float u, float v, spr_stats_t* stats);
+/* Lookups are tallied per thread and added to tex->sample_count and
+   stats->texture_samples by spr_texture_flush_samples(), which the library
+   runs at the end of every worker job and draw call */
+vec4_t spr_texture_sample(spr_texture_t* tex, float u, float v, spr_stats_t* stats);
+
+/* Publishes the calling thread's sample tallies */
+void spr_texture_flush_samples(void);
 
 #else
 
@@ -32,10 +38,11 @@ typedef struct { int unused; } spr_texture_t;
 
 static inline spr_texture_t* spr_texture_load(const char* f) { (void)f; return NULL; }
 static inline void spr_texture_free(spr_texture_t* t) { (void)t; }
-static inline vec4_t spr_texture_sample(const spr_texture_t* t, float u, float v, spr_stats_t* s) { 
+static inline vec4_t spr_texture_sample(spr_texture_t* t, float u, float v, spr_stats_t* s) { 
     (void)t; (void)u; (void)v; (void)s;
     vec4_t c = {1,1,1,1}; return c; 
 }
+static inline void spr_texture_flush_samples(void) {}
 
 #endif /* SPR_ENABLE_TEXTURES */
 
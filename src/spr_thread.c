@@ -0,0 +1,192 @@
+#include "spr_thread.h"
+#include <stdlib.h>
+
+#ifdef SPR_ENABLE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define SPR_MAX_THREADS 256
+
+#ifdef SPR_ENABLE_THREADS
+
+typedef struct {
+    spr_thread_pool_t* pool;
+    int index;
+} spr_worker_arg_t;
+
+struct spr_thread_pool_t {
+    int size; /* Including the calling thread */
+    pthread_t* threads;
+    spr_worker_arg_t* args;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    /* Current batch, published under 'lock' */
+    spr_job_func_t func;
+    void* user_data;
+    int job_count;
+    int next_job;         /* Claimed with an atomic add */
+    int busy_workers;     /* Background workers still inside the batch */
+    unsigned generation;  /* Bumped for every batch */
+    int shutdown;
+};
+
+static void run_jobs(spr_thread_pool_t* pool, int worker_index) {
+    for (;;) {
+        int job = __atomic_fetch_add(&pool->next_job, 1, __ATOMIC_RELAXED);
+        if (job >= pool->job_count) break;
+        pool->func(pool->user_data, job, worker_index);
+    }
+}
+
+static void* worker_main(void* p) {
+    spr_worker_arg_t* arg = (spr_worker_arg_t*)p;
+    spr_thread_pool_t* pool = arg->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_jobs(pool, arg->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy_workers == 0) pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int spr_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    if (n > SPR_MAX_THREADS) return SPR_MAX_THREADS;
+    return (int)n;
+}
+
+spr_thread_pool_t* spr_thread_pool_create(int thread_count) {
+    spr_thread_pool_t* pool;
+    int i;
+
+    if (thread_count <= 0) thread_count = spr_cpu_count();
+    if (thread_count > SPR_MAX_THREADS) thread_count = SPR_MAX_THREADS;
+
+    pool = (spr_thread_pool_t*)calloc(1, sizeof(spr_thread_pool_t));
+    if (!pool) return NULL;
+
+    pool->size = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (thread_count > 1) {
+        pool->threads = (pthread_t*)malloc((thread_count - 1) * sizeof(pthread_t));
+        pool->args = (spr_worker_arg_t*)malloc((thread_count - 1) * sizeof(spr_worker_arg_t));
+        if (pool->threads && pool->args) {
+            for (i = 0; i < thread_count - 1; ++i) {
+                pool->args[i].pool = pool;
+                pool->args[i].index = i + 1;
+                if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]) != 0) break;
+                pool->size++;
+            }
+        }
+    }
+    return pool;
+}
+
+void spr_thread_pool_destroy(spr_thread_pool_t* pool) {
+    int i;
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->size - 1; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->args);
+    free(pool);
+}
+
+int spr_thread_pool_size(const spr_thread_pool_t* pool) {
+    return pool ? pool->size : 1;
+}
+
+void spr_thread_pool_run(spr_thread_pool_t* pool, spr_job_func_t func, void* user_data, int job_count) {
+    int i;
+    if (!func || job_count <= 0) return;
+
+    /* Nothing to share: run inline and skip the wake-up cost */
+    if (!pool || pool->size == 1 || job_count == 1) {
+        for (i = 0; i < job_count; ++i) func(user_data, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->user_data = user_data;
+    pool->job_count = job_count;
+    pool->next_job = 0;
+    pool->busy_workers = pool->size - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_jobs(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_workers > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#else /* !SPR_ENABLE_THREADS */
+
+struct spr_thread_pool_t {
+    int size;
+};
+
+int spr_cpu_count(void) {
+    return 1;
+}
+
+spr_thread_pool_t* spr_thread_pool_create(int thread_count) {
+    spr_thread_pool_t* pool = (spr_thread_pool_t*)malloc(sizeof(spr_thread_pool_t));
+    (void)thread_count;
+    if (pool) pool->size = 1;
+    return pool;
+}
+
+void spr_thread_pool_destroy(spr_thread_pool_t* pool) {
+    free(pool);
+}
+
+int spr_thread_pool_size(const spr_thread_pool_t* pool) {
+    (void)pool;
+    return 1;
+}
+
+void spr_thread_pool_run(spr_thread_pool_t* pool, spr_job_func_t func, void* user_data, int job_count) {
+    int i;
+    (void)pool;
+    if (!func) return;
+    for (i = 0; i < job_count; ++i) func(user_data, i, 0);
+}
+
+#endif /* SPR_ENABLE_THREADS */
@@ -0,0 +1,29 @@
+#ifndef SPR_THREAD_H
+#define SPR_THREAD_H
+
+/* Minimal worker pool used internally by libspr.
+ *
+ * Work is expressed as a number of independent jobs. spr_thread_pool_run()
+ * hands job indices out to the workers and returns once all of them are done.
+ * The calling thread takes part as worker 0, so a pool of size N owns N-1
+ * background threads.
+ *
+ * Threading is compiled in with -DSPR_ENABLE_THREADS (POSIX threads). Without
+ * it the pool always has a single worker and jobs run inline, in order.
+ */
+
+typedef struct spr_thread_pool_t spr_thread_pool_t;
+
+/* job_index: 0..job_count-1, worker_index: 0..spr_thread_pool_size()-1 */
+typedef void (*spr_job_func_t)(void* user_data, int job_index, int worker_index);
+
+/* thread_count <= 0 selects spr_cpu_count() */
+spr_thread_pool_t* spr_thread_pool_create(int thread_count);
+void spr_thread_pool_destroy(spr_thread_pool_t* pool);
+int spr_thread_pool_size(const spr_thread_pool_t* pool);
+void spr_thread_pool_run(spr_thread_pool_t* pool, spr_job_func_t func, void* user_data, int job_count);
+
+/* Number of online CPUs (1 if unknown or threads are disabled) */
+int spr_cpu_count(void);
+
+#endif /* SPR_THREAD_H */